@@ -20,6 +20,7 @@
 #include "AKFS_FileIO.h"
 #include "AKFS_Measure.h"
 #include "AKFS_APIs.h"
+#include <time.h>
 
 /******************************************************************************/
 /*! Initialize #AKMPRMS structure and make APIs ready to use. This function
@@ -60,6 +61,9 @@ int16 AKFS_Init(
 	prms->fv_hs.u.x = AKM_MAG_SENSE;
 	prms->fv_hs.u.y = AKM_MAG_SENSE;
 	prms->fv_hs.u.z = AKM_MAG_SENSE;
+	prms->fva_hsi[0].u.x = 1.0f;
+	prms->fva_hsi[1].u.y = 1.0f;
+	prms->fva_hsi[2].u.z = 1.0f;
 	prms->fv_as.u.x = AKM_ACC_SENSE;
 	prms->fv_as.u.y = AKM_ACC_SENSE;
 	prms->fv_as.u.z = AKM_ACC_SENSE;
@@ -72,6 +76,11 @@ int16 AKFS_Init(
 	/* Copy layout pattern */
 	prms->e_hpat = hpat;
 
+	/* Make transforms and select kernels for measurement data */
+	if (AKFS_UpdateTransform(prms) != AKM_SUCCESS) {
+		return AKM_ERROR;
+	}
+
 	return AKM_SUCCESS;
 }
 
@@ -92,9 +101,219 @@ void AKFS_Release(void *mem)
 	/* Do nothing */
 }
 
+/******************************************************************************/
+/*! Select offset estimation method. This function should be called after
+  #AKFS_Init and before #AKFS_Start. #AKFS_Init selects #AKFS_AOC_4POINTS.
+  @return #AKM_SUCCESS on success. #AKM_ERROR if an error occurred.
+  @param[in/out] mem A pointer to a handler.
+  @param[in] mode Offset estimation method.
+ */
+int16 AKFS_SetAOCMode(void *mem, const AKFS_AOC_MODE mode)
+{
+	AKMPRMS *prms;
+#ifdef AKM_VALUE_CHECK
+	if (mem == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+#endif
+	if ((mode != AKFS_AOC_4POINTS) && (mode != AKFS_AOC_LSQ) &&
+		(mode != AKFS_AOC_ELLIPSOID)) {
+		return AKM_ERROR;
+	}
+	AKMDEBUG(AKMDATA_DUMP, "%s: mode=%d\n", __FUNCTION__, mode);
+
+	/* Copy pointer */
+	prms = (AKMPRMS *)mem;
+
+	prms->e_aocmode = mode;
+
+	return AKM_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Select whether offset is estimated in a worker thread. This function
+  should be called after #AKFS_Init and before #AKFS_Start. The worker is
+  started by #AKFS_Start and stopped by #AKFS_Stop. #AKFS_Init selects
+  synchronous estimation.
+  @return #AKM_SUCCESS on success. #AKM_ERROR if an error occurred.
+  @param[in/out] mem A pointer to a handler.
+  @param[in] enable Non-zero to use a worker thread.
+ */
+int16 AKFS_SetCalibAsync(void *mem, const int16 enable)
+{
+	AKMPRMS *prms;
+#ifdef AKM_VALUE_CHECK
+	if (mem == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+#endif
+	AKMDEBUG(AKMDATA_DUMP, "%s: enable=%d\n", __FUNCTION__, enable);
+
+	/* Copy pointer */
+	prms = (AKMPRMS *)mem;
+
+	prms->i16_calibasync = (enable ? 1 : 0);
+
+	return AKM_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Select how magnetic and acceleration vectors are smoothed. This function
+  should be called after #AKFS_Init and before #AKFS_Start. #AKFS_Init
+  selects #AKFS_FILTER_BOX.
+  @return #AKM_SUCCESS on success. #AKM_ERROR if an error occurred.
+  @param[in/out] mem A pointer to a handler.
+  @param[in] mode Smoothing method.
+ */
+int16 AKFS_SetFilterMode(void *mem, const AKFS_FILTER_MODE mode)
+{
+	AKMPRMS *prms;
+#ifdef AKM_VALUE_CHECK
+	if (mem == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+#endif
+	if ((mode != AKFS_FILTER_BOX) && (mode != AKFS_FILTER_KALMAN) &&
+		(mode != AKFS_FILTER_ADAPTIVE)) {
+		return AKM_ERROR;
+	}
+	AKMDEBUG(AKMDATA_DUMP, "%s: mode=%d\n", __FUNCTION__, mode);
+
+	/* Copy pointer */
+	prms = (AKMPRMS *)mem;
+
+	prms->e_filter = mode;
+
+	return AKM_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Select whether stillness of the device is detected. While the device is
+  still, offset estimation and direction calculation are skipped, and the
+  last results are returned. This function should be called after
+  #AKFS_Init and before #AKFS_Start. #AKFS_Init disables detection.
+  @return #AKM_SUCCESS on success. #AKM_ERROR if an error occurred.
+  @param[in/out] mem A pointer to a handler.
+  @param[in] enable Non-zero to enable detection.
+ */
+int16 AKFS_SetStillDetect(void *mem, const int16 enable)
+{
+	AKMPRMS *prms;
+#ifdef AKM_VALUE_CHECK
+	if (mem == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+#endif
+	AKMDEBUG(AKMDATA_DUMP, "%s: enable=%d\n", __FUNCTION__, enable);
+
+	/* Copy pointer */
+	prms = (AKMPRMS *)mem;
+
+	prms->i16_stilldet = (enable ? 1 : 0);
+
+	return AKM_SUCCESS;
+}
+
+/*!
+  Initialize state which depends on the latest vectors, i.e. buffers for
+  averaging, filters and stillness detection. Offset and the state of its
+  estimation are not changed.
+  @return The return value is #AKM_SUCCESS. Otherwise the return value is
+   #AKM_ERROR.
+  @param[in/out] prms A pointer to #AKMPRMS structure.
+ */
+static int16 InitSession(AKMPRMS *prms)
+{
+	const int16 hnave[2] = {CSPEC_HNAVE_D, CSPEC_HNAVE_V};
+	const int16 anave[2] = {CSPEC_ANAVE_D, CSPEC_ANAVE_V};
+
+	/* Offset may be changed */
+	if (AKFS_UpdateTransform(prms) != AKM_SUCCESS) {
+		return AKM_ERROR;
+	}
+
+	/* Initialize buffer */
+	AKFS_InitRBuf(AKFS_HDATA_SIZE, &prms->fva_hvbuf);
+	AKFS_InitRBuf(AKFS_ADATA_SIZE, &prms->fva_avbuf);
+
+	/* Initialize running sums for averaging */
+	if (AKFS_InitVbAve(&prms->fva_hvbuf, 2, hnave, &prms->s_hvave) != AKFS_SUCCESS) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+	if (AKFS_InitVbAve(&prms->fva_avbuf, 2, anave, &prms->s_avave) != AKFS_SUCCESS) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+
+	/* Initialize recursive filters, which have the same noise level as
+	   the averaging above */
+	if (prms->e_filter == AKFS_FILTER_KALMAN) {
+		if ((AKFS_InitVFilt(CSPEC_HNAVE_D, CSPEC_HNOISE, &prms->s_hfilt[0]) != AKFS_SUCCESS) ||
+			(AKFS_InitVFilt(CSPEC_HNAVE_V, CSPEC_HNOISE, &prms->s_hfilt[1]) != AKFS_SUCCESS) ||
+			(AKFS_InitVFilt(CSPEC_ANAVE_D, CSPEC_ANOISE, &prms->s_afilt[0]) != AKFS_SUCCESS) ||
+			(AKFS_InitVFilt(CSPEC_ANAVE_V, CSPEC_ANOISE, &prms->s_afilt[1]) != AKFS_SUCCESS)) {
+			AKMERROR;
+			return AKM_ERROR;
+		}
+	}
+
+	/* Averaging starts with the longest length */
+	prms->i16a_hnave[0] = CSPEC_HNAVE_D;
+	prms->i16a_hnave[1] = CSPEC_HNAVE_V;
+	prms->i16a_anave[0] = CSPEC_ANAVE_D;
+	prms->i16a_anave[1] = CSPEC_ANAVE_V;
+	AKFS_InitVVar(CSPEC_HNAVE_V, &prms->s_hvar);
+	AKFS_InitVVar(CSPEC_ANAVE_V, &prms->s_avar);
+
+	/* Device is regarded as moving until enough vectors are measured */
+	prms->i16_hstillcnt = 0;
+	prms->i16_astillcnt = 0;
+	prms->i16_dircache = 0;
+
+	return AKM_SUCCESS;
+}
+
+/*!
+  Take a snapshot of offset, soft iron matrix, accuracy and radius, which
+  are the same as the setting file.
+  @param[in/out] prms A pointer to #AKMPRMS structure.
+ */
+static void SnapSaved(AKMPRMS *prms)
+{
+	int i;
+
+	prms->s_saved.ho = prms->fv_ho;
+	for (i = 0; i < 3; i++) {
+		prms->s_saved.hsi[i] = prms->fva_hsi[i];
+	}
+	prms->i16_savedstatus = prms->i16_hstatus;
+	prms->s_saved.hr = prms->f_hr;
+	prms->i16_savedvalid = 1;
+}
+
+/*!
+  Let the next vectors check the accuracy which is kept from the last
+  sequence. The state of estimators must not be owned by the worker.
+  @param[in/out] prms A pointer to #AKMPRMS structure.
+ */
+static void ArmWarmCheck(AKMPRMS *prms)
+{
+	prms->i16_aocreset = 0;
+	prms->f_warmhr = prms->f_hr;
+	prms->i16_warmcheck = (prms->i16_hstatus > 0) ? CSPEC_WARM_NCHECK : 0;
+}
+
 /******************************************************************************/
 /* This function is called just before a measurement sequence starts.
-  Load parameters from a file and initialize library. This function must be
+  Load parameters from a file and initialize library. When the file has the
+  history of AOC and accuracy, they are restored, so that the accuracy is
+  reported from the first vector. It is checked with the first
+  #CSPEC_WARM_NCHECK vectors. This function must be
   called when a sequential measurement thread boots up.
   @return The return value is #AKM_SUCCESS.
   @param[in/out] mem A pointer to a handler.
@@ -104,6 +323,8 @@ void AKFS_Release(void *mem)
 int16 AKFS_Start(void *mem, const char *path)
 {
 	AKMPRMS *prms;
+	long now;
+	int16 migrate;
 #ifdef AKM_VALUE_CHECK
 	if (mem == NULL || path == NULL) {
 		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
@@ -115,28 +336,114 @@ int16 AKFS_Start(void *mem, const char *path)
 	/* Copy pointer */
 	prms = (AKMPRMS *)mem;
 
-	/* Read setting files from a file */
-	if (AKFS_LoadParameters(prms, path) != AKM_SUCCESS) {
-		AKMERROR_STR("AKFS_LoadParameters");
-	}
-
-	/* Initialize buffer */
-	AKFS_InitBuffer(AKFS_HDATA_SIZE, prms->fva_hdata);
-	AKFS_InitBuffer(AKFS_HDATA_SIZE, prms->fva_hvbuf);
-	AKFS_InitBuffer(AKFS_ADATA_SIZE, prms->fva_avbuf);
-
 	/* Initialize for AOC */
+	AKFS_InitRBuf(AKFS_HDATA_SIZE, &prms->fva_hdata);
 	AKFS_InitAOC(&prms->s_aocv);
+	AKFS_InitSphereFit(&prms->s_lsqv);
+	AKFS_InitEllipsoidFit(&prms->s_ellv);
 	/* Initialize magnetic status */
 	prms->i16_hstatus = 0;
+	prms->l_savedtime = 0;
+	prms->f_hr = 0.0f;
+
+	/* Read setting files from a file. History of AOC and accuracy are
+	   restored as well, if the file has them. A text file of the former
+	   format is converted to the setting file. */
+	prms->i16_savedvalid = 0;
+	migrate = 0;
+	if (AKFS_LoadParameters(prms, path) == AKM_SUCCESS) {
+		SnapSaved(prms);
+	} else if (AKFS_LoadOldParameters(prms, path) == AKM_SUCCESS) {
+		migrate = 1;
+	} else {
+		AKMERROR_STR("AKFS_LoadParameters");
+	}
+
+	/* Too old state is not trusted */
+	now = (long)time(NULL);
+	if ((prms->i16_hstatus > 0) &&
+		((now < prms->l_savedtime) || (now - prms->l_savedtime > CSPEC_WARM_AGE))) {
+		AKMDEBUG(AKMDATA_DUMP, "%s: saved state is expired\n", __FUNCTION__);
+		AKFS_InitAOC(&prms->s_aocv);
+		prms->i16_hstatus = 0;
+		prms->f_hr = 0.0f;
+	}
+	ArmWarmCheck(prms);
+
+	/* Converted file is saved now, otherwise by AKFS_Stop */
+	if (migrate) {
+		if (AKFS_SaveParameters(prms, path) != AKM_SUCCESS) {
+			AKMERROR_STR("AKFS_SaveParameters");
+		} else {
+			SnapSaved(prms);
+			if (AKFS_RetireOldParameters(path) != AKM_SUCCESS) {
+				AKMERROR_STR("AKFS_RetireOldParameters");
+			}
+		}
+	}
+
+	if (InitSession(prms) != AKM_SUCCESS) {
+		return AKM_ERROR;
+	}
+
+	/* Estimators are owned by the worker from here */
+	if (prms->i16_calibasync) {
+		if (AKFS_StartAsyncCalib(prms) != AKM_SUCCESS) {
+			AKMERROR_STR("AKFS_StartAsyncCalib");
+		}
+	}
+
+	return AKM_SUCCESS;
+}
+
+/******************************************************************************/
+/*! This function is called instead of #AKFS_Start when a measurement
+  sequence starts again after #AKFS_Stop. The setting file is not read, and
+  offset, its accuracy and the state of offset estimation are kept in memory,
+  so the estimation continues from the last sequence. Only the state which
+  depends on the latest vectors is initialized, and the accuracy is checked
+  again as #AKFS_Start does.
+  @return The return value is #AKM_SUCCESS. Otherwise the return value is
+   #AKM_ERROR.
+  @param[in/out] mem A pointer to a handler.
+ */
+int16 AKFS_Resume(void *mem)
+{
+	AKMPRMS *prms;
+#ifdef AKM_VALUE_CHECK
+	if (mem == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+#endif
+	AKMDEBUG(AKMDATA_DUMP, "%s: status=%d\n", __FUNCTION__,
+		((AKMPRMS *)mem)->i16_hstatus);
+
+	/* Copy pointer */
+	prms = (AKMPRMS *)mem;
+
+	/* The device may be moved to another field while it is stopped */
+	ArmWarmCheck(prms);
+
+	if (InitSession(prms) != AKM_SUCCESS) {
+		return AKM_ERROR;
+	}
+
+	/* Estimators are owned by the worker from here */
+	if (prms->i16_calibasync) {
+		if (AKFS_StartAsyncCalib(prms) != AKM_SUCCESS) {
+			AKMERROR_STR("AKFS_StartAsyncCalib");
+		}
+	}
 
 	return AKM_SUCCESS;
 }
 
 /******************************************************************************/
 /*! This function is called when a measurement sequence is done.
-  Save parameters to a file. This function must be called when a sequential
-  measurement thread ends.
+  Save parameters to a file, only if they differ from the file, so that the
+  file is not rewritten at every sequence. This function must be called when
+  a sequential measurement thread ends.
   @return The return value is #AKM_SUCCESS.
   @param[in/out] mem A pointer to a handler.
   @param[in] path The path to a setting file to be written. The path name
@@ -145,6 +452,8 @@ int16 AKFS_Start(void *mem, const char *path)
 int16 AKFS_Stop(void *mem, const char *path)
 {
 	AKMPRMS *prms;
+	long	now;
+	int		refresh;
 #ifdef AKM_VALUE_CHECK
 	if (mem == NULL || path == NULL) {
 		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
@@ -156,9 +465,32 @@ int16 AKFS_Stop(void *mem, const char *path)
 	/* Copy pointer */
 	prms = (AKMPRMS *)mem;
 
+	/* Take the last result of the worker, if it is running */
+	AKFS_StopAsyncCalib(prms);
+
+	/* Restored history may be found wrong after the worker has stopped */
+	if (prms->i16_aocreset) {
+		AKFS_ResetEstimator(prms);
+	}
+
+	/* Accuracy which passed the warm check is saved again before it expires,
+	   even if nothing is changed */
+	now = (long)time(NULL);
+	refresh = ((prms->i16_hstatus > 0) && (prms->i16_warmcheck == 0) &&
+		((now < prms->l_savedtime) ||
+		 (now - prms->l_savedtime > CSPEC_WARM_REFRESH)));
+
 	/* Write setting files to a file */
-	if (AKFS_SaveParameters(prms, path) != AKM_SUCCESS) {
+	if (!refresh && prms->i16_savedvalid &&
+		(memcmp(&prms->s_saved.ho, &prms->fv_ho, sizeof(AKFVEC)) == 0) &&
+		(memcmp(prms->s_saved.hsi, prms->fva_hsi, sizeof(prms->fva_hsi)) == 0) &&
+		(prms->i16_savedstatus == prms->i16_hstatus) &&
+		(prms->s_saved.hr == prms->f_hr)) {
+		AKMDEBUG(AKMDATA_DUMP, "%s: not changed\n", __FUNCTION__);
+	} else if (AKFS_SaveParameters(prms, path) != AKM_SUCCESS) {
 		AKMERROR_STR("AKFS_SaveParameters");
+	} else {
+		SnapSaved(prms);
 	}
 
 	return AKM_SUCCESS;
@@ -263,6 +595,109 @@ int16 AKFS_Get_ACCELEROMETER(
 	return AKM_SUCCESS;
 }
 
+/*!
+  Batch version of #AKFS_Get_MAGNETIC_FIELD. Samples are processed in order,
+  and the result is the same as calling #AKFS_Get_MAGNETIC_FIELD n times,
+  except rounding of conversion, see #AKFS_Set_MAGNETIC_FIELD_Batch.
+  Arguments are checked only once for the whole batch. Output arrays have
+  one entry for each input sample, so timestamps of the input can be
+  associated by index. When a sample fails, e.g. because of the status,
+  its accuracy is set to -1 and its vector holds the last valid output.
+  @return The number of samples which are processed successfully. When
+   arguments are invalid, the return value is #AKM_ERROR.
+  @param[in/out] mem A pointer to a handler.
+  @param[in] n The number of samples.
+  @param[in] mag Measurement data from magnetometer, see #AKFS_Get_MAGNETIC_FIELD.
+  @param[in] status Status of each measurement data.
+  @param[out] hvec Magnetic field vectors.
+  @param[out] accuracy Accuracy of each vector.
+ */
+int16 AKFS_Get_MAGNETIC_FIELD_Batch(
+			void		*mem,
+	const	int16		n,
+	const	int16		mag[][3],
+	const	int16		status[],
+			AKFVEC		hvec[],
+			int16		accuracy[]
+)
+{
+	AKMPRMS *prms;
+#ifdef AKM_VALUE_CHECK
+	if (mem == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+	if (mag == NULL || status == NULL || hvec == NULL || accuracy == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid data pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+#endif
+	if (n < 0) {
+		return AKM_ERROR;
+	}
+
+	/* Copy pointer */
+	prms = (AKMPRMS *)mem;
+
+	return AKFS_Set_MAGNETIC_FIELD_Batch(prms, n, mag, status, hvec, accuracy);
+}
+
+/*!
+  Batch version of #AKFS_Get_ACCELEROMETER. Samples are processed in order,
+  and the result is identical to calling #AKFS_Get_ACCELEROMETER n times.
+  See #AKFS_Get_MAGNETIC_FIELD_Batch for the handling of failed samples.
+  @return The number of samples which are processed successfully. When
+   arguments are invalid, the return value is #AKM_ERROR.
+  @param[in/out] mem A pointer to a handler.
+  @param[in] n The number of samples.
+  @param[in] acc Measurement data from accelerometer, see #AKFS_Get_ACCELEROMETER.
+  @param[in] status Status of each measurement data.
+  @param[out] avec Acceleration vectors.
+  @param[out] accuracy Accuracy of each vector.
+ */
+int16 AKFS_Get_ACCELEROMETER_Batch(
+			void		*mem,
+	const	int16		n,
+	const	int16		acc[][3],
+	const	int16		status[],
+			AKFVEC		avec[],
+			int16		accuracy[]
+)
+{
+	AKMPRMS *prms;
+	int16 i;
+	int16 nsuccess;
+#ifdef AKM_VALUE_CHECK
+	if (mem == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+	if (acc == NULL || status == NULL || avec == NULL || accuracy == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid data pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+#endif
+	if (n < 0) {
+		return AKM_ERROR;
+	}
+
+	/* Copy pointer */
+	prms = (AKMPRMS *)mem;
+
+	nsuccess = 0;
+	for (i = 0; i < n; i++) {
+		if (AKFS_Set_ACCELEROMETER(prms, acc[i], status[i]) == AKM_SUCCESS) {
+			accuracy[i] = 3;
+			nsuccess++;
+		} else {
+			accuracy[i] = -1;
+		}
+		avec[i] = prms->fv_avec;
+	}
+
+	return nsuccess;
+}
+
 /*!
   Get orientation sensor's elements. The vector format and coordination system
    follow the Android definition.  Before this function is called, magnetic
@@ -285,6 +720,7 @@ int16 AKFS_Get_ORIENTATION(
 {
 	int16 akret;
 	AKMPRMS *prms;
+	AKFVEC hvec, avec;
 #ifdef AKM_VALUE_CHECK
 	if (mem == NULL) {
 		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
@@ -299,21 +735,30 @@ int16 AKFS_Get_ORIENTATION(
 	/* Copy pointer */
 	prms = (AKMPRMS *)mem;
 
-	/* Azimuth calculation */
+	/* The last result is valid while the device is still */
+	if (AKFS_IsStill(prms) && (prms->i16_dircache & AKFS_DIRCACHE_ORI)) {
+		goto ORI_OUTPUT;
+	}
+
+	/* Averaging */
 	/* hvbuf[in] : Android coordinate, sensitivity adjusted, */
 	/*			   offset subtracted. */
 	/* avbuf[in] : Android coordinate, sensitivity adjusted, */
 	/*			   offset subtracted. */
+	/* hvec [out]: averaged, or filtered. */
+	/* avec [out]: averaged, or filtered. */
+	if (AKFS_GetDirVectors(prms, &hvec, &avec) != AKM_SUCCESS) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+
+	/* Azimuth calculation */
 	/* azimuth[out]: Android coordinate and unit (degree). */
 	/* pitch  [out]: Android coordinate and unit (degree). */
 	/* roll   [out]: Android coordinate and unit (degree). */
 	akret = AKFS_Direction(
-		AKFS_HDATA_SIZE,
-		prms->fva_hvbuf,
-		CSPEC_HNAVE_D,
-		AKFS_ADATA_SIZE,
-		prms->fva_avbuf,
-		CSPEC_ANAVE_D,
+		&hvec,
+		&avec,
 		&prms->f_azimuth,
 		&prms->f_pitch,
 		&prms->f_roll
@@ -323,7 +768,9 @@ int16 AKFS_Get_ORIENTATION(
 		AKMERROR;
 		return AKM_ERROR;
 	}
+	prms->i16_dircache |= AKFS_DIRCACHE_ORI;
 
+ORI_OUTPUT:
 	/* Success */
 	*azimuth = prms->f_azimuth;
 	*pitch   = prms->f_pitch;
@@ -337,3 +784,83 @@ int16 AKFS_Get_ORIENTATION(
 	return AKM_SUCCESS;
 }
 
+/*!
+  Get rotation vector sensor's elements. The vector format and coordination
+   system follow the Android definition, i.e. a unit quaternion which rotates
+   the device coordinate to the world coordinate (east, north, up). Before
+   this function is called, magnetic field vector and acceleration vector
+   should be stored in the buffer by calling #AKFS_Get_MAGNETIC_FIELD and
+   #AKFS_Get_ACCELEROMETER.
+  @return The return value is #AKM_SUCCESS when function succeeds. Otherwise
+   the return value is #AKM_ERROR.
+  @param[out] x X element of the quaternion, i.e. x*sin(theta/2).
+  @param[out] y Y element of the quaternion, i.e. y*sin(theta/2).
+  @param[out] z Z element of the quaternion, i.e. z*sin(theta/2).
+  @param[out] w Scalar element of the quaternion, i.e. cos(theta/2).
+  @param[out] accuracy Accuracy of rotation vector sensor.
+ */
+int16 AKFS_Get_ROTATION_VECTOR(
+			void		*mem,
+			AKFLOAT		*x,
+			AKFLOAT		*y,
+			AKFLOAT		*z,
+			AKFLOAT		*w,
+			int16		*accuracy
+)
+{
+	int16 akret;
+	AKMPRMS *prms;
+	AKFVEC hvec, avec;
+#ifdef AKM_VALUE_CHECK
+	if (mem == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid mem pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+	if (x == NULL || y == NULL || z == NULL || w == NULL || accuracy == NULL) {
+		AKMDEBUG(AKMDATA_CHECK, "%s: Invalid data pointer.", __FUNCTION__);
+		return AKM_ERROR;
+	}
+#endif
+
+	/* Copy pointer */
+	prms = (AKMPRMS *)mem;
+
+	/* The last result is valid while the device is still */
+	if (AKFS_IsStill(prms) && (prms->i16_dircache & AKFS_DIRCACHE_RV)) {
+		goto RV_OUTPUT;
+	}
+
+	/* Averaging, see AKFS_Get_ORIENTATION */
+	if (AKFS_GetDirVectors(prms, &hvec, &avec) != AKM_SUCCESS) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+
+	/* Rotation vector calculation */
+	/* quat  [out]: Android coordinate, unit quaternion. */
+	akret = AKFS_RotationVector(
+		&hvec,
+		&avec,
+		prms->fa_quat
+	);
+
+	if (akret == AKFS_ERROR) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+	prms->i16_dircache |= AKFS_DIRCACHE_RV;
+
+RV_OUTPUT:
+	/* Success */
+	*x = prms->fa_quat[0];
+	*y = prms->fa_quat[1];
+	*z = prms->fa_quat[2];
+	*w = prms->fa_quat[3];
+	*accuracy = 3;
+
+	/* Debug output */
+	AKMDEBUG(AKMDATA_ORI, "RotVec(?):%8.4f, %8.4f, %8.4f, %8.4f\n",
+			*x, *y, *z, *w);
+
+	return AKM_SUCCESS;
+}
@@ -37,8 +37,18 @@ int16 AKFS_Init(
 
 void AKFS_Release(void *mem);
 
+int16 AKFS_SetAOCMode(void *mem, const AKFS_AOC_MODE mode);
+
+int16 AKFS_SetCalibAsync(void *mem, const int16 enable);
+
+int16 AKFS_SetFilterMode(void *mem, const AKFS_FILTER_MODE mode);
+
+int16 AKFS_SetStillDetect(void *mem, const int16 enable);
+
 int16 AKFS_Start(void *mem, const char *path);
 
+int16 AKFS_Resume(void *mem);
+
 int16 AKFS_Stop(void *mem, const char *path);
 
 int16 AKFS_Get_MAGNETIC_FIELD(
@@ -61,6 +71,24 @@ int16 AKFS_Get_ACCELEROMETER(
 			int16		*accuracy
 );
 
+int16 AKFS_Get_MAGNETIC_FIELD_Batch(
+			void		*mem,
+	const	int16		n,
+	const	int16		mag[][3],
+	const	int16		status[],
+			AKFVEC		hvec[],
+			int16		accuracy[]
+);
+
+int16 AKFS_Get_ACCELEROMETER_Batch(
+			void		*mem,
+	const	int16		n,
+	const	int16		acc[][3],
+	const	int16		status[],
+			AKFVEC		avec[],
+			int16		accuracy[]
+);
+
 int16 AKFS_Get_ORIENTATION(
 			void		*mem,
 			AKFLOAT		*azimuth,
@@ -69,5 +97,14 @@ int16 AKFS_Get_ORIENTATION(
 			int16		*accuracy
 );
 
+int16 AKFS_Get_ROTATION_VECTOR(
+			void		*mem,
+			AKFLOAT		*x,
+			AKFLOAT		*y,
+			AKFLOAT		*z,
+			AKFLOAT		*w,
+			int16		*accuracy
+);
+
 #endif
 
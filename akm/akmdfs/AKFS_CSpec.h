@@ -27,11 +27,48 @@
 #define CSPEC_ANAVE_D	4
 #define CSPEC_HNAVE_V	8
 #define CSPEC_ANAVE_V	8
+/*	The shortest average when the number is adapted to the motion. */
+/*	The longest is the number above. */
+#define CSPEC_HNAVE_MIN	1
+#define CSPEC_ANAVE_MIN	1
 
+/* Parameters for recursive filter */
+/*	Variance of the measurement noise of each axis, used by AKFS_VFILT. */
+/*	Magnetic field in uT^2, acceleration in (m/s^2)^2. */
+#define CSPEC_HNOISE	0.09f
+#define CSPEC_ANOISE	0.0016f
+
+/* Parameters for stillness detection */
+/*	A vector which moves more than this from the reference in any axis */
+/*	means motion. Magnetic field in uT, acceleration in m/s^2. */
+#define CSPEC_STILL_HTH	1.2f
+#define CSPEC_STILL_ATH	0.2f
+/*	The number of vectors within the threshold to be regarded as still. */
+#define CSPEC_STILL_CNT	16
+/*	While the device is still, magnetometer is measured once in this */
+/*	number of loops. Accelerometer is still measured every loop. */
+#define CSPEC_STILL_HINTERVAL	8
+
+/* Parameters for warm start */
+/*	The number of magnetic vectors which are compared with the radius of */
+/*	the restored offset. Accuracy in the setting file is reported from the */
+/*	first vector, and it is discarded if any of them is off the sphere. */
+#define CSPEC_WARM_NCHECK	4
+/*	Allowed difference between the size of a vector and the radius, */
+/*	relative to the radius. */
+#define CSPEC_WARM_RTH	0.25f
+/*	Accuracy in a setting file older than this (sec) is not restored. */
+#define CSPEC_WARM_AGE	(7 * 24 * 60 * 60)
+/*	The time in a setting file is refreshed after this (sec), when the */
+/*	accuracy is confirmed again, so good accuracy does not expire. */
+#define CSPEC_WARM_REFRESH	(CSPEC_WARM_AGE / 4)
+
+/* Setting file. The text file which was used before has the extension */
+/* ".txt" instead, and it is read only when the setting file does not exist. */
 #ifdef WIN32
-#define CSPEC_SETTING_FILE	"akmdfs.txt"
+#define CSPEC_SETTING_FILE	"akmdfs.bin"
 #else
-#define CSPEC_SETTING_FILE	"/data/misc/akmdfs.txt"
+#define CSPEC_SETTING_FILE	"/data/misc/akmdfs.bin"
 #endif
 
 #endif
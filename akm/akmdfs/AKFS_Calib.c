@@ -0,0 +1,268 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include "AKFS_Common.h"
+#include "AKFS_Calib.h"
+#include <sched.h>
+#include <sys/eventfd.h>
+
+/*** Constant definition ******************************************************/
+#define AKFS_CALIB_QMASK	(AKFS_CALIB_QSIZE - 1)
+
+/* Full memory barrier. */
+#define AKFS_BARRIER()		__sync_synchronize()
+
+/*** Static function **********************************************************/
+/*!
+ Publish the working copy of the worker to the sample path.
+ @param[in/out] calib A pointer to #AKFS_CALIB structure.
+ */
+static void PublishResult(AKFS_CALIB *calib)
+{
+	calib->res[calib->back] = calib->cur;
+	AKFS_BARRIER();
+	calib->back = __sync_lock_test_and_set(
+		&calib->mid, calib->back | AKFS_CALIB_FRESH) & ~AKFS_CALIB_FRESH;
+}
+
+/*!
+ Undo real-time settings which the worker inherits from the thread that
+ started it, i.e. SCHED_FIFO and the CPU pin of the measurement thread.
+ Estimation is not time critical, and it must not compete with the sample
+ path on its CPU.
+ */
+static void ResetScheduling(void)
+{
+	struct sched_param param;
+	cpu_set_t cpus;
+	long ncpu;
+	long cpu;
+
+	memset(&param, 0, sizeof(param));
+	if (sched_setscheduler(0, SCHED_OTHER, &param) < 0) {
+		AKMERROR_STR("sched_setscheduler");
+	}
+	ncpu = sysconf(_SC_NPROCESSORS_CONF);
+	CPU_ZERO(&cpus);
+	for (cpu = 0; (cpu < ncpu) && (cpu < CPU_SETSIZE); cpu++) {
+		CPU_SET(cpu, &cpus);
+	}
+	/* Zero means the calling thread, not the whole process */
+	if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+		AKMERROR_STR("sched_setaffinity");
+	}
+}
+
+/*!
+ Main loop of the worker thread. Queued candidates are passed to the
+ estimator one by one, and every successful estimation is published. When
+ the queue is empty, the worker sleeps until #AKFS_PushCalib queues a
+ candidate or #AKFS_StopCalib is called.
+ @return Always NULL.
+ @param[in] args A pointer to #AKFS_CALIB structure.
+ */
+static void* calib_main(void *args)
+{
+	AKFS_CALIB *calib = (AKFS_CALIB *)args;
+	AKFVEC hdata;
+	unsigned int tail;
+	uint64_t val;
+
+	ResetScheduling();
+
+	while (!calib->stop) {
+		tail = calib->qtail;
+		while (tail != calib->qhead) {
+			AKFS_BARRIER();
+			hdata = calib->q[tail & AKFS_CALIB_QMASK];
+			AKFS_BARRIER();
+			calib->qtail = ++tail;
+			/* qtail must be visible before qhead is read again,
+			   see AKFS_PushCalib. */
+			AKFS_BARRIER();
+
+			if (calib->func(calib->arg, &hdata, &calib->cur) == AKFS_SUCCESS) {
+				PublishResult(calib);
+			}
+		}
+
+		/* Wait for the next candidate, counter is reset by read */
+		if ((read(calib->evfd, &val, sizeof(val)) < 0) && (errno != EINTR)) {
+			AKMERROR_STR("read");
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/*** Function *****************************************************************/
+/*!
+ Start a worker thread which runs an offset estimator off the sample path.
+ @return #AKM_SUCCESS on success. #AKM_ERROR if the thread could not be
+  started. In that case, the caller should estimate offset synchronously.
+ @param[out] calib A pointer to #AKFS_CALIB structure.
+ @param[in] func An estimator.
+ @param[in] arg An argument which is passed to func.
+ @param[in] init Current offset and soft iron matrix.
+ @param[in] step Minimum distance (uT) from the last queued candidate to
+  queue a new one. 0 queues every vector.
+ */
+int16 AKFS_StartCalib(
+			AKFS_CALIB			*calib,
+			AKFS_CALIB_FUNC		func,
+			void				*arg,
+	const	AKFS_CALIB_RESULT	*init,
+	const	AKFLOAT				step
+)
+{
+	int i;
+
+	calib->qhead = 0;
+	calib->qtail = 0;
+	calib->ndrop = 0;
+	calib->step = step;
+	for (i = 0; i < 3; i++) {
+		calib->res[i] = *init;
+	}
+	calib->cur = *init;
+	calib->back = 0;
+	calib->mid = 1;
+	calib->front = 2;
+	calib->func = func;
+	calib->arg = arg;
+	calib->stop = 0;
+	calib->running = 0;
+
+	calib->evfd = eventfd(0, 0);
+	if (calib->evfd < 0) {
+		AKMERROR_STR("eventfd");
+		return AKM_ERROR;
+	}
+	if (pthread_create(&calib->thread, NULL, calib_main, calib) != 0) {
+		AKMERROR_STR("pthread_create");
+		close(calib->evfd);
+		return AKM_ERROR;
+	}
+	calib->running = 1;
+
+	return AKM_SUCCESS;
+}
+
+/*!
+ Stop the worker thread. Candidates which are not processed yet are
+ discarded. A result which is published before the worker stops can still
+ be picked up with #AKFS_PollCalib.
+ @param[in/out] calib A pointer to #AKFS_CALIB structure.
+ */
+void AKFS_StopCalib(
+			AKFS_CALIB			*calib
+)
+{
+	uint64_t val = 1;
+
+	if (!calib->running) {
+		return;
+	}
+	calib->stop = 1;
+	AKFS_BARRIER();
+	if (write(calib->evfd, &val, sizeof(val)) < 0) {
+		AKMERROR_STR("write");
+	}
+	pthread_join(calib->thread, NULL);
+	close(calib->evfd);
+	calib->running = 0;
+
+	AKMDEBUG(AKMDATA_DEBUG, "%s: dropped=%u\n", __FUNCTION__, calib->ndrop);
+}
+
+/*!
+ Queue a candidate vector for the worker. This function never blocks.
+ A vector which is closer than the step of #AKFS_StartCalib to the last
+ queued one is not queued, and a vector is dropped when the queue is full.
+ The worker is woken up only when the queue was empty, so a busy worker
+ costs no system call.
+ @return #AKM_SUCCESS if the vector is queued. Otherwise #AKM_ERROR.
+ @param[in/out] calib A pointer to #AKFS_CALIB structure.
+ @param[in] hdata A magnetic vector, Android coordinate, sensitivity adjusted.
+ */
+int16 AKFS_PushCalib(
+			AKFS_CALIB			*calib,
+	const	AKFVEC				*hdata
+)
+{
+	unsigned int head;
+	uint64_t val = 1;
+	AKFLOAT d;
+	AKFLOAT t;
+	int i;
+
+	head = calib->qhead;
+	if ((calib->step > 0.0f) && (head != 0)) {
+		d = 0.0f;
+		for (i = 0; i < 3; i++) {
+			t = hdata->v[i] - calib->last.v[i];
+			d += t * t;
+		}
+		if (d < (calib->step * calib->step)) {
+			return AKM_ERROR;
+		}
+	}
+	if ((head - calib->qtail) >= AKFS_CALIB_QSIZE) {
+		calib->ndrop++;
+		return AKM_ERROR;
+	}
+
+	calib->q[head & AKFS_CALIB_QMASK] = *hdata;
+	calib->last = *hdata;
+	AKFS_BARRIER();
+	calib->qhead = head + 1;
+	AKFS_BARRIER();
+
+	/* Either the worker sees the new qhead before it sleeps, or this sees
+	   qtail which the worker stored before it read qhead. */
+	if ((calib->qtail == head) &&
+		(write(calib->evfd, &val, sizeof(val)) < 0)) {
+		AKMERROR_STR("write");
+	}
+
+	return AKM_SUCCESS;
+}
+
+/*!
+ Pick up the latest result of the worker, if any.
+ @return #AKM_SUCCESS if a new result is stored in res. Otherwise
+  #AKM_ERROR, and res is not changed.
+ @param[in/out] calib A pointer to #AKFS_CALIB structure.
+ @param[out] res The latest result.
+ */
+int16 AKFS_PollCalib(
+			AKFS_CALIB			*calib,
+			AKFS_CALIB_RESULT	*res
+)
+{
+	if ((calib->mid & AKFS_CALIB_FRESH) == 0) {
+		return AKM_ERROR;
+	}
+	calib->front = __sync_lock_test_and_set(&calib->mid, calib->front)
+		& ~AKFS_CALIB_FRESH;
+	AKFS_BARRIER();
+	*res = calib->res[calib->front];
+
+	return AKM_SUCCESS;
+}
+
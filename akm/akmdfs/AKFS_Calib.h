@@ -0,0 +1,108 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_CALIB_H
+#define AKFS_INC_CALIB_H
+
+#include <pthread.h>
+
+/* Include file for AKM OSS library. */
+#include "./libAKM_OSS/AKFS_Device.h"
+
+/*** Constant definition ******************************************************/
+/* Size of candidate queue. This must be a power of 2. */
+#define AKFS_CALIB_QSIZE	64
+/* Minimum distance (uT) from the last queued candidate to queue a new one,
+   for estimators which accept only distant samples by themselves. */
+#define AKFS_CALIB_STEP		0.5f
+/* Flag of a result slot which is not picked up by the sample path yet. */
+#define AKFS_CALIB_FRESH	0x4
+
+/*** Type declaration *********************************************************/
+/*! A result of offset estimation. */
+typedef struct _AKFS_CALIB_RESULT {
+	AKFVEC	ho;			/* Offset */
+	AKFVEC	hsi[3];		/* Soft iron matrix, row by row */
+	AKFLOAT	hr;			/* Radius of the field around the offset */
+} AKFS_CALIB_RESULT;
+
+/*! Offset estimator which is called by the worker thread. res holds the
+  current result on entry, and it is updated when #AKFS_SUCCESS is returned. */
+typedef int16 (*AKFS_CALIB_FUNC)(
+			void				*arg,
+	const	AKFVEC				*hdata,
+			AKFS_CALIB_RESULT	*res
+);
+
+/*! State of asynchronous calibration worker.
+  The candidate queue is a single producer (sample path), single consumer
+  (worker) ring, i.e. qhead is written only by the sample path and qtail
+  only by the worker. Results are handed over with a triple buffer: the
+  worker fills res[back] then swaps it with mid, and the sample path swaps
+  res[front] with mid when mid is flagged with #AKFS_CALIB_FRESH. */
+typedef struct _AKFS_CALIB {
+	/* Candidate queue */
+	AKFVEC				q[AKFS_CALIB_QSIZE];
+	volatile unsigned int	qhead;
+	volatile unsigned int	qtail;
+	AKFVEC				last;		/* The last queued candidate */
+	AKFLOAT				step;		/* Minimum distance from last */
+	unsigned int		ndrop;		/* Candidates dropped as queue is full */
+
+	/* Result snapshot */
+	AKFS_CALIB_RESULT	res[3];
+	volatile int		mid;
+	int					back;		/* Owned by the worker */
+	int					front;		/* Owned by the sample path */
+	AKFS_CALIB_RESULT	cur;		/* Working copy of the worker */
+
+	/* Worker */
+	AKFS_CALIB_FUNC		func;
+	void				*arg;
+	pthread_t			thread;
+	int					evfd;		/* eventfd to wake the worker up */
+	volatile int		stop;
+	int16				running;
+} AKFS_CALIB;
+
+/*** Global variables *********************************************************/
+
+/*** Prototype of function ****************************************************/
+int16 AKFS_StartCalib(
+			AKFS_CALIB			*calib,
+			AKFS_CALIB_FUNC		func,
+			void				*arg,
+	const	AKFS_CALIB_RESULT	*init,
+	const	AKFLOAT				step
+);
+
+void AKFS_StopCalib(
+			AKFS_CALIB			*calib
+);
+
+int16 AKFS_PushCalib(
+			AKFS_CALIB			*calib,
+	const	AKFVEC				*hdata
+);
+
+int16 AKFS_PollCalib(
+			AKFS_CALIB			*calib,
+			AKFS_CALIB_RESULT	*res
+);
+
+#endif
+
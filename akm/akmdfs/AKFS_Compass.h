@@ -32,11 +32,15 @@
 /****************************************/
 #include "./libAKM_OSS/AKFS_Configure.h"
 #include "./libAKM_OSS/AKFS_AOC.h"
+#include "./libAKM_OSS/AKFS_Batch.h"
 #include "./libAKM_OSS/AKFS_Decomp.h"
 #include "./libAKM_OSS/AKFS_Device.h"
 #include "./libAKM_OSS/AKFS_Direction.h"
+#include "./libAKM_OSS/AKFS_Ellipsoid.h"
 #include "./libAKM_OSS/AKFS_Math.h"
+#include "./libAKM_OSS/AKFS_Sphere.h"
 #include "./libAKM_OSS/AKFS_VNorm.h"
+#include "AKFS_Calib.h"
 
 /*** Constant definition ******************************************************/
 #define AKM_MAG_SENSE			(1.0)
@@ -51,6 +55,20 @@ typedef struct _AKSENSOR_DATA{
     int8	status;
 } AKSENSOR_DATA;
 
+/*! Offset estimation method. */
+typedef enum _AKFS_AOC_MODE {
+	AKFS_AOC_4POINTS = 0,	/*!< Sphere from 4 points (AKFS_AOC) */
+	AKFS_AOC_LSQ,			/*!< Least-squares sphere fit (AKFS_SphereFit) */
+	AKFS_AOC_ELLIPSOID		/*!< Ellipsoid fit (AKFS_EllipsoidFit) */
+} AKFS_AOC_MODE;
+
+/*! Smoothing of magnetic and acceleration vectors. */
+typedef enum _AKFS_FILTER_MODE {
+	AKFS_FILTER_BOX = 0,	/*!< Average of the latest entries (AKFS_VbAveGet) */
+	AKFS_FILTER_KALMAN,		/*!< Recursive filter (AKFS_VFiltUpdate) */
+	AKFS_FILTER_ADAPTIVE	/*!< Average of variable length (AKFS_VVarWindow) */
+} AKFS_FILTER_MODE;
+
 /*! A parameter structure. */
 /* ix*_ : x-bit integer */
 /* f**_ : floating value */
@@ -62,28 +80,73 @@ typedef struct _AKSENSOR_DATA{
 typedef struct _AKMPRMS{
 
 	/* Variables for Decomp. */
-	AKFVEC			fva_hdata[AKFS_HDATA_SIZE];
+	AKFS_RBUF		fva_hdata;
 	uint8vec		i8v_asa;
+	AKFS_AFFINE		s_hdec;		/* ASA, sensitivity and layout */
+	AKFS_DECOMP_FUNC	p_hdec;		/* Kernel for s_hdec */
 
 	/* Variables forAOC. */
 	AKFS_AOC_VAR	s_aocv;
+	AKFS_LSQ_VAR	s_lsqv;
+	AKFS_ELL_VAR	s_ellv;
+	AKFS_AOC_MODE	e_aocmode;
+	AKFS_CALIB		s_calib;	/* Worker, used if i16_calibasync is set */
+	int16			i16_calibasync;
+	AKFS_CALIB_RESULT	s_saved;	/* Offset, matrix and radius in the setting file */
+	int16			i16_savedvalid;	/* Non-zero if s_saved is valid */
+
+	/* Variables for warm start. */
+	int16			i16_savedstatus;	/* Accuracy in the setting file */
+	long			l_savedtime;	/* Time of the setting file (sec) */
+	int16			i16_warmcheck;	/* Vectors left to check accuracy */
+	AKFLOAT			f_warmhr;		/* Radius which vectors are checked with */
+	AKFLOAT			f_hr;			/* Radius of the estimator which set fv_ho */
+	volatile int16	i16_aocreset;	/* Set to discard the history of AOC */
 
 	/* Variables for Magnetometer buffer. */
-	AKFVEC			fva_hvbuf[AKFS_HDATA_SIZE];
+	AKFS_RBUF		fva_hvbuf;
+	AKFS_VAVE		s_hvave;
 	AKFVEC			fv_ho;
 	AKFVEC			fv_hs;
+	AKFVEC			fva_hsi[3];	/* Soft iron matrix, row by row */
 	AKFS_PATNO		e_hpat;
+	AKFS_AFFINE		s_hcal;		/* s_hdec, then offset and sensitivity */
+	AKFS_DECOMP_FUNC	p_hcal;		/* Kernel for s_hcal */
 
 	/* Variables for Accelerometer buffer. */
-	AKFVEC			fva_avbuf[AKFS_ADATA_SIZE];
+	AKFS_RBUF		fva_avbuf;
+	AKFS_VAVE		s_avave;
 	AKFVEC			fv_ao;
 	AKFVEC			fv_as;
+	AKFS_AFFINE		s_acal;		/* offset and sensitivity */
+
+	/* Variables for recursive filter. [0]: for direction, [1]: for vector */
+	AKFS_FILTER_MODE	e_filter;
+	AKFS_VFILT		s_hfilt[2];
+	AKFS_VFILT		s_afilt[2];
+
+	/* Variables for averaging. [0]: for direction, [1]: for vector */
+	int16			i16a_hnave[2];	/* Number of average, adapted to s_hvar */
+	int16			i16a_anave[2];	/* Number of average, adapted to s_avar */
+	AKFS_VVAR		s_hvar;
+	AKFS_VVAR		s_avar;
+
+	/* Variables for stillness detection. */
+	int16			i16_stilldet;	/* Non-zero to enable */
+	int16			i16_hstillcnt;	/* Magnetic vectors within the threshold */
+	int16			i16_astillcnt;	/* Acceleration vectors within the threshold */
+	int16			i16_dircache;	/* AKFS_DIRCACHE_*, valid results */
+	AKFVEC			fv_hstill;		/* Reference magnetic vector */
+	AKFVEC			fv_astill;		/* Reference acceleration vector */
 
 	/* Variables for Direction. */
 	AKFLOAT			f_azimuth;
 	AKFLOAT			f_pitch;
 	AKFLOAT			f_roll;
 
+	/* Variables for Rotation vector. */
+	AKFLOAT			fa_quat[4];	/* x, y, z, w */
+
 	/* Variables for vector output */
 	AKFVEC			fv_hvec;
 	AKFVEC			fv_avec;
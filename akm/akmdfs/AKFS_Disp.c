@@ -47,6 +47,8 @@ void Disp_Result(int buf[])
 		buf[8], REVERT_MAG(buf[5]), REVERT_MAG(buf[6]), REVERT_MAG(buf[7]));
 	AKMDEBUG(AKMDATA_CONSOLE, "Ori(%d)=%8.2f, %8.2f, %8.2f\n",
 		buf[8], REVERT_ORI(buf[9]), REVERT_ORI(buf[10]), REVERT_ORI(buf[11]));
+	AKMDEBUG(AKMDATA_CONSOLE, "RV=%8.4f, %8.4f, %8.4f, %8.4f\n",
+		REVERT_RV(buf[12]), REVERT_RV(buf[13]), REVERT_RV(buf[14]), REVERT_RV(buf[15]));
 }
 
 /*!
@@ -61,6 +63,7 @@ MODE Menu_Main(void)
 	AKMDEBUG(AKMDATA_CONSOLE,
 	" --------------------  AKM Daemon Application -------------------- \n"
 	"   1. Start measurement. \n"
+	"   2. Show timing statistics. \n"
 	"   Q. Quit application. \n"
 	" ----------------------------------------------------------------- \n"
 	" Please select a number.\n"
@@ -72,6 +75,8 @@ MODE Menu_Main(void)
 	/*    only the first character is compared. */
 	if (!strncmp(msg, "1", 1)) {
 		return MODE_Measure;
+	} else if (!strncmp(msg, "2", 1)) {
+		return MODE_Stat;
 	} else if (strncmp(msg, "Q", 1) == 0 || strncmp(msg, "q", 1) == 0) {
 		return MODE_Quit;
 	} else {
@@ -25,6 +25,7 @@
 #define REVERT_ACC(a)	((float)((a) * 9.8f / 720.0f))
 #define REVERT_MAG(m)	((float)((m) * 0.06f))
 #define REVERT_ORI(o)	((float)((o) / 64.0f))
+#define REVERT_RV(r)	((float)((r) / 16384.0f))
 
 /*** Type declaration *********************************************************/
 
@@ -32,6 +33,7 @@
 typedef enum _MODE {
 	MODE_ERROR,			/*!< Error */
 	MODE_Measure,		/*!< Measurement */
+	MODE_Stat,			/*!< Timing statistics of measurement */
 	MODE_Quit			/*!< Quit */
 } MODE;
 
@@ -56,6 +56,24 @@ void AKD_DeinitDevice(void)
 	}
 }
 
+/*!
+ Get file descriptor of the device driver, so that it can be waited with
+ poll or epoll. POLLIN means measurement data is ready, POLLPRI means
+ enable flag or delay is changed.
+ @return If this function succeeds, the return value is #AKD_SUCCESS.
+ Otherwise the return value is #AKD_ERROR.
+ @param[out] fd File descriptor.
+ */
+int16_t AKD_GetDeviceFd(int* fd)
+{
+	if (s_fdDev < 0) {
+		AKMERROR;
+		return AKD_ERROR;
+	}
+	*fd = s_fdDev;
+	return AKD_SUCCESS;
+}
+
 /*!
  Writes data to a register of the AKM E-Compass.  When more than one byte of
  data is specified, the data is written in contiguous locations starting at an
@@ -378,6 +396,26 @@ int16_t AKD_GetLayout(int16_t* layout)
 	return AKD_SUCCESS;
 }
 
+/*!
+ Get whether DRDY is notified through poll, i.e. the device driver has IRQ.
+ Old device driver does not support this, then it is regarded as no IRQ.
+ */
+int16_t AKD_GetDrdyIrq(int* irq)
+{
+	if (s_fdDev < 0) {
+		AKMERROR;
+		return AKD_ERROR;
+	}
+	if (ioctl(s_fdDev, ECS_IOCTL_GET_DRDY_IRQ, irq) < 0) {
+		AKMDEBUG(AKMDATA_DRV, "%s: not supported\n", __FUNCTION__);
+		*irq = 0;
+		return AKD_SUCCESS;
+	}
+
+	AKMDEBUG(AKMDATA_DRV, "%s: irq=%d\n", __FUNCTION__, *irq);
+	return AKD_SUCCESS;
+}
+
 /* Get acceleration data. */
 int16_t AKD_GetAccelerationData(int16_t data[3])
 {
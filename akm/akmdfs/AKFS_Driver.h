@@ -52,6 +52,8 @@ int16_t AKD_InitDevice(void);
 
 void AKD_DeinitDevice(void);
 
+int16_t AKD_GetDeviceFd(int* fd);
+
 int16_t AKD_TxData(
 		const BYTE address,
 		const BYTE* data,
@@ -82,6 +84,8 @@ int16_t AKD_GetDelay(int64_t delay[AKM_NUM_SENSORS]);
 
 int16_t AKD_GetLayout(int16_t* layout);
 
+int16_t AKD_GetDrdyIrq(int* irq);
+
 int16_t AKD_GetAccelerationData(int16_t data[3]);
 
 #endif /* AKMD_INC_AKMD_DRIVER_H */
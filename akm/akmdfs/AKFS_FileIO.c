@@ -16,6 +16,14 @@
  *
  ******************************************************************************/
 #include "AKFS_FileIO.h"
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef WIN32
+#include <io.h>
+#include <windows.h>
+#define fsync(fd)	_commit(fd)
+#endif
 
 /*** Constant definition ******************************************************/
 #ifdef AKFS_PRECISION_DOUBLE
@@ -23,11 +31,113 @@
 #else
 #define AKFS_SCANF_FORMAT	"%63s = %f"
 #endif
-#define AKFS_PRINTF_FORMAT	"%s = %f\n"
+#define AKFS_SCANF_FORMAT_L	"%63s = %ld"
 #define LOAD_BUF_SIZE	64
+#define PATH_BUF_SIZE	256
+
+#ifndef O_BINARY
+#define O_BINARY	0
+#endif
+/* Suffix of the temporary file which replaces the setting file. */
+#define AKFS_STORE_TMP	".tmp"
+/* Extension of the setting file, and of the text file which was used before. */
+#define AKFS_STORE_EXT	".bin"
+#define AKFS_TEXT_EXT	".txt"
+/* Suffix of the text file after it is converted to the setting file. */
+#define AKFS_TEXT_DONE	".migrated"
+
+/* Names of soft iron matrix elements, row by row. */
+static const char * const s_hsiName[3][3] = {
+	{"HSI.xx", "HSI.xy", "HSI.xz"},
+	{"HSI.yx", "HSI.yy", "HSI.yz"},
+	{"HSI.zx", "HSI.zy", "HSI.zz"}
+};
+
+/* Names of axes of offset history, i.e. "HOBUF.<i>.x". */
+static const char s_axisName[3] = {'x', 'y', 'z'};
 
 /*!
- Load parameters from file which is specified with #path.  This function reads 
+ Read one line of the setting file, and check its name.
+ @return 1 if the line has the name, EOF at the end of file. Otherwise 0.
+ @param[in] fp A file which is opened for read.
+ @param[in] name Expected name of the parameter.
+ @param[out] val Value of the parameter.
+ */
+static int ScanValue(FILE *fp, const char *name, AKFLOAT *val)
+{
+	char buf[LOAD_BUF_SIZE];
+	int n;
+
+	n = fscanf(fp, AKFS_SCANF_FORMAT, buf, val);
+	if (n == EOF) {
+		return EOF;
+	}
+	if ((n != 2) || (strncmp(buf, name, sizeof(buf)) != 0)) {
+		return 0;
+	}
+	return 1;
+}
+
+/*!
+ Load the state of offset estimation, which follows HSI. Files written
+  before it was introduced end at HSI, so the state is left untouched in that
+  case. The state is stored to prms only when all of it is read.
+ @return 1 on success, 0 if the file is broken.
+ @param[in] fp A file which is opened for read.
+ @param[out] prms A pointer to #AKMPRMS structure.
+ */
+static int16 LoadWarmState(FILE *fp, AKMPRMS *prms)
+{
+	char buf[LOAD_BUF_SIZE];
+	char name[LOAD_BUF_SIZE];
+	AKFLOAT status, hraoc, num;
+	AKFVEC hobuf[AKFS_HOBUF_SIZE];
+	long tm;
+	int i, j, n;
+
+	n = ScanValue(fp, "HSTATUS", &status);
+	if (n == EOF) {
+		return 1;
+	}
+	if ((n != 1) || (status < 0) || (status > 3)) {
+		return 0;
+	}
+	if ((ScanValue(fp, "HR", &hraoc) != 1) || (hraoc < 0)) {
+		return 0;
+	}
+	if ((ScanValue(fp, "HOBUF.n", &num) != 1) ||
+		(num < 0) || (num > AKFS_HOBUF_SIZE)) {
+		return 0;
+	}
+	for (i = 0; i < (int)num; i++) {
+		for (j = 0; j < 3; j++) {
+			snprintf(name, sizeof(name), "HOBUF.%d.%c", i, s_axisName[j]);
+			if (ScanValue(fp, name, &hobuf[i].v[j]) != 1) {
+				return 0;
+			}
+		}
+	}
+	if ((fscanf(fp, AKFS_SCANF_FORMAT_L, buf, &tm) != 2) ||
+		(strncmp(buf, "TIME", sizeof(buf)) != 0)) {
+		return 0;
+	}
+
+	/* History is stored from the oldest entry */
+	AKFS_InitRBuf(AKFS_HOBUF_SIZE, &prms->s_aocv.hobuf);
+	for (i = 0; i < (int)num; i++) {
+		AKFS_RBufPush(&prms->s_aocv.hobuf, &hobuf[i]);
+	}
+	prms->s_aocv.hraoc = hraoc;
+	prms->f_hr = hraoc;
+	prms->i16_hstatus = (int16)status;
+	prms->l_savedtime = tm;
+	return 1;
+}
+
+/*!
+ Load parameters from a text file which is specified with #path. The setting
+  file was written in this format before #AKFS_STORE was introduced, so this
+  function is used to migrate it. This function reads 
   data from a beginning of the file line by line, and check parameter name 
   sequentially. In other words, this function depends on the order of eache 
   parameter described in the file.
@@ -39,11 +149,14 @@
   stored to the member of this structure.
  @param[in] path A path to the setting file.
  */
-int16 AKFS_LoadParameters(AKMPRMS * prms, const char* path)
+int16 AKFS_LoadTextParameters(AKMPRMS * prms, const char* path)
 {
 	int16 ret;
+	int16 i, j;
+	int n;
 	char buf[LOAD_BUF_SIZE];
 	AKFLOAT tmpF;
+	AKFVEC hsi[3];
 	FILE *fp = NULL;
 
 	/* Open setting file for read. */
@@ -83,6 +196,40 @@ int16 AKFS_LoadParameters(AKMPRMS * prms, const char* path)
 		}
 	}
 
+	/* Load data to HSI. Files written before the matrix was introduced end
+	   here, so the identity matrix is kept in that case. */
+	if (ret != 0) {
+		for (i = 0; i < 3; i++) {
+			for (j = 0; j < 3; j++) {
+				hsi[i].v[j] = (i == j) ? 1.0f : 0.0f;
+			}
+		}
+		for (i = 0; (ret != 0) && (i < 3); i++) {
+			for (j = 0; (ret != 0) && (j < 3); j++) {
+				n = fscanf(fp, AKFS_SCANF_FORMAT, buf, &tmpF);
+				if ((n == EOF) && (i == 0) && (j == 0)) {
+					i = 3;
+					break;
+				}
+				if ((n != 2) || (strncmp(buf, s_hsiName[i][j], sizeof(buf)) != 0)) {
+					ret = 0;
+				} else {
+					hsi[i].v[j] = tmpF;
+				}
+			}
+		}
+		if (ret != 0) {
+			for (i = 0; i < 3; i++) {
+				prms->fva_hsi[i] = hsi[i];
+			}
+		}
+	}
+
+	/* Load the state of offset estimation and accuracy. */
+	if (ret != 0) {
+		ret = LoadWarmState(fp, prms);
+	}
+
 	if (fclose(fp) != 0) {
 		AKMERROR_STR("fclose");
 		ret = 0;
@@ -96,42 +243,304 @@ int16 AKFS_LoadParameters(AKMPRMS * prms, const char* path)
 	return AKM_SUCCESS;
 }
 
+/*!
+ Calculate CRC32 (IEEE 802.3, reflected) of a memory block.
+ @return CRC32 value.
+ @param[in] buf A pointer to the block.
+ @param[in] len Length of the block in bytes.
+ */
+static uint32_t Crc32(const void *buf, size_t len)
+{
+	const uint8 *p = (const uint8 *)buf;
+	uint32_t crc = 0xFFFFFFFFu;
+	int k;
+
+	while (len-- > 0) {
+		crc ^= *p++;
+		for (k = 0; k < 8; k++) {
+			crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+		}
+	}
+	return ~crc;
+}
+
+/*!
+ Get the path of the text file which was used before the setting file, i.e.
+  the extension ".bin" of #path is replaced with ".txt".
+ @return 1 if the path is stored to #text, 0 if #text is too short.
+ @param[in] path A path to the setting file.
+ @param[out] text A buffer for the path to the text file.
+ @param[in] size Size of #text.
+ */
+static int TextPath(const char *path, char *text, size_t size)
+{
+	size_t len;
+	size_t ext;
+
+	len = strlen(path);
+	ext = strlen(AKFS_STORE_EXT);
+	if ((len >= ext) && (strcmp(path + len - ext, AKFS_STORE_EXT) == 0)) {
+		len -= ext;
+	}
+	return (snprintf(text, size, "%.*s%s", (int)len, path, AKFS_TEXT_EXT)
+			< (int)size);
+}
+
+/*!
+ Load parameters from the setting file which is specified with #path. The
+  file is read at once, and it is used only if its magic, size and CRC are
+  valid. A record of a later version is taken as well, only the fields of
+  #AKFS_STORE are used. Parameters are not changed otherwise.
+ @return If function fails, the return value is #AKM_ERROR. If function
+  succeeds, the return value is #AKM_SUCCESS.
+ @param[out] prms A pointer to #AKMPRMS structure. Loaded parameter is
+  stored to the member of this structure.
+ @param[in] path A path to the setting file.
+ */
+int16 AKFS_LoadParameters(AKMPRMS *prms, const char* path)
+{
+	/* uint32_t for the alignment of the record */
+	uint32_t buf[AKFS_STORE_SIZE_MAX / sizeof(uint32_t)];
+	AKFS_STORE rec;
+	AKFVEC v;
+	uint32_t crc;
+	int fd;
+	int n;
+	int i, j;
+
+	if ((fd = open(path, O_RDONLY | O_BINARY)) < 0) {
+		AKMERROR_STR("open");
+		return AKM_ERROR;
+	}
+	n = read(fd, buf, sizeof(buf));
+	if (n < 0) {
+		AKMERROR_STR("read");
+	}
+	close(fd);
+
+	if (n < (int)AKFS_STORE_SIZE_V1) {
+		AKMDEBUG(AKMDATA_DUMP, "%s: invalid record, n=%d\n", __FUNCTION__, n);
+		return AKM_ERROR;
+	}
+	memcpy(&rec, buf, sizeof(rec));
+	if ((rec.magic != AKFS_STORE_MAGIC) ||
+		(rec.version < 1) ||
+		(rec.size < AKFS_STORE_SIZE_V1) ||
+		(rec.size != n)) {
+		AKMDEBUG(AKMDATA_DUMP, "%s: invalid record, n=%d\n", __FUNCTION__, n);
+		return AKM_ERROR;
+	}
+	crc = rec.crc;
+	((AKFS_STORE *)buf)->crc = 0;
+	if (Crc32(buf, rec.size) != crc) {
+		AKMDEBUG(AKMDATA_DUMP, "%s: CRC error\n", __FUNCTION__);
+		return AKM_ERROR;
+	}
+	if ((rec.hstatus < 0) || (rec.hstatus > 3) ||
+		(rec.hobufn < 0) || (rec.hobufn > AKFS_HOBUF_SIZE)) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+
+	for (i = 0; i < 3; i++) {
+		prms->fv_ho.v[i] = rec.ho[i];
+		for (j = 0; j < 3; j++) {
+			prms->fva_hsi[i].v[j] = rec.hsi[i][j];
+		}
+	}
+	AKFS_InitRBuf(AKFS_HOBUF_SIZE, &prms->s_aocv.hobuf);
+	for (i = 0; i < rec.hobufn; i++) {
+		for (j = 0; j < 3; j++) {
+			v.v[j] = rec.hobuf[i][j];
+		}
+		AKFS_RBufPush(&prms->s_aocv.hobuf, &v);
+	}
+	/* AOC takes it as the radius of its last solution */
+	prms->s_aocv.hraoc = rec.hr;
+	prms->f_hr = rec.hr;
+	prms->i16_hstatus = rec.hstatus;
+	prms->l_savedtime = (long)rec.time;
+
+	return AKM_SUCCESS;
+}
+
+/*!
+ Write a file and make it durable.
+ @return 1 on success, 0 on failure.
+ @param[in] path A path to the file.
+ @param[in] buf Contents of the file.
+ @param[in] len Length of contents in bytes.
+ */
+static int16 WriteSync(const char *path, const void *buf, size_t len)
+{
+	int16 ret = 1;
+	int fd;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0660)) < 0) {
+		AKMERROR_STR("open");
+		return 0;
+	}
+	if (write(fd, buf, len) != (int)len) {
+		AKMERROR_STR("write");
+		ret = 0;
+	} else if (fsync(fd) != 0) {
+		AKMERROR_STR("fsync");
+		ret = 0;
+	}
+	if (close(fd) != 0) {
+		AKMERROR_STR("close");
+		ret = 0;
+	}
+	return ret;
+}
+
+/*!
+ Load parameters from the text file which was used before the setting file
+  #path, so that it is converted. The text file is read only if the setting
+  file does not exist. A broken setting file is not replaced with the values
+  which were valid before it.
+ @return If function fails, or the setting file exists, the return value is
+  #AKM_ERROR. See #AKFS_LoadTextParameters for the output in this case. If
+  function succeeds, the return value is #AKM_SUCCESS.
+ @param[out] prms A pointer to #AKMPRMS structure. Loaded parameter is
+  stored to the member of this structure.
+ @param[in] path A path to the setting file.
+ */
+int16 AKFS_LoadOldParameters(AKMPRMS *prms, const char* path)
+{
+	char text[PATH_BUF_SIZE];
+	struct stat st;
+
+	if ((stat(path, &st) == 0) || (errno != ENOENT)) {
+		AKMDEBUG(AKMDATA_DUMP, "%s: setting file exists\n", __FUNCTION__);
+		return AKM_ERROR;
+	}
+	if (!TextPath(path, text, sizeof(text))) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+	return AKFS_LoadTextParameters(prms, text);
+}
+
+/*!
+ Rename the text file which is loaded by #AKFS_LoadOldParameters, after
+  the setting file is saved. It is kept for reference, but it is not read
+  again.
+ @return If function fails, the return value is #AKM_ERROR. If function
+  succeeds, the return value is #AKM_SUCCESS.
+ @param[in] path A path to the setting file.
+ */
+int16 AKFS_RetireOldParameters(const char* path)
+{
+	char text[PATH_BUF_SIZE];
+	char done[PATH_BUF_SIZE];
+
+	if (!TextPath(path, text, sizeof(text)) ||
+		(snprintf(done, sizeof(done), "%s%s", text, AKFS_TEXT_DONE)
+			>= (int)sizeof(done))) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+#ifdef WIN32
+	/* rename does not replace an existing file */
+	if (!MoveFileExA(text, done, MOVEFILE_REPLACE_EXISTING)) {
+		AKMERROR_STR("MoveFileEx");
+		return AKM_ERROR;
+	}
+#else
+	if (rename(text, done) != 0) {
+		AKMERROR_STR("rename");
+		return AKM_ERROR;
+	}
+#endif
+	return AKM_SUCCESS;
+}
+
 /*!
  Save parameters to file which is specified with #path. This function saves 
   variables when the offsets of magnetic sensor estimated successfully.
- @return If function fails, the return value is #AKM_ERROR. When function fails,
-  the parameter file may collapsed. Therefore, the parameters file should be
-  discarded. If function succeeds, the return value is #AKM_SUCCESS.
+  The record is written to a temporary file, which replaces the setting file
+  after it is flushed to the storage. Therefore the setting file has either
+  the old or the new record even if power is lost while it is written.
+ @return If function fails, the return value is #AKM_ERROR. When function
+  fails, the setting file is not changed. If function succeeds, the return
+  value is #AKM_SUCCESS.
  @param[out] prms A pointer to #AKMPRMS structure. Member variables are
   saved to the parameter file.
  @param[in] path A path to the setting file.
  */
 int16 AKFS_SaveParameters(AKMPRMS *prms, const char* path)
 {
-	int16 ret = 1;
-	FILE *fp;
+	AKFS_STORE rec;
+	const AKFS_RBUF *hobuf = &prms->s_aocv.hobuf;
+	char tmp[PATH_BUF_SIZE];
+	int i, j;
+#ifndef WIN32
+	char *sep;
+	int fd;
+#endif
 
-	/*Open setting file for write. */
-	if ((fp = fopen(path, "w")) == NULL) {
-		AKMERROR_STR("fopen");
+	if (snprintf(tmp, sizeof(tmp), "%s%s", path, AKFS_STORE_TMP) >= (int)sizeof(tmp)) {
+		AKMERROR;
 		return AKM_ERROR;
 	}
 
-	/* Save data to HO */
-	if (fprintf(fp, AKFS_PRINTF_FORMAT, "HO.x", prms->fv_ho.u.x) < 0) { ret = 0; }
-	if (fprintf(fp, AKFS_PRINTF_FORMAT, "HO.y", prms->fv_ho.u.y) < 0) { ret = 0; }
-	if (fprintf(fp, AKFS_PRINTF_FORMAT, "HO.z", prms->fv_ho.u.z) < 0) { ret = 0; }
-
-	if (fclose(fp) != 0) {
-		AKMERROR_STR("fclose");
-		ret = 0;
+	/* Unused bytes must be 0 to calculate CRC */
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = AKFS_STORE_MAGIC;
+	rec.version = AKFS_STORE_VERSION;
+	rec.size = sizeof(rec);
+	rec.hstatus = prms->i16_hstatus;
+	rec.hobufn = hobuf->num;
+	rec.time = (int64_t)time(NULL);
+	for (i = 0; i < 3; i++) {
+		rec.ho[i] = prms->fv_ho.v[i];
+		for (j = 0; j < 3; j++) {
+			rec.hsi[i][j] = prms->fva_hsi[i].v[j];
+		}
+	}
+	rec.hr = prms->f_hr;
+	for (i = 0; i < hobuf->num; i++) {
+		for (j = 0; j < 3; j++) {
+			rec.hobuf[i][j] = AKFS_RBUF_AT(hobuf, hobuf->num - 1 - i).v[j];
+		}
 	}
+	rec.crc = Crc32(&rec, sizeof(rec));
 
-	if (ret == 0) {
+	if (!WriteSync(tmp, &rec, sizeof(rec))) {
+		unlink(tmp);
 		AKMERROR;
 		return AKM_ERROR;
 	}
+#ifdef WIN32
+	/* rename does not replace an existing file. The file is replaced in one
+	   step, and it is flushed before the function returns. */
+	if (!MoveFileExA(tmp, path,
+			MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		AKMERROR_STR("MoveFileEx");
+		unlink(tmp);
+		return AKM_ERROR;
+	}
+#else
+	if (rename(tmp, path) != 0) {
+		AKMERROR_STR("rename");
+		unlink(tmp);
+		return AKM_ERROR;
+	}
+	/* Make the new entry of the directory durable as well */
+	if ((sep = strrchr(tmp, '/')) != NULL) {
+		if (sep == tmp) {
+			sep++;
+		}
+		*sep = '\0';
+		if ((fd = open(tmp, O_RDONLY)) >= 0) {
+			fsync(fd);
+			close(fd);
+		}
+	}
+#endif
 
+	prms->l_savedtime = (long)rec.time;
 	return AKM_SUCCESS;
 }
 
@@ -20,19 +20,54 @@
 
 /* Common include files. */
 #include "AKFS_Common.h"
+#include <stdint.h>
 
 /* Include file for AKM OSS library. */
 #include "AKFS_Compass.h"
 
 /*** Constant definition ******************************************************/
+#define AKFS_STORE_MAGIC	0x534D4B41	/* "AKMS" in little endian */
+#define AKFS_STORE_VERSION	1
 
 /*** Type declaration *********************************************************/
+/*! A record of the setting file. Fields have fixed size and are aligned
+  naturally, so that the file is read into this structure as it is. A new
+  field is appended to the end, with a new version, and the fields of former
+  versions are never changed. So a reader takes a record of any version,
+  whose size is at least #AKFS_STORE_SIZE_V1, and uses the fields it knows.
+  CRC is calculated over #size bytes. The byte order is the one of the
+  device. */
+typedef struct _AKFS_STORE {
+	uint32_t	magic;		/* #AKFS_STORE_MAGIC */
+	uint16_t	version;	/* #AKFS_STORE_VERSION */
+	uint16_t	size;		/* Size of the record */
+	uint32_t	crc;		/* CRC32 of the record, with this field 0 */
+	int16_t		hstatus;	/* Accuracy */
+	int16_t		hobufn;		/* Entries of hobuf */
+	int64_t		time;		/* Wall clock time of the save (sec) */
+	float		ho[3];		/* Offset */
+	float		hsi[3][3];	/* Soft iron matrix, row by row */
+	float		hr;			/* Radius of the field around the offset */
+	float		hobuf[AKFS_HOBUF_SIZE][3];	/* Offset history, oldest first */
+	uint32_t	reserved;	/* 0, to have no padding */
+} AKFS_STORE;
+
+/* Size of a record of version 1, i.e. the shortest valid record. */
+#define AKFS_STORE_SIZE_V1	sizeof(AKFS_STORE)
+/* A longer record is not accepted. */
+#define AKFS_STORE_SIZE_MAX	1024
 
 /*** Global variables *********************************************************/
 
 /*** Prototype of function ****************************************************/
 int16 AKFS_LoadParameters(AKMPRMS *prms, const char* path);
 
+int16 AKFS_LoadTextParameters(AKMPRMS *prms, const char* path);
+
+int16 AKFS_LoadOldParameters(AKMPRMS *prms, const char* path);
+
+int16 AKFS_RetireOldParameters(const char* path);
+
 int16 AKFS_SaveParameters(AKMPRMS* prms, const char* path);
 
 #endif
@@ -17,90 +17,386 @@
 #include "AKFS_APIs.h"
 #include "AKFS_Measure.h"
 
-
 /******************************************************************************/
-/*! This function is called when new magnetometer data is available.  The
-  coordination system of input vector is sensor local coordination system.
-  The input vector will be converted to micro tesla unit (i.e. uT), then
-  rotated using layout matrix (i.e. i16_hlayout).
-  A magnetic offset is estimated automatically in this function.
-  As a result of it, offset subtracted vector is stored in #AKMPRMS structure.
-
+/*! Make affine transforms which convert measurement data to output vectors,
+  and select the kernel of each transform for the layout pattern.
+  This function must be called whenever ASA values, layout pattern, offset,
+  sensitivity or soft iron matrix in #AKMPRMS structure are changed, so that
+  no division or branch is needed for each sample.
   @return #AKM_SUCCESS on success. Otherwise the return value is #AKM_ERROR.
-  @param[in] prms A pointer to #AKMPRMS structure.
-  @param[in] mag A set of measurement data from magnetometer.  X axis value
-  should be in mag[0], Y axis value should be in mag[1], Z axis value should be
-  in mag[2].
-  @param[in] status A status of magnetometer.  This status indicates the result
-  of measurement data, i.e. overflow, success or fail, etc.
+  @param[in/out] prms A pointer to #AKMPRMS structure.
  */
-int16 AKFS_Set_MAGNETIC_FIELD(
-			AKMPRMS		*prms,
-	const	int16		mag[3],
-	const	int16		status
+int16 AKFS_UpdateTransform(
+			AKMPRMS		*prms
 )
 {
-	int16 akret;
-	int16 aocret;
-	AKFLOAT radius;
+	AKFS_AFFINE hnorm;
+	AKFS_AFFINE hsi;
+	AKFS_AFFINE tmp;
+	int16 i, j;
 
-	AKMDEBUG(AKMDATA_MAG, "%s: m[0]=%d, m[1]=%d, m[2]=%d, st=%d\n",
-		__FUNCTION__, mag[0], mag[1], mag[2], status);
-
-	/* Decomposition */
 	/* mag  [in] : sensor local coordinate, sensor local unit. */
-	/* hdata[out]: sensor local coordinate, sensitivity adjusted (i.e. uT). */
-	akret = AKFS_Decomp(
-		mag,
-		status,
-		&prms->i8v_asa,
-		AKFS_HDATA_SIZE,
-		prms->fva_hdata
-	);
-	if (akret == AKFS_ERROR) {
+	/* hdata[out]: Android coordinate, sensitivity adjusted. */
+	if (AKFS_InitDecompAffine(&prms->i8v_asa, prms->e_hpat, &prms->s_hdec)
+			!= AKFS_SUCCESS) {
 		AKMERROR;
 		return AKM_ERROR;
 	}
 
-	/* Rotate coordination */
-	/* hdata[in] : sensor local coordinate, sensitivity adjusted. */
-	/* hdata[out]: Android coordinate, sensitivity adjusted. */
-	akret = AKFS_Rotate(
-		prms->e_hpat,
-		&prms->fva_hdata[0]
-	);
-	if (akret == AKFS_ERROR) {
+	/* hdata[in] : Android coordinate, sensitivity adjusted. */
+	/* hvbuf[out]: Android coordinate, sensitivity adjusted, */
+	/*			   offset subtracted, soft iron corrected. */
+	if (AKFS_InitNormAffine(&prms->fv_ho, &prms->fv_hs, AKM_MAG_SENSE, &hnorm)
+			!= AKFS_SUCCESS) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			hsi.m[i][j] = prms->fva_hsi[i].v[j];
+		}
+		hsi.b.v[i] = 0.0f;
+	}
+	AKFS_AffineMul(&hnorm, &prms->s_hdec, &tmp);
+	AKFS_AffineMul(&hsi, &tmp, &prms->s_hcal);
+
+	/* A soft iron matrix with off-diagonal entries needs the generic kernel */
+	prms->p_hdec = AKFS_GetDecompFunc(prms->e_hpat, &prms->s_hdec);
+	prms->p_hcal = AKFS_GetDecompFunc(prms->e_hpat, &prms->s_hcal);
+
+	/* acc  [in] : Android coordinate, sensor local unit. */
+	/* avbuf[out]: Android coordinate, sensitivity adjusted (SI unit), */
+	/*			   offset subtracted. */
+	if (AKFS_InitNormAffine(&prms->fv_ao, &prms->fv_as, AKM_ACC_TARGET, &prms->s_acal)
+			!= AKFS_SUCCESS) {
 		AKMERROR;
 		return AKM_ERROR;
 	}
 
-	/* Offset calculation is done in this function */
+	return AKM_SUCCESS;
+}
+
+
+/******************************************************************************/
+/*! Discard the history of offset estimators, i.e. #AKMPRMS.i16_aocreset is
+  handled. The selected estimator must not run at the same time.
+  @param[in/out] prms A pointer to #AKMPRMS structure.
+ */
+void AKFS_ResetEstimator(
+			AKMPRMS		*prms
+)
+{
+	AKFS_InitAOC(&prms->s_aocv);
+	AKFS_InitSphereFit(&prms->s_lsqv);
+	AKFS_InitEllipsoidFit(&prms->s_ellv);
+	prms->i16_aocreset = 0;
+}
+
+/******************************************************************************/
+/*! Run the offset estimator which is selected by #AKFS_SetAOCMode.
+  @return #AKFS_SUCCESS if ho (and hsi) is updated. Otherwise #AKFS_ERROR.
+  @param[in/out] prms A pointer to #AKMPRMS structure. Only the state of
+  estimators is changed.
+  @param[in] hdata A magnetic vector, Android coordinate, sensitivity adjusted.
+  @param[in/out] ho Offset.
+  @param[in/out] hsi Soft iron matrix.
+  @param[in/out] hr Radius of the field around ho, i.e. the size of offset
+  subtracted vectors. It is updated with ho.
+ */
+int16 AKFS_EstimateOffset(
+			AKMPRMS		*prms,
+	const	AKFVEC		*hdata,
+			AKFVEC		*ho,
+			AKFVEC		hsi[3],
+			AKFLOAT		*hr
+)
+{
+	/* Restored history is discarded by the owner of estimators */
+	if (prms->i16_aocreset) {
+		AKFS_ResetEstimator(prms);
+	}
+
+	if (prms->e_aocmode == AKFS_AOC_LSQ) {
+		if (AKFS_SphereFit(&prms->s_lsqv, hdata, ho) != AKFS_SUCCESS) {
+			return AKFS_ERROR;
+		}
+		*hr = prms->s_lsqv.hrlsq;
+	} else if (prms->e_aocmode == AKFS_AOC_ELLIPSOID) {
+		/* hsi maps the ellipsoid to a sphere of this radius */
+		if (AKFS_EllipsoidFit(&prms->s_ellv, hdata, ho, hsi) != AKFS_SUCCESS) {
+			return AKFS_ERROR;
+		}
+		*hr = prms->s_ellv.hrell;
+	} else {
+		if (AKFS_AOC(&prms->s_aocv, hdata, ho) != AKFS_SUCCESS) {
+			return AKFS_ERROR;
+		}
+		*hr = prms->s_aocv.hraoc;
+	}
+	return AKFS_SUCCESS;
+}
+
+/* Adapter of #AKFS_EstimateOffset for the worker. */
+static int16 CalibEstimate(
+			void				*arg,
+	const	AKFVEC				*hdata,
+			AKFS_CALIB_RESULT	*res
+)
+{
+	return AKFS_EstimateOffset((AKMPRMS *)arg, hdata, &res->ho, res->hsi,
+		&res->hr);
+}
+
+/******************************************************************************/
+/*! Start a worker thread which estimates offset off the sample path. While
+  the worker is running, the state of estimators in #AKMPRMS structure is
+  owned by the worker. #AKFS_Set_MAGNETIC_FIELD only queues candidate
+  vectors and picks up new results. #AKFS_AOC takes every vector as in
+  synchronous estimation, and fitting estimators, which have their own
+  minimum step, get vectors decimated by #AKFS_CALIB_STEP.
+  @return #AKM_SUCCESS on success. Otherwise the return value is #AKM_ERROR,
+  and offset is estimated synchronously.
+  @param[in/out] prms A pointer to #AKMPRMS structure.
+ */
+int16 AKFS_StartAsyncCalib(
+			AKMPRMS		*prms
+)
+{
+	AKFS_CALIB_RESULT init;
+	int16 i;
+
+	init.ho = prms->fv_ho;
+	for (i = 0; i < 3; i++) {
+		init.hsi[i] = prms->fva_hsi[i];
+	}
+	init.hr = prms->f_hr;
+	return AKFS_StartCalib(&prms->s_calib, CalibEstimate, prms, &init,
+		(prms->e_aocmode == AKFS_AOC_4POINTS) ? 0.0f : AKFS_CALIB_STEP);
+}
+
+/******************************************************************************/
+/*! Stop the worker thread, and take the last result it published.
+  @param[in/out] prms A pointer to #AKMPRMS structure.
+ */
+void AKFS_StopAsyncCalib(
+			AKMPRMS		*prms
+)
+{
+	AKFS_CALIB_RESULT res;
+	int16 i;
+
+	if (!prms->s_calib.running) {
+		return;
+	}
+	AKFS_StopCalib(&prms->s_calib);
+	if (AKFS_PollCalib(&prms->s_calib, &res) == AKM_SUCCESS) {
+		prms->fv_ho = res.ho;
+		for (i = 0; i < 3; i++) {
+			prms->fva_hsi[i] = res.hsi[i];
+		}
+		prms->f_hr = res.hr;
+		AKFS_UpdateTransform(prms);
+	}
+}
+
+/******************************************************************************/
+/*! Check the accuracy restored by #AKFS_Start with a live vector. The size of
+  an offset subtracted vector must be close to the radius saved by the
+  estimator which set the offset, or within the geomagnetic range if the
+  radius is unknown. Otherwise the device is in
+  another field, so the accuracy is discarded and AOC starts from scratch.
+  @return None
+  @param[in/out] prms A pointer to #AKMPRMS structure.
+  @param[in] hv Offset subtracted vector.
+ */
+static void WarmCheck(
+			AKMPRMS		*prms,
+	const	AKFVEC		*hv
+)
+{
+	AKFLOAT r;
+	int16 ok;
+
+	r = AKFS_SQRT((hv->u.x * hv->u.x) + (hv->u.y * hv->u.y) + (hv->u.z * hv->u.z));
+	if (prms->f_warmhr > 0) {
+		ok = ((r >= prms->f_warmhr * (1.0f - CSPEC_WARM_RTH)) &&
+			  (r <= prms->f_warmhr * (1.0f + CSPEC_WARM_RTH)));
+	} else {
+		ok = (r <= AKFS_GEOMAG_MAX);
+	}
+
+	if (ok) {
+		prms->i16_warmcheck--;
+	} else {
+		AKMDEBUG(AKMDATA_MAG, "%s: accuracy is discarded, r=%f hr=%f\n",
+			__FUNCTION__, r, prms->f_warmhr);
+		prms->i16_warmcheck = 0;
+		prms->i16_hstatus = 0;
+		prms->f_hr = 0.0f;
+		prms->i16_aocreset = 1;
+	}
+}
+
+/******************************************************************************/
+/*! Compare the latest vectors with the reference of stillness detection.
+  The average of nave vectors is compared, so that noise of each vector does
+  not look like motion. When it moves more than th in any axis, the average
+  becomes the new reference and cached results are discarded. Each sensor
+  has its own counter, so that samples of one sensor do not make up for
+  the other one, e.g. accelerometer at a higher rate than magnetometer.
+  @return None
+  @param[in/out] prms A pointer to #AKMPRMS structure.
+  @param[in/out] cnt Counter of vectors within the threshold.
+  @param[in/out] ref Reference vector.
+  @param[in] vbuf Vector buffer, the latest entry is just added.
+  @param[in] ave Prefix sums of vbuf.
+  @param[in] nave Number of average.
+  @param[in] th Threshold.
+ */
+static void StillCheck(
+			AKMPRMS		*prms,
+			int16		*cnt,
+			AKFVEC		*ref,
+	const	AKFS_RBUF	*vbuf,
+	const	AKFS_VAVE	*ave,
+	const	int16		nave,
+	const	AKFLOAT		th
+)
+{
+	AKFVEC v;
+
+	if (AKFS_VbAveGet(vbuf, ave, nave, &v) != AKFS_SUCCESS) {
+		return;
+	}
+	if ((fabs(v.u.x - ref->u.x) > th) ||
+		(fabs(v.u.y - ref->u.y) > th) ||
+		(fabs(v.u.z - ref->u.z) > th)) {
+		*ref = v;
+		*cnt = 0;
+		prms->i16_dircache = 0;
+	} else if (*cnt < CSPEC_STILL_CNT) {
+		(*cnt)++;
+	}
+}
+
+/******************************************************************************/
+/*! Check whether the device is still. The device is still when the last
+  CSPEC_STILL_CNT averaged magnetic vectors stay within CSPEC_STILL_HTH, and
+  the last CSPEC_STILL_CNT averaged acceleration vectors stay within
+  CSPEC_STILL_ATH from the reference vectors.
+  While the device is still, offset estimation is skipped, output vectors
+  are held and direction is taken from the last result.
+  @return Non-zero if the device is still and detection is enabled.
+  @param[in] prms A pointer to #AKMPRMS structure.
+ */
+int16 AKFS_IsStill(
+	const	AKMPRMS		*prms
+)
+{
+	return (prms->i16_stilldet &&
+		(prms->i16_hstillcnt >= CSPEC_STILL_CNT) &&
+		(prms->i16_astillcnt >= CSPEC_STILL_CNT));
+}
+
+/******************************************************************************/
+/*! Steps of #AKFS_Set_MAGNETIC_FIELD after decomposition, i.e. offset
+  estimation, offset subtraction, filtering and averaging. The decomposed
+  vector must be the latest entry of fva_hdata.
+  @return #AKM_SUCCESS on success. Otherwise the return value is #AKM_ERROR.
+  @param[in/out] prms A pointer to #AKMPRMS structure.
+  @param[in] mag Measurement data from magnetometer.
+  @param[in] hcal mag converted by s_hcal, or NULL to convert it here.
+  When the offset is updated, it is not used but converted again.
+  @param[out] updated Set to non-zero when s_hcal is changed. It can be NULL.
+ */
+static int16 SetDecomposed(
+			AKMPRMS		*prms,
+	const	int16		mag[3],
+	const	AKFVEC		*hcal,
+			int16		*updated
+)
+{
+	int16 akret;
+	int16 aocret;
+	int16 i;
+	AKFLOAT radius;
+	AKFVEC hv;
+	AKFS_CALIB_RESULT res;
+
+	/* Offset calculation is done in this function, or in the worker */
 	/* hdata[in] : Android coordinate, sensitivity adjusted. */
 	/* ho   [out]: Android coordinate, sensitivity adjusted. */
-	aocret = AKFS_AOC(
-		&prms->s_aocv,
-		prms->fva_hdata,
-		&prms->fv_ho
-	);
+	/* hsi  [out]: soft iron matrix (AKFS_AOC_ELLIPSOID only). */
+	/* A still device gives no new point, so it is skipped. */
+	if (AKFS_IsStill(prms)) {
+		aocret = AKFS_ERROR;
+	} else if (prms->s_calib.running) {
+		AKFS_PushCalib(&prms->s_calib, &AKFS_RBUF_AT(&prms->fva_hdata, 0));
+		if (AKFS_PollCalib(&prms->s_calib, &res) == AKM_SUCCESS) {
+			prms->fv_ho = res.ho;
+			for (i = 0; i < 3; i++) {
+				prms->fva_hsi[i] = res.hsi[i];
+			}
+			prms->f_hr = res.hr;
+			aocret = AKFS_SUCCESS;
+		} else {
+			aocret = AKFS_ERROR;
+		}
+	} else {
+		aocret = AKFS_EstimateOffset(
+			prms,
+			&AKFS_RBUF_AT(&prms->fva_hdata, 0),
+			&prms->fv_ho,
+			prms->fva_hsi,
+			&prms->f_hr
+		);
+	}
+	if (updated != NULL) {
+		*updated = (aocret == AKFS_SUCCESS);
+	}
+	if (aocret == AKFS_SUCCESS) {
+		/* Offset is updated */
+		if (AKFS_UpdateTransform(prms) != AKM_SUCCESS) {
+			return AKM_ERROR;
+		}
+		/* Output vectors are changed as well */
+		prms->i16_hstillcnt = 0;
+		prms->i16_dircache = 0;
+	}
 
 	/* Subtract offset */
-	/* hdata[in] : Android coordinate, sensitivity adjusted. */
-	/* ho   [in] : Android coordinate, sensitivity adjusted. */
+	/* mag  [in] : sensor local coordinate, sensor local unit. */
 	/* hvbuf[out]: Android coordinate, sensitivity adjusted, */
 	/*			   offset subtracted. */
-	akret = AKFS_VbNorm(
-		AKFS_HDATA_SIZE,
-		prms->fva_hdata,
-		1,
-		&prms->fv_ho,
-		&prms->fv_hs,
-		AKM_MAG_SENSE,
-		AKFS_HDATA_SIZE,
-		prms->fva_hvbuf
-	);
-	if (akret == AKFS_ERROR) {
-		AKMERROR;
-		return AKM_ERROR;
+	if ((hcal != NULL) && (aocret != AKFS_SUCCESS)) {
+		hv = *hcal;
+	} else {
+		prms->p_hcal(&prms->s_hcal, mag, &hv);
+	}
+	if (prms->i16_warmcheck > 0) {
+		WarmCheck(prms, &hv);
+	}
+	AKFS_RBufPush(&prms->fva_hvbuf, &hv);
+	AKFS_VbAveUpdate(&prms->fva_hvbuf, &prms->s_hvave);
+	if (prms->e_filter == AKFS_FILTER_KALMAN) {
+		AKFS_VFiltUpdate(&prms->s_hfilt[0], &hv);
+		AKFS_VFiltUpdate(&prms->s_hfilt[1], &hv);
+	} else if (prms->e_filter == AKFS_FILTER_ADAPTIVE) {
+		AKFS_VVarUpdate(&prms->s_hvar, &hv);
+		prms->i16a_hnave[0] = AKFS_VVarWindow(&prms->s_hvar, CSPEC_HNOISE,
+			CSPEC_HNAVE_MIN, CSPEC_HNAVE_D, prms->i16a_hnave[0]);
+		prms->i16a_hnave[1] = AKFS_VVarWindow(&prms->s_hvar, CSPEC_HNOISE,
+			CSPEC_HNAVE_MIN, CSPEC_HNAVE_V, prms->i16a_hnave[1]);
+	}
+
+	/* Hold the output while the device is still */
+	if (prms->i16_stilldet) {
+		StillCheck(prms, &prms->i16_hstillcnt, &prms->fv_hstill,
+			&prms->fva_hvbuf, &prms->s_hvave,
+			CSPEC_HNAVE_D, CSPEC_STILL_HTH);
+		if (AKFS_IsStill(prms)) {
+			return AKM_SUCCESS;
+		}
 	}
 
 	/* Averaging */
@@ -108,15 +404,19 @@ int16 AKFS_Set_MAGNETIC_FIELD(
 	/*			   offset subtracted. */
 	/* hvec [out]: Android coordinate, sensitivity adjusted, */
 	/*			   offset subtracted, averaged. */
-	akret = AKFS_VbAve(
-		AKFS_HDATA_SIZE,
-		prms->fva_hvbuf,
-		CSPEC_HNAVE_V,
-		&prms->fv_hvec
-	);
-	if (akret == AKFS_ERROR) {
-		AKMERROR;
-		return AKM_ERROR;
+	if (prms->e_filter == AKFS_FILTER_KALMAN) {
+		prms->fv_hvec = prms->s_hfilt[1].x;
+	} else {
+		akret = AKFS_VbAveGet(
+			&prms->fva_hvbuf,
+			&prms->s_hvave,
+			prms->i16a_hnave[1],
+			&prms->fv_hvec
+		);
+		if (akret == AKFS_ERROR) {
+			AKMERROR;
+			return AKM_ERROR;
+		}
 	}
 
 	/* Check the size of magnetic vector */
@@ -140,6 +440,138 @@ int16 AKFS_Set_MAGNETIC_FIELD(
 	return AKM_SUCCESS;
 }
 
+/******************************************************************************/
+/*! This function is called when new magnetometer data is available.  The
+  coordination system of input vector is sensor local coordination system.
+  The input vector will be converted to micro tesla unit (i.e. uT), then
+  rotated using layout pattern (i.e. e_hpat). Both are done at once with
+  the transforms made by #AKFS_UpdateTransform.
+  A magnetic offset is estimated automatically in this function.
+  As a result of it, offset subtracted vector is stored in #AKMPRMS structure.
+
+  @return #AKM_SUCCESS on success. Otherwise the return value is #AKM_ERROR.
+  @param[in] prms A pointer to #AKMPRMS structure.
+  @param[in] mag A set of measurement data from magnetometer.  X axis value
+  should be in mag[0], Y axis value should be in mag[1], Z axis value should be
+  in mag[2].
+  @param[in] status A status of magnetometer.  This status indicates the result
+  of measurement data, i.e. overflow, success or fail, etc.
+ */
+int16 AKFS_Set_MAGNETIC_FIELD(
+			AKMPRMS		*prms,
+	const	int16		mag[3],
+	const	int16		status
+)
+{
+	int16 akret;
+
+	AKMDEBUG(AKMDATA_MAG, "%s: m[0]=%d, m[1]=%d, m[2]=%d, st=%d\n",
+		__FUNCTION__, mag[0], mag[1], mag[2], status);
+
+	/* Decomposition and rotation */
+	/* mag  [in] : sensor local coordinate, sensor local unit. */
+	/* hdata[out]: Android coordinate, sensitivity adjusted (i.e. uT). */
+	akret = AKFS_DecompAffine(
+		mag,
+		status,
+		&prms->s_hdec,
+		prms->p_hdec,
+		&prms->fva_hdata
+	);
+	if (akret == AKFS_ERROR) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+
+	return SetDecomposed(prms, mag, NULL, NULL);
+}
+
+/******************************************************************************/
+/*! Batch version of #AKFS_Set_MAGNETIC_FIELD. Samples are converted by
+  #AKFS_DecompNormBatch in blocks of #AKFS_BATCH_BLOCK, both to the
+  decomposed vector for offset estimation and to the offset subtracted
+  vector. When the offset is updated in a block, the rest of the block is
+  converted again with the new transform. A sample whose status is an error
+  is skipped as #AKFS_Set_MAGNETIC_FIELD does.
+  The result is the same as calling #AKFS_Set_MAGNETIC_FIELD n times except
+  rounding, see #AKFS_DecompNormBatch.
+  @return The number of samples which are processed successfully.
+  @param[in] prms A pointer to #AKMPRMS structure.
+  @param[in] n The number of samples.
+  @param[in] mag Measurement data from magnetometer.
+  @param[in] status Status of each measurement data.
+  @param[out] hvec Output vector of each sample, i.e. fv_hvec after it.
+  @param[out] accuracy Accuracy of each sample, -1 if it failed.
+ */
+int16 AKFS_Set_MAGNETIC_FIELD_Batch(
+			AKMPRMS		*prms,
+	const	int16		n,
+	const	int16		mag[][3],
+	const	int16		status[],
+			AKFVEC		hvec[],
+			int16		accuracy[]
+)
+{
+	AKFLOAT dx[AKFS_BATCH_BLOCK], dy[AKFS_BATCH_BLOCK], dz[AKFS_BATCH_BLOCK];
+	AKFLOAT cx[AKFS_BATCH_BLOCK], cy[AKFS_BATCH_BLOCK], cz[AKFS_BATCH_BLOCK];
+	AKFVEC hdata;
+	AKFVEC hcal;
+	int16 updated;
+	int16 nsuccess;
+	int16 nb;
+	int16 i, j, k;
+
+	nsuccess = 0;
+	for (i = 0; i < n; i += nb) {
+		nb = ((n - i) < AKFS_BATCH_BLOCK) ? (n - i) : AKFS_BATCH_BLOCK;
+
+		/* mag  [in] : sensor local coordinate, sensor local unit. */
+		/* d    [out]: Android coordinate, sensitivity adjusted. */
+		/* c    [out]: Android coordinate, sensitivity adjusted, */
+		/*			   offset subtracted. */
+		AKFS_DecompNormBatch(&mag[i], nb, &prms->s_hdec, dx, dy, dz);
+		AKFS_DecompNormBatch(&mag[i], nb, &prms->s_hcal, cx, cy, cz);
+
+		for (j = 0; j < nb; j++) {
+			k = i + j;
+			AKMDEBUG(AKMDATA_MAG, "%s: m[0]=%d, m[1]=%d, m[2]=%d, st=%d\n",
+				__FUNCTION__, mag[k][0], mag[k][1], mag[k][2], status[k]);
+
+			/* put st1 and st2 value */
+			if (AKM_ST_ERROR(status[k])) {
+				AKMERROR;
+				accuracy[k] = -1;
+				hvec[k] = prms->fv_hvec;
+				continue;
+			}
+			hdata.u.x = dx[j];
+			hdata.u.y = dy[j];
+			hdata.u.z = dz[j];
+			AKFS_RBufPush(&prms->fva_hdata, &hdata);
+			hcal.u.x = cx[j];
+			hcal.u.y = cy[j];
+			hcal.u.z = cz[j];
+
+			updated = 0;
+			if (SetDecomposed(prms, mag[k], &hcal, &updated) == AKM_SUCCESS) {
+				accuracy[k] = prms->i16_hstatus;
+				nsuccess++;
+			} else {
+				accuracy[k] = -1;
+			}
+			hvec[k] = prms->fv_hvec;
+
+			/* The rest of the block is stale */
+			if (updated && (j + 1 < nb)) {
+				AKFS_DecompNormBatch(&mag[k + 1], nb - j - 1, &prms->s_hcal,
+					&cx[j + 1], &cy[j + 1], &cz[j + 1]);
+			}
+		}
+	}
+
+	return nsuccess;
+}
+
 /******************************************************************************/
 /*! This function is called when new accelerometer data is available.  The
   coordination system of input vector is Android coordination system.
@@ -159,28 +591,44 @@ int16 AKFS_Set_ACCELEROMETER(
 	const	int16		status
 )
 {
+#ifdef AKFS_OUTPUT_AVEC
 	int16 akret;
+#endif
+	AKFVEC avec;
 
 	AKMDEBUG(AKMDATA_ACC, "%s: a[0]=%d, a[1]=%d, a[2]=%d, st=%d\n",
 		__FUNCTION__, acc[0], acc[1], acc[2], status);
 
-	/* Make a spare area for new data */
-	akret = AKFS_BufShift(
-		AKFS_ADATA_SIZE,
-		1,
-		prms->fva_avbuf
-	);
-	if (akret == AKFS_ERROR) {
-		AKMERROR;
-		return AKM_ERROR;
-	}
 	/* Subtract offset, adjust sensitivity */
 	/* acc  [in] : Android coordinate, sensor local unit. */
 	/* avbuf[out]: Android coordinate, sensitivity adjusted (SI unit), */
 	/*			   offset subtracted. */
-	prms->fva_avbuf[0].u.x = AKM_ACC_TARGET * (((AKFLOAT)acc[0] - prms->fv_ao.u.x) / prms->fv_as.u.x);
-	prms->fva_avbuf[0].u.y = AKM_ACC_TARGET * (((AKFLOAT)acc[1] - prms->fv_ao.u.y) / prms->fv_as.u.y);
-	prms->fva_avbuf[0].u.z = AKM_ACC_TARGET * (((AKFLOAT)acc[2] - prms->fv_ao.u.z) / prms->fv_as.u.z);
+	avec.u.x = (AKFLOAT)acc[0];
+	avec.u.y = (AKFLOAT)acc[1];
+	avec.u.z = (AKFLOAT)acc[2];
+	AKFS_AffineApply(&prms->s_acal, &avec, &avec);
+	AKFS_RBufPush(&prms->fva_avbuf, &avec);
+	AKFS_VbAveUpdate(&prms->fva_avbuf, &prms->s_avave);
+	if (prms->e_filter == AKFS_FILTER_KALMAN) {
+		AKFS_VFiltUpdate(&prms->s_afilt[0], &avec);
+		AKFS_VFiltUpdate(&prms->s_afilt[1], &avec);
+	} else if (prms->e_filter == AKFS_FILTER_ADAPTIVE) {
+		AKFS_VVarUpdate(&prms->s_avar, &avec);
+		prms->i16a_anave[0] = AKFS_VVarWindow(&prms->s_avar, CSPEC_ANOISE,
+			CSPEC_ANAVE_MIN, CSPEC_ANAVE_D, prms->i16a_anave[0]);
+		prms->i16a_anave[1] = AKFS_VVarWindow(&prms->s_avar, CSPEC_ANOISE,
+			CSPEC_ANAVE_MIN, CSPEC_ANAVE_V, prms->i16a_anave[1]);
+	}
+
+	/* Hold the output while the device is still */
+	if (prms->i16_stilldet) {
+		StillCheck(prms, &prms->i16_astillcnt, &prms->fv_astill,
+			&prms->fva_avbuf, &prms->s_avave,
+			CSPEC_ANAVE_D, CSPEC_STILL_ATH);
+		if (AKFS_IsStill(prms)) {
+			return AKM_SUCCESS;
+		}
+	}
 
 #ifdef AKFS_OUTPUT_AVEC
 	/* Averaging */
@@ -188,15 +636,19 @@ int16 AKFS_Set_ACCELEROMETER(
 	/*			   offset subtracted. */
 	/* avec [out]: Android coordinate, sensitivity adjusted, */
 	/*			   offset subtracted, averaged. */
-	akret = AKFS_VbAve(
-		AKFS_ADATA_SIZE,
-		prms->fva_avbuf,
-		CSPEC_ANAVE_V,
-		&prms->fv_avec
-	);
-	if (akret == AKFS_ERROR) {
-		AKMERROR;
-		return AKM_ERROR;
+	if (prms->e_filter == AKFS_FILTER_KALMAN) {
+		prms->fv_avec = prms->s_afilt[1].x;
+	} else {
+		akret = AKFS_VbAveGet(
+			&prms->fva_avbuf,
+			&prms->s_avave,
+			prms->i16a_anave[1],
+			&prms->fv_avec
+		);
+		if (akret == AKFS_ERROR) {
+			AKMERROR;
+			return AKM_ERROR;
+		}
 	}
 
 	/* Debug output (accuracy is always '3' */
@@ -207,3 +659,41 @@ int16 AKFS_Set_ACCELEROMETER(
 	return AKM_SUCCESS;
 }
 
+/******************************************************************************/
+/*! Get magnetic and acceleration vectors for direction calculation. They
+  are averaged over CSPEC_HNAVE_D and CSPEC_ANAVE_D entries, or less when
+  #AKFS_FILTER_ADAPTIVE is selected. They are taken from the recursive
+  filters when #AKFS_FILTER_KALMAN is selected.
+  @return #AKM_SUCCESS on success. Otherwise the return value is #AKM_ERROR.
+  @param[in] prms A pointer to #AKMPRMS structure.
+  @param[out] hvec Magnetic vector.
+  @param[out] avec Acceleration vector.
+ */
+int16 AKFS_GetDirVectors(
+	const	AKMPRMS		*prms,
+			AKFVEC		*hvec,
+			AKFVEC		*avec
+)
+{
+	/* No data is available yet */
+	if ((prms->fva_hvbuf.num <= 0) || (prms->fva_avbuf.num <= 0)) {
+		return AKM_ERROR;
+	}
+
+	if (prms->e_filter == AKFS_FILTER_KALMAN) {
+		*hvec = prms->s_hfilt[0].x;
+		*avec = prms->s_afilt[0].x;
+		return AKM_SUCCESS;
+	}
+
+	if (AKFS_VbAveGet(&prms->fva_hvbuf, &prms->s_hvave, prms->i16a_hnave[0], hvec)
+			!= AKFS_SUCCESS) {
+		return AKM_ERROR;
+	}
+	if (AKFS_VbAveGet(&prms->fva_avbuf, &prms->s_avave, prms->i16a_anave[0], avec)
+			!= AKFS_SUCCESS) {
+		return AKM_ERROR;
+	}
+
+	return AKM_SUCCESS;
+}
@@ -24,22 +24,72 @@
 #define AKFS_GEOMAG_MAX	70
 #define AKFS_GEOMAG_MIN	10
 
+/* Bits of i16_dircache, results which can be reused while still */
+#define AKFS_DIRCACHE_ORI	0x01
+#define AKFS_DIRCACHE_RV	0x02
+
+/* Samples converted at once by #AKFS_Set_MAGNETIC_FIELD_Batch */
+#define AKFS_BATCH_BLOCK	16
+
 /*** Type declaration *********************************************************/
 
 /*** Global variables *********************************************************/
 
 /*** Prototype of function ****************************************************/
+int16 AKFS_UpdateTransform(
+			AKMPRMS		*prms
+);
+
+void AKFS_ResetEstimator(
+			AKMPRMS		*prms
+);
+
+int16 AKFS_EstimateOffset(
+			AKMPRMS		*prms,
+	const	AKFVEC		*hdata,
+			AKFVEC		*ho,
+			AKFVEC		hsi[3],
+			AKFLOAT		*hr
+);
+
+int16 AKFS_StartAsyncCalib(
+			AKMPRMS		*prms
+);
+
+void AKFS_StopAsyncCalib(
+			AKMPRMS		*prms
+);
+
+int16 AKFS_IsStill(
+	const	AKMPRMS		*prms
+);
+
 int16 AKFS_Set_MAGNETIC_FIELD(
 			AKMPRMS		*prms,
 	const	int16		mag[3],
 	const	int16		status
 );
 
+int16 AKFS_Set_MAGNETIC_FIELD_Batch(
+			AKMPRMS		*prms,
+	const	int16		n,
+	const	int16		mag[][3],
+	const	int16		status[],
+			AKFVEC		hvec[],
+			int16		accuracy[]
+);
+
 int16 AKFS_Set_ACCELEROMETER(
 			AKMPRMS		*prms,
 	const	int16		acc[3],
 	const	int16		status
 );
 
+int16 AKFS_GetDirVectors(
+	const	AKMPRMS		*prms,
+			AKFVEC		*hvec,
+			AKFVEC		*avec
+);
+
 #endif
 
@@ -0,0 +1,277 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include "AKFS_Common.h"
+#include "AKFS_Pipe.h"
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+/*** Constant definition ******************************************************/
+#define AKFS_PIPE_QMASK		(AKFS_PIPE_QSIZE - 1)
+
+/* Full memory barrier. */
+#define AKFS_BARRIER()		__sync_synchronize()
+
+/*** Static function **********************************************************/
+/*!
+ Get current time.
+ @return Monotonic time in nanosecond.
+ */
+static int64_t PipeNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*!
+ Add a latency to statistics.
+ @param[in/out] lat A pointer to #AKFS_LATENCY structure.
+ @param[in] ns Latency in nanosecond.
+ */
+static void PipeLatency(AKFS_LATENCY *lat, const int64_t ns)
+{
+	lat->sum += ns;
+	if (lat->max < ns) {
+		lat->max = ns;
+	}
+	lat->n++;
+}
+
+/*** Function *****************************************************************/
+/*!
+ Initialize a sample queue.
+ @return #AKM_SUCCESS on success. #AKM_ERROR if eventfd could not be
+  created.
+ @param[out] pipe A pointer to #AKFS_PIPE structure.
+ */
+int16 AKFS_InitPipe(
+			AKFS_PIPE			*pipe
+)
+{
+	memset(pipe, 0, sizeof(AKFS_PIPE));
+	pipe->evfd = eventfd(0, EFD_NONBLOCK);
+	if (pipe->evfd < 0) {
+		AKMERROR_STR("eventfd");
+		return AKM_ERROR;
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+ Release resources of a sample queue.
+ @param[in/out] pipe A pointer to #AKFS_PIPE structure.
+ */
+void AKFS_ReleasePipe(
+			AKFS_PIPE			*pipe
+)
+{
+	if (pipe->evfd >= 0) {
+		close(pipe->evfd);
+		pipe->evfd = -1;
+	}
+}
+
+/*!
+ Queue a sample and wake the consumer up. This function is called only by
+ the producer, and it never blocks.
+ @return #AKM_SUCCESS if the sample is queued. #AKM_ERROR if it is dropped
+  as the queue is full.
+ @param[in/out] pipe A pointer to #AKFS_PIPE structure.
+ @param[in/out] smp A sample. tpush is set by this function.
+ */
+int16 AKFS_PushPipe(
+			AKFS_PIPE			*pipe,
+			AKFS_SAMPLE			*smp
+)
+{
+	unsigned int head;
+	uint64_t val = 1;
+
+	head = pipe->qhead;
+	if ((head - pipe->qtail) >= AKFS_PIPE_QSIZE) {
+		pipe->ndrop++;
+		return AKM_ERROR;
+	}
+
+	smp->tpush = PipeNow();
+	pipe->q[head & AKFS_PIPE_QMASK] = *smp;
+	AKFS_BARRIER();
+	pipe->qhead = head + 1;
+
+	/* Counter overflow is impossible, so EAGAIN is not expected. */
+	if (write(pipe->evfd, &val, sizeof(val)) < 0) {
+		AKMERROR_STR("write");
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+ Tell the consumer that no more sample is queued. This function is called
+ only by the producer.
+ @param[in/out] pipe A pointer to #AKFS_PIPE structure.
+ */
+void AKFS_ClosePipe(
+			AKFS_PIPE			*pipe
+)
+{
+	uint64_t val = 1;
+
+	pipe->done = 1;
+	AKFS_BARRIER();
+	if (write(pipe->evfd, &val, sizeof(val)) < 0) {
+		AKMERROR_STR("write");
+	}
+}
+
+/*!
+ Wait until a sample is queued or the producer finishes. This function is
+ called only by the consumer.
+ @return #AKM_SUCCESS when woken up. #AKM_ERROR on error.
+ @param[in/out] pipe A pointer to #AKFS_PIPE structure.
+ */
+int16 AKFS_WaitPipe(
+			AKFS_PIPE			*pipe
+)
+{
+	struct pollfd pfd;
+	uint64_t val;
+
+	pfd.fd = pipe->evfd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, -1) < 0) {
+		if (errno == EINTR) {
+			return AKM_SUCCESS;
+		}
+		AKMERROR_STR("poll");
+		return AKM_ERROR;
+	}
+	/* Reset counter, samples are counted by qhead */
+	read(pipe->evfd, &val, sizeof(val));
+	return AKM_SUCCESS;
+}
+
+/*!
+ Dequeue samples in order. This function is called only by the consumer.
+ Queue depth and latency until dequeue are recorded, and tpop is set.
+ @return The number of samples stored in smp.
+ @param[in/out] pipe A pointer to #AKFS_PIPE structure.
+ @param[out] smp Samples.
+ @param[in] max The maximum number of samples to be dequeued.
+ */
+int16 AKFS_PopPipe(
+			AKFS_PIPE			*pipe,
+			AKFS_SAMPLE			smp[],
+	const	int16				max
+)
+{
+	unsigned int tail;
+	unsigned int depth;
+	int64_t now;
+	int16 n;
+	int16 i;
+
+	tail = pipe->qtail;
+	depth = pipe->qhead - tail;
+	if (depth == 0) {
+		return 0;
+	}
+	AKFS_BARRIER();
+	for (n = 0; (n < max) && (tail != pipe->qhead); n++) {
+		smp[n] = pipe->q[tail & AKFS_PIPE_QMASK];
+		tail++;
+	}
+	AKFS_BARRIER();
+	pipe->qtail = tail;
+
+	pipe->npop++;
+	pipe->dsum += depth;
+	if (pipe->dmax < depth) {
+		pipe->dmax = depth;
+	}
+	now = PipeNow();
+	for (i = 0; i < n; i++) {
+		smp[i].tpop = now;
+		PipeLatency(&pipe->lat[AKFS_PIPE_ACQUIRE],
+			smp[i].tpush - smp[i].twake);
+		PipeLatency(&pipe->lat[AKFS_PIPE_QUEUE], now - smp[i].tpush);
+	}
+	return n;
+}
+
+/*!
+ Record latency after the result of dequeued samples is output. Latency of
+ computation is counted once for a batch, and that from wakeup until output
+ is counted for every sample.
+ @param[in/out] pipe A pointer to #AKFS_PIPE structure.
+ @param[in] smp Samples which are returned by #AKFS_PopPipe.
+ @param[in] n The number of samples.
+ */
+void AKFS_DonePipe(
+			AKFS_PIPE			*pipe,
+	const	AKFS_SAMPLE			smp[],
+	const	int16				n
+)
+{
+	int64_t now;
+	int16 i;
+
+	if (n <= 0) {
+		return;
+	}
+	now = PipeNow();
+	PipeLatency(&pipe->lat[AKFS_PIPE_COMPUTE], now - smp[0].tpop);
+	for (i = 0; i < n; i++) {
+		PipeLatency(&pipe->lat[AKFS_PIPE_TOTAL], now - smp[i].twake);
+	}
+}
+
+/*!
+ Show statistics of a sample queue.
+ @param[in] pipe A pointer to #AKFS_PIPE structure.
+ */
+void AKFS_PrintPipe(
+	const	AKFS_PIPE			*pipe
+)
+{
+	static const char *name[AKFS_PIPE_NSTAGE] = {
+		"acquire", "queue", "compute", "total"
+	};
+	const AKFS_LATENCY *lat;
+	int i;
+
+	if (pipe->npop == 0) {
+		return;
+	}
+	AKMDEBUG(AKMDATA_DUMP,
+		"%s: depth mean=%.2f max=%u, %u batches, %u dropped\n",
+		__FUNCTION__, (double)pipe->dsum / pipe->npop, pipe->dmax,
+		pipe->npop, pipe->ndrop);
+	for (i = 0; i < AKFS_PIPE_NSTAGE; i++) {
+		lat = &pipe->lat[i];
+		if (lat->n == 0) {
+			continue;
+		}
+		AKMDEBUG(AKMDATA_DUMP,
+			"%s: %-7s latency mean=%lld max=%lld usec\n", __FUNCTION__,
+			name[i], (long long)(lat->sum / lat->n / 1000),
+			(long long)(lat->max / 1000));
+	}
+}
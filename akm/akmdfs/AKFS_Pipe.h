@@ -0,0 +1,124 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_PIPE_H
+#define AKFS_INC_PIPE_H
+
+/* Include file for AKM daemon. */
+#include "AKFS_Compass.h"
+
+/*** Constant definition ******************************************************/
+/* Size of sample queue. This must be a power of 2. */
+#define AKFS_PIPE_QSIZE		32
+/* Maximum number of samples which are drained at once. */
+#define AKFS_PIPE_BATCH		8
+
+/* Stages of latency */
+#define AKFS_PIPE_ACQUIRE	0	/* From wakeup until the sample is queued */
+#define AKFS_PIPE_QUEUE		1	/* Waiting in the queue */
+#define AKFS_PIPE_COMPUTE	2	/* From dequeue until the result is output */
+#define AKFS_PIPE_TOTAL		3	/* From wakeup until the result is output */
+#define AKFS_PIPE_NSTAGE	4
+
+/*** Type declaration *********************************************************/
+/*! A raw sample, which is taken by acquisition thread. */
+typedef struct _AKFS_SAMPLE {
+	int64_t	twake;		/* Wakeup time of acquisition in ns */
+	int64_t	tpush;		/* Time when the sample is queued in ns */
+	int64_t	tpop;		/* Time when the sample is dequeued in ns */
+	uint16	flag;		/* Sensors which are due, *_DATA_READY */
+	uint16	measured;	/* Sensors whose data is read, *_DATA_READY */
+	uint16	enabled;	/* Sensors which are enabled by driver */
+	int16	acc[3];
+	BYTE	mag[AKM_SENSOR_DATA_SIZE];	/* ST1 ~ ST2 */
+} AKFS_SAMPLE;
+
+/*! Latency of a stage. */
+typedef struct _AKFS_LATENCY {
+	int64_t		sum;
+	int64_t		max;
+	uint32_t	n;
+} AKFS_LATENCY;
+
+/*! Sample queue from acquisition thread to compute thread.
+  The queue is a single producer, single consumer ring, i.e. qhead is
+  written only by the producer and qtail only by the consumer, same as
+  #AKFS_CALIB. The producer never blocks: a sample is dropped when the
+  queue is full, and the consumer is woken up through a non-blocking
+  eventfd. Statistics are owned by the consumer. */
+typedef struct _AKFS_PIPE {
+	/* Sample queue */
+	AKFS_SAMPLE			q[AKFS_PIPE_QSIZE];
+	volatile unsigned int	qhead;
+	volatile unsigned int	qtail;
+	unsigned int		ndrop;		/* Samples dropped as queue is full */
+	int					evfd;		/* eventfd to wake the consumer up */
+
+	/* Hints between threads */
+	volatile int		still;		/* Set by the consumer, see AKFS_IsStill */
+	volatile int		done;		/* Set by the producer when it finishes */
+	volatile int		stop;		/* Set by the consumer to stop the producer */
+
+	/* Statistics */
+	AKFS_LATENCY		lat[AKFS_PIPE_NSTAGE];
+	uint32_t			npop;		/* Number of batches */
+	uint32_t			dsum;		/* Sum of queue depth at each batch */
+	uint32_t			dmax;		/* Maximum of queue depth */
+} AKFS_PIPE;
+
+/*** Global variables *********************************************************/
+
+/*** Prototype of function ****************************************************/
+int16 AKFS_InitPipe(
+			AKFS_PIPE			*pipe
+);
+
+void AKFS_ReleasePipe(
+			AKFS_PIPE			*pipe
+);
+
+int16 AKFS_PushPipe(
+			AKFS_PIPE			*pipe,
+			AKFS_SAMPLE			*smp
+);
+
+void AKFS_ClosePipe(
+			AKFS_PIPE			*pipe
+);
+
+int16 AKFS_WaitPipe(
+			AKFS_PIPE			*pipe
+);
+
+int16 AKFS_PopPipe(
+			AKFS_PIPE			*pipe,
+			AKFS_SAMPLE			smp[],
+	const	int16				max
+);
+
+void AKFS_DonePipe(
+			AKFS_PIPE			*pipe,
+	const	AKFS_SAMPLE			smp[],
+	const	int16				n
+);
+
+void AKFS_PrintPipe(
+	const	AKFS_PIPE			*pipe
+);
+
+#endif
+
@@ -13,18 +13,24 @@ LOCAL_C_INCLUDES := \
 
 LOCAL_SRC_FILES:= \
 	$(AKM_FS_LIB)/AKFS_AOC.c \
+	$(AKM_FS_LIB)/AKFS_Batch.c \
 	$(AKM_FS_LIB)/AKFS_Decomp.c \
 	$(AKM_FS_LIB)/AKFS_Device.c \
 	$(AKM_FS_LIB)/AKFS_Direction.c \
+	$(AKM_FS_LIB)/AKFS_Ellipsoid.c \
+	$(AKM_FS_LIB)/AKFS_Sphere.c \
 	$(AKM_FS_LIB)/AKFS_VNorm.c \
 	AKFS_Driver.c \
 	AKFS_APIs.c \
+	AKFS_Calib.c \
 	AKFS_Disp.c \
 	AKFS_FileIO.c \
 	AKFS_Measure.c \
+	AKFS_Pipe.c \
 	main.c
 
 LOCAL_CFLAGS += -Wall
+LOCAL_CFLAGS += -D_GNU_SOURCE
 LOCAL_CFLAGS += -DAKFS_OUTPUT_AVEC
 LOCAL_CFLAGS += -DAKM_VALUE_CHECK
 LOCAL_CFLAGS += -DENABLE_AKMDEBUG=1
@@ -45,6 +51,53 @@ LOCAL_FORCE_STATIC_EXECUTABLE := false
 LOCAL_SHARED_LIBRARIES := libc libm libcutils
 include $(BUILD_EXECUTABLE)
 
+##### Benchmark ################################################################
+# Measurements of the library and a load generator for bench/jitter.sh.
+# It is not installed by default, build it with "mmm" and push it.
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES := \
+	$(KERNEL_HEADERS) \
+	$(LOCAL_PATH) \
+	$(LOCAL_PATH)/$(AKM_FS_LIB)
+
+LOCAL_SRC_FILES:= \
+	$(AKM_FS_LIB)/AKFS_AOC.c \
+	$(AKM_FS_LIB)/AKFS_Batch.c \
+	$(AKM_FS_LIB)/AKFS_Decomp.c \
+	$(AKM_FS_LIB)/AKFS_Device.c \
+	$(AKM_FS_LIB)/AKFS_Direction.c \
+	$(AKM_FS_LIB)/AKFS_Ellipsoid.c \
+	$(AKM_FS_LIB)/AKFS_Sphere.c \
+	$(AKM_FS_LIB)/AKFS_VNorm.c \
+	AKFS_APIs.c \
+	AKFS_Calib.c \
+	AKFS_FileIO.c \
+	AKFS_Measure.c \
+	bench/AKFS_Bench.c
+
+LOCAL_CFLAGS += -Wall
+LOCAL_CFLAGS += -D_GNU_SOURCE
+LOCAL_CFLAGS += -DAKFS_OUTPUT_AVEC
+LOCAL_CFLAGS += -DAKM_VALUE_CHECK
+LOCAL_CFLAGS += -DENABLE_AKMDEBUG=1
+
+ifeq ($(AKMD_DEVICE_TYPE), 8963)
+LOCAL_CFLAGS += -DAKM_DEVICE_AK8963
+endif
+ifeq ($(AKMD_DEVICE_TYPE), 8975)
+LOCAL_CFLAGS += -DAKM_DEVICE_AK8975
+endif
+ifeq ($(AKMD_DEVICE_TYPE), 9911)
+LOCAL_CFLAGS += -DAKM_DEVICE_AK09911
+endif
+
+LOCAL_MODULE := akmdfs_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_FORCE_STATIC_EXECUTABLE := false
+LOCAL_SHARED_LIBRARIES := libc libm libcutils
+include $(BUILD_EXECUTABLE)
+
 
 endif  # TARGET_SIMULATOR != true
 
@@ -0,0 +1,1161 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+/* Benchmark of the library and the daemon. It is built apart from akmdfs,
+   and each sub command reproduces the measurement of one change:
+     rbuf    Ring buffer against the former array shift, and the whole
+             sample path.
+     batch   AKFS_DecompNormBatch and the layout kernel against
+             AKFS_AffineApply.
+     dir     AKFS_Direction against the former asin/sin/cos kernel, and
+             AKFS_RotationVector on the same input.
+     filter  Lag and noise of box average, recursive filter and adaptive
+             average.
+     fit     Offset estimators on a session with hard and soft iron, alone
+             and in the library, and the output transform they leave.
+     gen     Write a synthetic session for replay.
+     replay  Feed a recorded session to the library and print the output.
+     hog     Busy loops which load CPUs, see jitter.sh. */
+#include "AKFS_Common.h"
+#include "AKFS_Compass.h"
+#include "AKFS_APIs.h"
+#include "AKFS_Measure.h"
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+/*** Constant definition ******************************************************/
+#define BENCH_SETTING_FILE	"akmdfs_bench.bin"
+/* Synthetic samples */
+#define BENCH_RATE_HZ		50
+#define BENCH_MAG_NOISE		0.3f	/* uT, per axis */
+#define BENCH_MAG_FIELD		45.0f	/* uT */
+#define BENCH_MAX_THREADS	16
+/* Trials of a step response */
+#define BENCH_STEP_TRIALS	200
+
+#ifndef M_PI
+#define M_PI	3.14159265358979323846
+#endif
+
+/*** Global variables *********************************************************/
+int g_stopRequest = 0;
+int g_opmode = 0;
+int g_dbgzone = 0;
+
+/* Results of timed loops are accumulated here, so that loops are not
+   removed by the compiler. */
+static volatile AKFLOAT s_sink;
+
+/*** Timer ********************************************************************/
+typedef struct _BENCH_TIMER {
+	int64_t		ns;
+	uint64_t	cycles;
+} BENCH_TIMER;
+
+static int64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+#define BENCH_HAS_CYCLES
+static uint64_t ReadCycles(void)
+{
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+#else
+static uint64_t ReadCycles(void)
+{
+	return 0;
+}
+#endif
+
+static void TimerStart(BENCH_TIMER *t)
+{
+	t->cycles = ReadCycles();
+	t->ns = NowNs();
+}
+
+static void TimerStop(BENCH_TIMER *t)
+{
+	t->ns = NowNs() - t->ns;
+	t->cycles = ReadCycles() - t->cycles;
+}
+
+/*!
+  Print the time of a loop per iteration. Cycles are shown only where the
+  time stamp counter is available.
+ */
+static void TimerPrint(const char *name, const BENCH_TIMER *t, const int n)
+{
+#ifdef BENCH_HAS_CYCLES
+	printf("  %-36s %8.1f ns %8.1f cycles\n", name,
+		(double)t->ns / n, (double)t->cycles / n);
+#else
+	printf("  %-36s %8.1f ns\n", name, (double)t->ns / n);
+#endif
+}
+
+/*** Synthetic data ***********************************************************/
+static double Uniform(unsigned *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (((*seed >> 8) & 0xFFFFFF) + 1.0) / 16777218.0;
+}
+
+static double Gauss(unsigned *seed)
+{
+	double u = Uniform(seed);
+	double v = Uniform(seed);
+
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/*!
+  Make the i-th raw sample of a device which turns around two axes in a
+  constant field, so that offset estimation converges. Magnetometer data
+  has offset and noise of a few LSB.
+ */
+static void GenSample(
+	const	int			i,
+			unsigned	*seed,
+			int16		mag[3],
+			int16		acc[3]
+)
+{
+	double a = i * 0.37;
+	double b = sin(i * 0.11) * 1.2;
+	double n = Gauss(seed) * 2.0;
+
+	mag[0] = (int16)lrint(200 * cos(a) * cos(b) + 60 + n);
+	mag[1] = (int16)lrint(200 * sin(a) * cos(b) - 40 + Gauss(seed) * 2.0);
+	mag[2] = (int16)lrint(200 * sin(b) + 25 - n);
+	acc[0] = (int16)lrint(300 * sin(b) + Gauss(seed) * 3.0);
+	acc[1] = (int16)lrint(200 * cos(a) + Gauss(seed) * 3.0);
+	acc[2] = (int16)lrint(600 + Gauss(seed) * 3.0);
+}
+
+/*!
+  Initialize the library as the daemon does. The setting file of the
+  previous run is removed, so every run starts from the same state.
+ */
+static int16 InitLib(
+			AKMPRMS			*prms,
+	const	AKFS_PATNO		pat,
+	const	AKFS_FILTER_MODE	filter,
+	const	AKFS_AOC_MODE	aoc
+)
+{
+	const uint8 regs[3] = {128, 128, 128};
+
+	remove(BENCH_SETTING_FILE);
+	if (AKFS_Init(prms, pat, regs) != AKM_SUCCESS) {
+		return AKM_ERROR;
+	}
+	if ((AKFS_SetFilterMode(prms, filter) != AKM_SUCCESS) ||
+		(AKFS_SetAOCMode(prms, aoc) != AKM_SUCCESS)) {
+		return AKM_ERROR;
+	}
+	return AKFS_Start(prms, BENCH_SETTING_FILE);
+}
+
+/*** rbuf *********************************************************************/
+/*!
+  Former history store of the library, which shifts the whole array to add
+  one entry. It is kept here as the reference of #AKFS_RBUF.
+ */
+static void BufShift(
+	const	int16	len,
+	const	int16	shift,
+			AKFVEC	v[]
+)
+{
+	int16 i;
+
+	for (i = len-1; i >= shift; i--) {
+		v[i] = v[i-shift];
+	}
+}
+
+/*!
+  Cost of adding a sample to a history of #AKFS_HDATA_SIZE entries, by
+  shifting the array as before and with #AKFS_RBUF. Then the cost of the
+  whole sample path, i.e. one accelerometer and one magnetometer sample and
+  the orientation.
+ */
+static int BenchRBuf(const int n)
+{
+	static AKMPRMS prms;
+	AKFVEC buf[AKFS_HDATA_SIZE];
+	AKFS_RBUF rb;
+	AKFVEC v;
+	BENCH_TIMER t;
+	unsigned seed = 1;
+	int16 mag[3], acc[3];
+	int16 ac;
+	AKFLOAT x, y, z;
+	int i;
+
+	memset(buf, 0, sizeof(buf));
+	AKFS_InitRBuf(AKFS_HDATA_SIZE, &rb);
+	v.u.y = 0;
+	v.u.z = 0;
+
+	printf("rbuf: %d samples, history of %d entries\n", n, AKFS_HDATA_SIZE);
+
+	TimerStart(&t);
+	for (i = 0; i < n; i++) {
+		v.u.x = (AKFLOAT)i;
+		BufShift(AKFS_HDATA_SIZE, 1, buf);
+		buf[0] = v;
+	}
+	TimerStop(&t);
+	s_sink += buf[1].u.x;
+	TimerPrint("Array shift", &t, n);
+
+	TimerStart(&t);
+	for (i = 0; i < n; i++) {
+		v.u.x = (AKFLOAT)i;
+		AKFS_RBufPush(&rb, &v);
+	}
+	TimerStop(&t);
+	s_sink += AKFS_RBUF_AT(&rb, 1).u.x;
+	TimerPrint("AKFS_RBufPush", &t, n);
+
+	if (InitLib(&prms, PAT1, AKFS_FILTER_BOX, AKFS_AOC_4POINTS) != AKM_SUCCESS) {
+		return 1;
+	}
+	TimerStart(&t);
+	for (i = 0; i < n; i++) {
+		GenSample(i, &seed, mag, acc);
+		AKFS_Get_ACCELEROMETER(&prms, acc, 0, &x, &y, &z, &ac);
+		AKFS_Get_MAGNETIC_FIELD(&prms, mag, 0x11, &x, &y, &z, &ac);
+		AKFS_Get_ORIENTATION(&prms, &x, &y, &z, &ac);
+		s_sink += x;
+	}
+	TimerStop(&t);
+	TimerPrint("Sample path (incl. generator)", &t, n);
+
+	return 0;
+}
+
+/*** batch ********************************************************************/
+/*!
+  Check #AKFS_DecompNormBatch and the kernel of the layout pattern against
+  #AKFS_AffineApply with the transform of a calibrated library, and compare
+  the time of them. The difference
+  must be rounding only. Every length up to #AKFS_BATCH_BLOCK is checked, so
+  that the remainder of vector lanes is covered.
+  @return 0 if the difference is small enough.
+ */
+static int BenchBatch(const int n)
+{
+	static AKMPRMS prms;
+	static int16 raw[AKFS_BATCH_BLOCK][3];
+	AKFLOAT vx[AKFS_BATCH_BLOCK], vy[AKFS_BATCH_BLOCK], vz[AKFS_BATCH_BLOCK];
+	AKFVEC in, out, kout;
+	BENCH_TIMER t;
+	unsigned seed = 1;
+	int16 acc[3];
+	AKFLOAT d, dmax = 0;
+	int i, j, len;
+
+	if (InitLib(&prms, PAT3, AKFS_FILTER_BOX, AKFS_AOC_4POINTS) != AKM_SUCCESS) {
+		return 1;
+	}
+	for (i = 0; i < 2000; i++) {
+		GenSample(i, &seed, raw[0], acc);
+		AKFS_Set_MAGNETIC_FIELD(&prms, raw[0], 0x11);
+	}
+
+	for (len = 0; len <= AKFS_BATCH_BLOCK; len++) {
+		for (i = 0; i < len; i++) {
+			GenSample(i, &seed, raw[i], acc);
+		}
+		if (AKFS_DecompNormBatch(raw, (int16)len, &prms.s_hcal, vx, vy, vz)
+			!= AKFS_SUCCESS) {
+			return 1;
+		}
+		for (i = 0; i < len; i++) {
+			for (j = 0; j < 3; j++) {
+				in.v[j] = (AKFLOAT)raw[i][j];
+			}
+			AKFS_AffineApply(&prms.s_hcal, &in, &out);
+			d = fabs(vx[i] - out.u.x) + fabs(vy[i] - out.u.y) + fabs(vz[i] - out.u.z);
+			if (d > dmax) {
+				dmax = d;
+			}
+			prms.p_hcal(&prms.s_hcal, raw[i], &kout);
+			d = fabs(kout.u.x - out.u.x) + fabs(kout.u.y - out.u.y) + fabs(kout.u.z - out.u.z);
+			if (d > dmax) {
+				dmax = d;
+			}
+		}
+	}
+	printf("batch: offset %.2f %.2f %.2f, max difference %g uT\n",
+		prms.fv_ho.u.x, prms.fv_ho.u.y, prms.fv_ho.u.z, dmax);
+
+	TimerStart(&t);
+	for (i = 0; i < n; i += AKFS_BATCH_BLOCK) {
+		AKFS_DecompNormBatch(raw, AKFS_BATCH_BLOCK, &prms.s_hcal, vx, vy, vz);
+		s_sink += vx[3];
+	}
+	TimerStop(&t);
+	TimerPrint("AKFS_DecompNormBatch", &t, n);
+
+	TimerStart(&t);
+	for (i = 0; i < n; i += AKFS_BATCH_BLOCK) {
+		for (j = 0; j < AKFS_BATCH_BLOCK; j++) {
+			in.u.x = (AKFLOAT)raw[j][0];
+			in.u.y = (AKFLOAT)raw[j][1];
+			in.u.z = (AKFLOAT)raw[j][2];
+			AKFS_AffineApply(&prms.s_hcal, &in, &out);
+			vx[j] = out.u.x;
+		}
+		s_sink += vx[3];
+	}
+	TimerStop(&t);
+	TimerPrint("AKFS_AffineApply", &t, n);
+
+	TimerStart(&t);
+	for (i = 0; i < n; i += AKFS_BATCH_BLOCK) {
+		for (j = 0; j < AKFS_BATCH_BLOCK; j++) {
+			prms.p_hcal(&prms.s_hcal, raw[j], &out);
+			vx[j] = out.u.x;
+		}
+		s_sink += vx[3];
+	}
+	TimerStop(&t);
+	TimerPrint("Layout kernel (p_hcal)", &t, n);
+
+	return (dmax < 1.0e-3f) ? 0 : 1;
+}
+
+/*** dir **********************************************************************/
+/*!
+  Former direction kernel, i.e. pitch and roll by asin, then their sine and
+  cosine for the azimuth. It is kept here as the reference.
+ */
+static int16 DirectionRef(
+	const	AKFVEC		*hvec,
+	const	AKFVEC		*avec,
+			AKFLOAT		*azimuth,
+			AKFLOAT		*pitch,
+			AKFLOAT		*roll
+)
+{
+	AKFLOAT av;
+	AKFLOAT p, r;
+	AKFLOAT sinP, cosP, sinR, cosR;
+	AKFLOAT Xh, Yh;
+
+	av = AKFS_SQRT((avec->u.x)*(avec->u.x) + (avec->u.y)*(avec->u.y) +
+		(avec->u.z)*(avec->u.z));
+	if (av < AKFS_EPSILON) {
+		return AKFS_ERROR;
+	}
+	p = AKFS_ASIN(-(avec->u.y) / av);
+	r = AKFS_ASIN((avec->u.x) / av);
+
+	sinP = AKFS_SIN(p);
+	cosP = AKFS_COS(p);
+	sinR = AKFS_SIN(r);
+	cosR = AKFS_COS(r);
+	Yh = -(hvec->u.x)*cosR + (hvec->u.z)*sinR;
+	Xh = (hvec->u.x)*sinP*sinR + (hvec->u.y)*cosP + (hvec->u.z)*sinP*cosR;
+
+	*azimuth = RAD2DEG(AKFS_ATAN2(Yh, Xh));
+	*pitch = RAD2DEG(p);
+	*roll = RAD2DEG(r);
+	if (*azimuth < 0) {
+		*azimuth += 360.0f;
+	}
+	return AKFS_SUCCESS;
+}
+
+/*!
+  The same as #DirectionRef in double precision, which is regarded as the
+  exact value.
+ */
+static void DirectionExact(
+	const	AKFVEC		*hvec,
+	const	AKFVEC		*avec,
+			double		out[3]
+)
+{
+	double ax = avec->u.x, ay = avec->u.y, az = avec->u.z;
+	double hx = hvec->u.x, hy = hvec->u.y, hz = hvec->u.z;
+	double av = sqrt(ax * ax + ay * ay + az * az);
+	double p = asin(-ay / av);
+	double r = asin(ax / av);
+	double Yh = -hx * cos(r) + hz * sin(r);
+	double Xh = hx * sin(p) * sin(r) + hy * cos(p) + hz * sin(p) * cos(r);
+
+	out[0] = atan2(Yh, Xh) * 180.0 / M_PI;
+	if (out[0] < 0) {
+		out[0] += 360.0;
+	}
+	out[1] = p * 180.0 / M_PI;
+	out[2] = r * 180.0 / M_PI;
+}
+
+/* Difference of angles in degree, azimuth wraps around. */
+static double AngleDiff(const double a, const double b, const int wrap)
+{
+	double d = fabs(a - b);
+
+	if (wrap && (d > 180.0)) {
+		d = 360.0 - d;
+	}
+	return d;
+}
+
+static int BenchDir(const int n)
+{
+	AKFVEC *h, *a;
+	AKFLOAT o[3];
+	AKFLOAT q[4];
+	double ex[3];
+	double errNew[3] = {0, 0, 0};
+	double errRef[3] = {0, 0, 0};
+	BENCH_TIMER t;
+	unsigned seed = 1;
+	int i, k;
+
+	h = (AKFVEC *)malloc(sizeof(AKFVEC) * n);
+	a = (AKFVEC *)malloc(sizeof(AKFVEC) * n);
+	if ((h == NULL) || (a == NULL)) {
+		free(h);
+		free(a);
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < 3; k++) {
+			h[i].v[k] = (AKFLOAT)((Uniform(&seed) - 0.5) * 100.0);
+			a[i].v[k] = (AKFLOAT)((Uniform(&seed) - 0.5) * 20.0);
+		}
+	}
+
+#ifdef AKFS_FAST_ATAN
+	printf("dir: %d random orientations, AKFS_FAST_ATAN\n", n);
+#else
+	printf("dir: %d random orientations\n", n);
+#endif
+
+	/* Error against the exact value */
+	for (i = 0; i < n; i++) {
+		DirectionExact(&h[i], &a[i], ex);
+		if (AKFS_Direction(&h[i], &a[i], &o[0], &o[1], &o[2]) == AKFS_SUCCESS) {
+			for (k = 0; k < 3; k++) {
+				if (AngleDiff(o[k], ex[k], k == 0) > errNew[k]) {
+					errNew[k] = AngleDiff(o[k], ex[k], k == 0);
+				}
+			}
+		}
+		if (DirectionRef(&h[i], &a[i], &o[0], &o[1], &o[2]) == AKFS_SUCCESS) {
+			for (k = 0; k < 3; k++) {
+				if (AngleDiff(o[k], ex[k], k == 0) > errRef[k]) {
+					errRef[k] = AngleDiff(o[k], ex[k], k == 0);
+				}
+			}
+		}
+	}
+	printf("  max error (deg)      azimuth    pitch     roll\n");
+	printf("  AKFS_Direction     %9.5f %9.5f %9.5f\n", errNew[0], errNew[1], errNew[2]);
+	printf("  reference          %9.5f %9.5f %9.5f\n", errRef[0], errRef[1], errRef[2]);
+
+	TimerStart(&t);
+	for (i = 0; i < n; i++) {
+		AKFS_Direction(&h[i], &a[i], &o[0], &o[1], &o[2]);
+		s_sink += o[0];
+	}
+	TimerStop(&t);
+	TimerPrint("AKFS_Direction", &t, n);
+
+	TimerStart(&t);
+	for (i = 0; i < n; i++) {
+		DirectionRef(&h[i], &a[i], &o[0], &o[1], &o[2]);
+		s_sink += o[0];
+	}
+	TimerStop(&t);
+	TimerPrint("reference (asin, sin, cos, atan2)", &t, n);
+
+	/* Same input as the rotation vector output */
+	TimerStart(&t);
+	for (i = 0; i < n; i++) {
+		AKFS_RotationVector(&h[i], &a[i], q);
+		s_sink += q[3];
+	}
+	TimerStop(&t);
+	TimerPrint("AKFS_RotationVector", &t, n);
+
+	free(h);
+	free(a);
+	return 0;
+}
+
+/*** filter *******************************************************************/
+/* State of one smoothing method, which is the same as the magnetic vector
+   output of #AKFS_Set_MAGNETIC_FIELD. */
+typedef struct _BENCH_FILTER {
+	AKFS_FILTER_MODE	mode;
+	int16		nave;
+	int16		ncur;
+	AKFS_RBUF	rb;
+	AKFS_VAVE	ave;
+	AKFS_VFILT	filt;
+	AKFS_VVAR	var;
+} BENCH_FILTER;
+
+static void FilterInit(BENCH_FILTER *f, const AKFS_FILTER_MODE mode, const int16 nave)
+{
+	f->mode = mode;
+	f->nave = nave;
+	f->ncur = nave;
+	AKFS_InitRBuf(AKFS_HDATA_SIZE, &f->rb);
+	AKFS_InitVbAve(&f->rb, 1, &f->nave, &f->ave);
+	AKFS_InitVFilt(nave, CSPEC_HNOISE, &f->filt);
+	AKFS_InitVVar(nave, &f->var);
+}
+
+static void FilterUpdate(BENCH_FILTER *f, const AKFVEC *in, AKFVEC *out)
+{
+	AKFS_RBufPush(&f->rb, in);
+	AKFS_VbAveUpdate(&f->rb, &f->ave);
+	if (f->mode == AKFS_FILTER_KALMAN) {
+		AKFS_VFiltUpdate(&f->filt, in);
+		*out = f->filt.x;
+		return;
+	}
+	if (f->mode == AKFS_FILTER_ADAPTIVE) {
+		AKFS_VVarUpdate(&f->var, in);
+		f->ncur = AKFS_VVarWindow(&f->var, CSPEC_HNOISE, CSPEC_HNAVE_MIN,
+			f->nave, f->ncur);
+	}
+	AKFS_VbAveGet(&f->rb, &f->ave, f->ncur, out);
+}
+
+static void Noisy(const double tv[3], unsigned *seed, AKFVEC *v)
+{
+	int k;
+
+	for (k = 0; k < 3; k++) {
+		v->v[k] = (AKFLOAT)(tv[k] + Gauss(seed) * BENCH_MAG_NOISE);
+	}
+}
+
+/*!
+  Mean number of samples until the output reaches 90% of a step on X axis.
+  0 means that the output reaches it at the sample of the step.
+ */
+static double StepLag(const AKFS_FILTER_MODE mode, const int16 nave, const double step)
+{
+	BENCH_FILTER f;
+	double tv[3] = {20.0, 0.0, -40.0};
+	AKFVEC in, out;
+	unsigned seed = 7;
+	long sum = 0;
+	int trial, i;
+
+	for (trial = 0; trial < BENCH_STEP_TRIALS; trial++) {
+		FilterInit(&f, mode, nave);
+		tv[0] = 20.0;
+		for (i = 0; i < 100; i++) {
+			Noisy(tv, &seed, &in);
+			FilterUpdate(&f, &in, &out);
+		}
+		tv[0] = 20.0 + step;
+		for (i = 0; i < 100; i++) {
+			Noisy(tv, &seed, &in);
+			FilterUpdate(&f, &in, &out);
+			if (out.u.x - 20.0 >= 0.9 * step) {
+				break;
+			}
+		}
+		sum += i;
+	}
+	return (double)sum / BENCH_STEP_TRIALS;
+}
+
+static int BenchFilter(const int n)
+{
+	static const char * const name[] = {"box", "kalman", "adaptive"};
+	const int16 nave[2] = {CSPEC_HNAVE_D, CSPEC_HNAVE_V};
+	BENCH_FILTER f;
+	double tv[3];
+	AKFVEC in, out;
+	double still, rot, win;
+	double th;
+	unsigned seed;
+	int mode, j, i, k;
+
+	printf("filter: %d Hz, noise %.2f uT per axis, RMS is per axis\n",
+		BENCH_RATE_HZ, BENCH_MAG_NOISE);
+	printf("  mode      n  still RMS  10uT lag  1uT lag  rot RMS  window\n");
+	for (j = 0; j < 2; j++) {
+		for (mode = AKFS_FILTER_BOX; mode <= AKFS_FILTER_ADAPTIVE; mode++) {
+			/* Still */
+			FilterInit(&f, (AKFS_FILTER_MODE)mode, nave[j]);
+			seed = 1;
+			tv[0] = 20.0;
+			tv[1] = 0.0;
+			tv[2] = -40.0;
+			still = 0;
+			win = 0;
+			for (i = 0; i < n + 100; i++) {
+				Noisy(tv, &seed, &in);
+				FilterUpdate(&f, &in, &out);
+				if (i >= 100) {
+					for (k = 0; k < 3; k++) {
+						still += (out.v[k] - tv[k]) * (out.v[k] - tv[k]);
+					}
+					win += f.ncur;
+				}
+			}
+			still = sqrt(still / (3.0 * n));
+			win /= n;
+
+			/* Rotation of 90 deg/s around Z axis */
+			FilterInit(&f, (AKFS_FILTER_MODE)mode, nave[j]);
+			rot = 0;
+			for (i = 0; i < n + 100; i++) {
+				th = (M_PI / 2.0) * i / BENCH_RATE_HZ;
+				tv[0] = BENCH_MAG_FIELD * cos(th);
+				tv[1] = BENCH_MAG_FIELD * sin(th);
+				tv[2] = -40.0;
+				Noisy(tv, &seed, &in);
+				FilterUpdate(&f, &in, &out);
+				if (i >= 100) {
+					for (k = 0; k < 3; k++) {
+						rot += (out.v[k] - tv[k]) * (out.v[k] - tv[k]);
+					}
+				}
+			}
+			rot = sqrt(rot / (3.0 * n));
+
+			printf("  %-8s %2d  %9.3f  %8.2f  %7.2f  %7.2f  %6.2f\n",
+				name[mode], nave[j], still,
+				StepLag((AKFS_FILTER_MODE)mode, nave[j], 10.0),
+				StepLag((AKFS_FILTER_MODE)mode, nave[j], 1.0),
+				rot, win);
+		}
+	}
+	return 0;
+}
+
+/*** fit **********************************************************************/
+/* Hard iron offset (uT) and soft iron matrix of the synthetic session */
+static const double s_fitOffset[3] = {20.0, -15.0, 10.0};
+static const double s_fitSoft[3][3] = {
+	{ 1.12,  0.06, -0.04},
+	{ 0.06,  0.92,  0.05},
+	{-0.04,  0.05,  1.00}
+};
+
+/* Result of one estimator */
+typedef struct _BENCH_FIT {
+	int		first;		/* Sample of the first estimation, -1 if none */
+	double	ns;			/* Mean time per sample */
+	double	maxns;		/* Longest time of one sample */
+	double	err;		/* Distance from the true offset (uT) */
+	double	spread;		/* RMS of calibrated radius relative to mean (%) */
+} BENCH_FIT;
+
+/*!
+  Make the i-th vector of a session with hard and soft iron, in uT of
+  Android coordinate. The device is waved around two axes as in
+  #GenSample, so that every estimator gets points far enough apart.
+ */
+static void FitSample(const int i, unsigned *seed, AKFVEC *h)
+{
+	double a = i * 0.37;
+	double b = sin(i * 0.11) * 1.2;
+	double f[3];
+	int r;
+
+	f[0] = BENCH_MAG_FIELD * cos(a) * cos(b);
+	f[1] = BENCH_MAG_FIELD * sin(a) * cos(b);
+	f[2] = BENCH_MAG_FIELD * sin(b);
+	for (r = 0; r < 3; r++) {
+		h->v[r] = (AKFLOAT)(s_fitSoft[r][0] * f[0] + s_fitSoft[r][1] * f[1] +
+			s_fitSoft[r][2] * f[2] + s_fitOffset[r] + Gauss(seed) * BENCH_MAG_NOISE);
+	}
+}
+
+/*!
+  Offset error and radius spread of a calibration, measured on the same
+  session as it is estimated.
+ */
+static void FitQuality(
+	const	AKFVEC		*ho,
+	const	AKFVEC		hsi[3],
+	const	AKFVEC		h[],
+	const	int			n,
+			BENCH_FIT	*res
+)
+{
+	double sum = 0, sum2 = 0;
+	double c, r, mean;
+	int i, j, k;
+
+	res->err = 0;
+	for (k = 0; k < 3; k++) {
+		res->err += (ho->v[k] - s_fitOffset[k]) * (ho->v[k] - s_fitOffset[k]);
+	}
+	res->err = sqrt(res->err);
+
+	for (i = 0; i < n; i++) {
+		r = 0;
+		for (j = 0; j < 3; j++) {
+			c = 0;
+			for (k = 0; k < 3; k++) {
+				c += hsi[j].v[k] * (h[i].v[k] - ho->v[k]);
+			}
+			r += c * c;
+		}
+		r = sqrt(r);
+		sum += r;
+		sum2 += r * r;
+	}
+	mean = sum / n;
+	res->spread = 100.0 * sqrt(sum2 / n - mean * mean) / mean;
+}
+
+/*!
+  Feed the session to one estimator of the library directly. The time of
+  each call is measured, so a solve shows up as the longest call.
+ */
+static void FitKernel(
+	const	AKFS_AOC_MODE	mode,
+	const	AKFVEC			h[],
+	const	int				n,
+			BENCH_FIT		*res
+)
+{
+	static AKFS_AOC_VAR aocv;
+	static AKFS_LSQ_VAR lsqv;
+	static AKFS_ELL_VAR ellv;
+	AKFVEC ho = {{0, 0, 0}};
+	AKFVEC hsi[3] = {{{1, 0, 0}}, {{0, 1, 0}}, {{0, 0, 1}}};
+	int16 ret;
+	int64_t t, dt, total = 0;
+	int i;
+
+	AKFS_InitAOC(&aocv);
+	AKFS_InitSphereFit(&lsqv);
+	AKFS_InitEllipsoidFit(&ellv);
+	res->first = -1;
+	res->maxns = 0;
+	for (i = 0; i < n; i++) {
+		t = NowNs();
+		if (mode == AKFS_AOC_LSQ) {
+			ret = AKFS_SphereFit(&lsqv, &h[i], &ho);
+		} else if (mode == AKFS_AOC_ELLIPSOID) {
+			ret = AKFS_EllipsoidFit(&ellv, &h[i], &ho, hsi);
+		} else {
+			ret = AKFS_AOC(&aocv, &h[i], &ho);
+		}
+		dt = NowNs() - t;
+		total += dt;
+		if (dt > res->maxns) {
+			res->maxns = (double)dt;
+		}
+		if ((ret == AKFS_SUCCESS) && (res->first < 0)) {
+			res->first = i;
+		}
+	}
+	res->ns = (double)total / n;
+	FitQuality(&ho, hsi, h, n, res);
+}
+
+/*!
+  Feed the session to #AKFS_Set_MAGNETIC_FIELD with the estimator of -a.
+  The first estimation is the first sample with accuracy 3.
+ */
+static int FitLib(
+	const	AKFS_AOC_MODE	mode,
+			AKMPRMS			*prms,
+	const	AKFVEC			h[],
+			int16			raw[][3],
+	const	int				n,
+			BENCH_FIT		*res
+)
+{
+	int64_t t, dt, total = 0;
+	int i, k;
+
+	if (InitLib(prms, PAT1, AKFS_FILTER_BOX, mode) != AKM_SUCCESS) {
+		return 1;
+	}
+	/* PAT1 does not rotate, so raw data is divided by the diagonal */
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < 3; k++) {
+			raw[i][k] = (int16)lrint(h[i].v[k] / prms->s_hdec.m[k][k]);
+		}
+	}
+	res->first = -1;
+	res->maxns = 0;
+	for (i = 0; i < n; i++) {
+		t = NowNs();
+		AKFS_Set_MAGNETIC_FIELD(prms, raw[i], 0x11);
+		dt = NowNs() - t;
+		total += dt;
+		if (dt > res->maxns) {
+			res->maxns = (double)dt;
+		}
+		if ((prms->i16_hstatus == 3) && (res->first < 0)) {
+			res->first = i;
+		}
+	}
+	res->ns = (double)total / n;
+	FitQuality(&prms->fv_ho, prms->fva_hsi, h, n, res);
+	return 0;
+}
+
+static void FitHeader(const char *name, const char *first)
+{
+	printf("  %-12s %12s  %7s  %7s  %7s  %7s\n", name, first,
+		"ns/smp", "max us", "err uT", "spread%");
+}
+
+static void FitPrint(const char *name, const BENCH_FIT *res)
+{
+	if (res->first < 0) {
+		printf("  %-12s %12s", name, "none");
+	} else {
+		printf("  %-12s %5d %5.1fs", name, res->first,
+			(double)res->first / BENCH_RATE_HZ);
+	}
+	printf("  %7.0f  %7.1f  %7.2f  %7.2f\n",
+		res->ns, res->maxns / 1000.0, res->err, res->spread);
+}
+
+/*!
+  Offset estimation on a session with hard and soft iron. Each estimator is
+  timed alone and in the library as selected by -a, then the output
+  transform s_hcal is timed with the matrix each estimator leaves.
+ */
+static int BenchFit(const int n)
+{
+	static const char * const name[] = {"aoc", "sphere", "ellipsoid"};
+	static AKMPRMS prms;
+	AKFVEC *h;
+	int16 (*raw)[3];
+	BENCH_FIT res;
+	BENCH_TIMER t;
+	AKFVEC in, out;
+	unsigned seed = 1;
+	int mode, i, k;
+	int ret = 0;
+
+	h = (AKFVEC *)malloc(sizeof(AKFVEC) * n);
+	raw = (int16 (*)[3])malloc(sizeof(int16[3]) * n);
+	if ((h == NULL) || (raw == NULL)) {
+		free(h);
+		free(raw);
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		FitSample(i, &seed, &h[i]);
+	}
+
+	printf("fit: %d samples at %d Hz, offset %.0f %.0f %.0f uT, soft iron\n",
+		n, BENCH_RATE_HZ, s_fitOffset[0], s_fitOffset[1], s_fitOffset[2]);
+	FitHeader("estimator", "first sample");
+	for (mode = AKFS_AOC_4POINTS; mode <= AKFS_AOC_ELLIPSOID; mode++) {
+		FitKernel((AKFS_AOC_MODE)mode, h, n, &res);
+		FitPrint(name[mode], &res);
+	}
+
+	FitHeader("-a", "accuracy 3");
+	for (mode = AKFS_AOC_4POINTS; mode <= AKFS_AOC_ELLIPSOID; mode++) {
+		if (FitLib((AKFS_AOC_MODE)mode, &prms, h, raw, n, &res) != 0) {
+			ret = 1;
+			break;
+		}
+		FitPrint(name[mode], &res);
+	}
+
+	/* The last run left the soft iron matrix of the ellipsoid fit */
+	printf("  s_hcal with the ellipsoid matrix, %s kernel\n",
+		(prms.p_hcal == AKFS_GetDecompFunc(PAT_INVALID, &prms.s_hcal)) ?
+		"generic" : "layout");
+	TimerStart(&t);
+	for (i = 0; i < n; i++) {
+		prms.p_hcal(&prms.s_hcal, raw[i], &out);
+		s_sink += out.u.x;
+	}
+	TimerStop(&t);
+	TimerPrint("p_hcal", &t, n);
+	TimerStart(&t);
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < 3; k++) {
+			in.v[k] = (AKFLOAT)raw[i][k];
+		}
+		AKFS_AffineApply(&prms.s_hcal, &in, &out);
+		s_sink += out.u.x;
+	}
+	TimerStop(&t);
+	TimerPrint("AKFS_AffineApply", &t, n);
+
+	free(h);
+	free(raw);
+	return ret;
+}
+
+/*** gen, replay **************************************************************/
+/*!
+  Write a session of n samples to stdout. Each line is a raw sample, i.e.
+  "A x y z status" for accelerometer and "M x y z status" for magnetometer.
+  One accelerometer sample is written for every k magnetometer samples,
+  which is the case of a hardware FIFO.
+ */
+static int BenchGen(const int n, const int k)
+{
+	unsigned seed = 1;
+	int16 mag[3], acc[3];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		GenSample(i, &seed, mag, acc);
+		if ((i % k) == 0) {
+			printf("A %d %d %d 0\n", acc[0], acc[1], acc[2]);
+		}
+		printf("M %d %d %d 17\n", mag[0], mag[1], mag[2]);
+	}
+	return 0;
+}
+
+/*!
+  Feed a session written by #BenchGen, or recorded in the same format, to
+  the library. The magnetic vector and its accuracy are printed for each
+  magnetometer sample, then the orientation. When block is more than 1,
+  consecutive magnetometer samples are given to
+  #AKFS_Get_MAGNETIC_FIELD_Batch, and orientation is printed once for each
+  batch.
+ */
+/* Print magnetic vectors of a batch and the orientation after it. */
+static void ReplayFlush(
+			AKMPRMS		*prms,
+	const	int			n,
+	const	int16		mag[][3],
+	const	int16		status[]
+)
+{
+	AKFVEC hvec[AKFS_BATCH_BLOCK];
+	int16 accuracy[AKFS_BATCH_BLOCK];
+	AKFLOAT x, y, z;
+	int16 ac;
+	int i;
+
+	if (n == 0) {
+		return;
+	}
+	AKFS_Get_MAGNETIC_FIELD_Batch(prms, (int16)n, mag, status, hvec, accuracy);
+	for (i = 0; i < n; i++) {
+		if (accuracy[i] < 0) {
+			printf("M error\n");
+		} else {
+			printf("M %.5f %.5f %.5f %d\n",
+				hvec[i].u.x, hvec[i].u.y, hvec[i].u.z, accuracy[i]);
+		}
+	}
+	if (AKFS_Get_ORIENTATION(prms, &x, &y, &z, &ac) == AKM_SUCCESS) {
+		printf("O %.4f %.4f %.4f %d\n", x, y, z, ac);
+	}
+}
+
+static int BenchReplay(
+	const	char			*path,
+	const	AKFS_PATNO		pat,
+	const	AKFS_FILTER_MODE	filter,
+	const	AKFS_AOC_MODE	aoc,
+	const	int				block
+)
+{
+	static AKMPRMS prms;
+	int16 mag[AKFS_BATCH_BLOCK][3];
+	int16 mst[AKFS_BATCH_BLOCK];
+	FILE *fp;
+	char type;
+	int x, y, z, st;
+	int16 v[3];
+	int16 ac;
+	AKFLOAT hx, hy, hz;
+	int nb = 0;
+	int n = 0;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		perror(path);
+		return 1;
+	}
+	if (InitLib(&prms, pat, filter, aoc) != AKM_SUCCESS) {
+		fclose(fp);
+		return 1;
+	}
+	while (fscanf(fp, " %c %d %d %d %d", &type, &x, &y, &z, &st) == 5) {
+		v[0] = (int16)x;
+		v[1] = (int16)y;
+		v[2] = (int16)z;
+		if (type == 'A') {
+			/* Samples of magnetometer come before this one */
+			ReplayFlush(&prms, nb, mag, mst);
+			nb = 0;
+			AKFS_Get_ACCELEROMETER(&prms, v, (int16)st, &hx, &hy, &hz, &ac);
+		} else if ((type == 'M') && (block > 1)) {
+			memcpy(mag[nb], v, sizeof(v));
+			mst[nb++] = (int16)st;
+			if ((nb == block) || (nb == AKFS_BATCH_BLOCK)) {
+				ReplayFlush(&prms, nb, mag, mst);
+				nb = 0;
+			}
+			n++;
+		} else if (type == 'M') {
+			if (AKFS_Get_MAGNETIC_FIELD(&prms, v, (int16)st, &hx, &hy, &hz, &ac)
+				== AKM_SUCCESS) {
+				printf("M %.5f %.5f %.5f %d\n", hx, hy, hz, ac);
+			} else {
+				printf("M error\n");
+			}
+			if (AKFS_Get_ORIENTATION(&prms, &hx, &hy, &hz, &ac) == AKM_SUCCESS) {
+				printf("O %.4f %.4f %.4f %d\n", hx, hy, hz, ac);
+			}
+			n++;
+		}
+	}
+	ReplayFlush(&prms, nb, mag, mst);
+	fclose(fp);
+	fprintf(stderr, "replay: %d magnetometer samples, offset %.3f %.3f %.3f\n",
+		n, prms.fv_ho.u.x, prms.fv_ho.u.y, prms.fv_ho.u.z);
+	return 0;
+}
+
+/*** hog **********************************************************************/
+static unsigned long s_hogmask;
+static int64_t s_hogend;
+
+static void* thread_hog(void *arg)
+{
+	cpu_set_t set;
+	unsigned long i;
+	volatile unsigned long x = 0;
+
+	(void)arg;
+	if (s_hogmask != 0) {
+		CPU_ZERO(&set);
+		for (i = 0; i < sizeof(s_hogmask) * 8; i++) {
+			if (s_hogmask & (1UL << i)) {
+				CPU_SET(i, &set);
+			}
+		}
+		if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+			perror("sched_setaffinity");
+		}
+	}
+	while (NowNs() < s_hogend) {
+		for (i = 0; i < 100000; i++) {
+			x += i;
+		}
+	}
+	return NULL;
+}
+
+/*!
+  Run busy loops on the CPUs in mask (0 means any CPU) for secs seconds.
+ */
+static int BenchHog(const int nthread, const unsigned long mask, const int secs)
+{
+	pthread_t th[BENCH_MAX_THREADS];
+	int i, n;
+
+	n = (nthread < BENCH_MAX_THREADS) ? nthread : BENCH_MAX_THREADS;
+	s_hogmask = mask;
+	s_hogend = NowNs() + (int64_t)secs * 1000000000;
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&th[i], NULL, thread_hog, NULL) != 0) {
+			perror("pthread_create");
+			n = i;
+			break;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		pthread_join(th[i], NULL);
+	}
+	return 0;
+}
+
+/*** main *********************************************************************/
+static void Usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s rbuf [n]\n"
+		"       %s batch [n]\n"
+		"       %s dir [n]\n"
+		"       %s filter [n]\n"
+		"       %s fit [n]\n"
+		"       %s gen [n] [k]\n"
+		"       %s replay file [layout] [filter] [aoc] [block]\n"
+		"       %s hog [threads] [cpumask] [secs]\n",
+		prog, prog, prog, prog, prog, prog, prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *cmd;
+
+	if (argc < 2) {
+		Usage(argv[0]);
+		return 2;
+	}
+	cmd = argv[1];
+
+	if (strcmp(cmd, "rbuf") == 0) {
+		return BenchRBuf((argc > 2) ? atoi(argv[2]) : 1000000);
+	} else if (strcmp(cmd, "batch") == 0) {
+		return BenchBatch((argc > 2) ? atoi(argv[2]) : 1000000);
+	} else if (strcmp(cmd, "dir") == 0) {
+		return BenchDir((argc > 2) ? atoi(argv[2]) : 1000000);
+	} else if (strcmp(cmd, "filter") == 0) {
+		return BenchFilter((argc > 2) ? atoi(argv[2]) : 20000);
+	} else if (strcmp(cmd, "fit") == 0) {
+		return BenchFit((argc > 2) ? atoi(argv[2]) : 3000);
+	} else if (strcmp(cmd, "gen") == 0) {
+		return BenchGen((argc > 2) ? atoi(argv[2]) : 4000,
+			(argc > 3) ? atoi(argv[3]) : 1);
+	} else if ((strcmp(cmd, "replay") == 0) && (argc > 2)) {
+		return BenchReplay(argv[2],
+			(argc > 3) ? (AKFS_PATNO)atoi(argv[3]) : PAT1,
+			(argc > 4) ? (AKFS_FILTER_MODE)atoi(argv[4]) : AKFS_FILTER_BOX,
+			(argc > 5) ? (AKFS_AOC_MODE)atoi(argv[5]) : AKFS_AOC_4POINTS,
+			(argc > 6) ? atoi(argv[6]) : 1);
+	} else if (strcmp(cmd, "hog") == 0) {
+		return BenchHog((argc > 2) ? atoi(argv[2]) : 4,
+			(argc > 3) ? strtoul(argv[3], NULL, 0) : 0,
+			(argc > 4) ? atoi(argv[4]) : 15);
+	}
+
+	Usage(argv[0]);
+	return 2;
+}
@@ -0,0 +1,57 @@
+#!/system/bin/sh
+#
+# Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Jitter of the measurement loop under CPU load, with the default scheduling
+# and with "-r 50 -b 0x1 -l". The daemon runs in console mode, and loop
+# statistics are printed when the measurement is stopped by SIGINT.
+#
+# Usage: jitter.sh [layout] [options of akmdfs...]
+# Environment:
+#   AKMD    Path of akmdfs (default: /system/bin/akmdfs)
+#   BENCH   Path of akmdfs_bench (default: /system/bin/akmdfs_bench)
+#   SECS    Duration of each run in seconds (default: 30)
+#   HOGS    Number of busy threads (default: 4)
+#   HOGMASK CPUs of busy threads (default: 0x1, the CPU of -b)
+
+AKMD=${AKMD:-/system/bin/akmdfs}
+BENCH=${BENCH:-/system/bin/akmdfs_bench}
+SECS=${SECS:-30}
+HOGS=${HOGS:-4}
+HOGMASK=${HOGMASK:-0x1}
+PAT=${1:-1}
+[ $# -gt 0 ] && shift
+
+MENU=${TMPDIR:-/data/local/tmp}/akmdfs_menu.$$
+# Measure, then statistics and quit
+printf '1\n2\nq\n' > $MENU
+
+run() {
+	echo "### akmdfs $*"
+	$BENCH hog $HOGS $HOGMASK $((SECS + 2)) &
+	HOG=$!
+	# Zone: console
+	$AKMD -s -z 0x80 -m $PAT "$@" < $MENU &
+	PID=$!
+	sleep $SECS
+	kill -INT $PID
+	wait $PID
+	wait $HOG
+}
+
+run "$@"
+run -r 50 -b 0x1 -l "$@"
+
+rm -f $MENU
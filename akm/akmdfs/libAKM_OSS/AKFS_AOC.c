@@ -116,10 +116,10 @@ static int16 From4Points2Sphere(
  * MeanVar
  */
 static void MeanVar(
-	const	AKFVEC	v[],	/*!< (i)   : input vectors */
-	const	int16	n,		/*!< (i)   : number of vectors */
-			AKFVEC	*mean,	/*!< (o)   : (max+min)/2 */
-			AKFVEC	*var	/*!< (o)   : variation in vectors */
+	const	AKFS_RBUF	*v,		/*!< (i)   : input vectors */
+	const	int16		n,		/*!< (i)   : number of vectors */
+			AKFVEC		*mean,	/*!< (o)   : (max+min)/2 */
+			AKFVEC		*var	/*!< (o)   : variation in vectors */
 ){
 	int16	i;
 	int16	j;
@@ -127,14 +127,14 @@ static void MeanVar(
 	AKFVEC	min;
 
 	for (j = 0; j < 3; j++) {
-		min.v[j] = v[0].v[j];
-		max.v[j] = v[0].v[j];
+		min.v[j] = AKFS_RBUF_AT(v, 0).v[j];
+		max.v[j] = AKFS_RBUF_AT(v, 0).v[j];
 		for (i = 1; i < n; i++) {
-			if (v[i].v[j] < min.v[j]) {
-				min.v[j] = v[i].v[j];
+			if (AKFS_RBUF_AT(v, i).v[j] < min.v[j]) {
+				min.v[j] = AKFS_RBUF_AT(v, i).v[j];
 			}
-			if (v[i].v[j] > max.v[j]) {
-				max.v[j] = v[i].v[j];
+			if (AKFS_RBUF_AT(v, i).v[j] > max.v[j]) {
+				max.v[j] = AKFS_RBUF_AT(v, i).v[j];
 			}
 		}
 		mean->v[j] = (max.v[j] + min.v[j]) / 2.0;	/*mean */
@@ -146,9 +146,9 @@ static void MeanVar(
  * Get4points
  */
 static void Get4points(
-	const	AKFVEC	v[],	/*!< (i)   : input vectors */
-	const	int16	n,		/*!< (i)   : number of vectors */
-			AKFVEC	out[]	/*!< (o)   : */
+	const	AKFS_RBUF	*v,		/*!< (i)   : input vectors */
+	const	int16		n,		/*!< (i)   : number of vectors */
+			AKFVEC		out[]	/*!< (o)   : */
 ){
 	int16	i, j;
 	AKFLOAT temp;
@@ -159,15 +159,15 @@ static void Get4points(
 	AKFVEC	tempv = {{0, 0, 0}};
 
 	/* out 0 */
-	out[0] = v[0];
+	out[0] = AKFS_RBUF_AT(v, 0);
 
 	/* out 1 */
 	d = 0.0;
 	for (i = 1; i < n; i++) {
-		temp = CalcR(&v[i], &out[0]);
+		temp = CalcR(&AKFS_RBUF_AT(v, i), &out[0]);
 		if (d < temp) {
 			d = temp;
-			out[1] = v[i];
+			out[1] = AKFS_RBUF_AT(v, i);
 		}
 	}
 
@@ -178,7 +178,7 @@ static void Get4points(
 	}
 	for (i = 1; i < n; i++) {
 		for (j = 0; j < 3; j++) {
-			dv[i].v[j] = v[i].v[j] - out[0].v[j];
+			dv[i].v[j] = AKFS_RBUF_AT(v, i).v[j] - out[0].v[j];
 		}
 		tempv.v[0] = dv[0].v[1]*dv[i].v[2] - dv[0].v[2]*dv[i].v[1];
 		tempv.v[1] = dv[0].v[2]*dv[i].v[0] - dv[0].v[0]*dv[i].v[2];
@@ -188,7 +188,7 @@ static void Get4points(
 			  +	tempv.u.z * tempv.u.z;
 		if (d < temp) {
 			d = temp;
-			out[2] = v[i];
+			out[2] = AKFS_RBUF_AT(v, i);
 			cross = tempv;
 		}
 	}
@@ -202,34 +202,17 @@ static void Get4points(
 		temp = fabs(temp);
 		if (d < temp) {
 			d = temp;
-			out[3] = v[i];
+			out[3] = AKFS_RBUF_AT(v, i);
 		}
 	}
 }
 
-/*
- * CheckInitFvec
- */
-static int16 CheckInitFvec(
-	const	AKFVEC	*v		/*!< [in]	vector */
-){
-	int16 i;
-
-	for (i = 0; i < 3; i++) {
-		if (AKFS_FMAX <= v->v[i]) {
-			return 1;       /* initvalue */
-		}
-	}
-
-	return 0;       /* not initvalue */
-}
-
 /*
  * AKFS_AOC
  */
 int16 AKFS_AOC(				/*!< (o) : calibration success(AKFS_SUCCESS), failure(AKFS_ERROR) */
 			AKFS_AOC_VAR	*haocv,	/*!< (i/o)	: a set of variables */
-	const	AKFVEC			*hdata,	/*!< (i)	: vectors of data    */
+	const	AKFVEC			*hdata,	/*!< (i)	: a vector of data   */
 			AKFVEC			*ho		/*!< (i/o)	: offset             */
 ){
 	int16	i, j;
@@ -243,25 +226,16 @@ int16 AKFS_AOC(				/*!< (o) : calibration success(AKFS_SUCCESS), failure(AKFS_ER
 	AKFVEC	mean;
 
 	/* buffer new data */
-	for (i = 1; i < AKFS_HBUF_SIZE; i++) {
-		haocv->hbuf[AKFS_HBUF_SIZE-i] = haocv->hbuf[AKFS_HBUF_SIZE-i-1];
-	}
-	haocv->hbuf[0] = *hdata;
+	AKFS_RBufPush(&haocv->hbuf, hdata);
 
 	/* Check Init */
-	num = 0;
-	for (i = AKFS_HBUF_SIZE; 3 < i; i--) {
-		if (CheckInitFvec(&haocv->hbuf[i-1]) == 0) {
-			num = i;
-			break;
-		}
-	}
+	num = haocv->hbuf.num;
 	if (num < 4) {
 		return AKFS_ERROR;
 	}
 
 	/* get 4 points */
-	Get4points(haocv->hbuf, num, fourpoints);
+	Get4points(&haocv->hbuf, num, fourpoints);
 
 	/* estimate offset */
 	if (0 != From4Points2Sphere(fourpoints, &tempho, &haocv->hraoc)) {
@@ -279,26 +253,21 @@ int16 AKFS_AOC(				/*!< (o) : calibration success(AKFS_SUCCESS), failure(AKFS_ER
 	}
 
 	/* update offset buffer */
-	for (i = 1; i < AKFS_HOBUF_SIZE; i++) {
-		haocv->hobuf[AKFS_HOBUF_SIZE-i] = haocv->hobuf[AKFS_HOBUF_SIZE-i-1];
-	}
-	haocv->hobuf[0] = tempho;
+	AKFS_RBufPush(&haocv->hobuf, &tempho);
 
-	/* clear hbuf */
-	for (i = (AKFS_HBUF_SIZE>>1); i < AKFS_HBUF_SIZE; i++) {
-		for (j = 0; j < 3; j++) {
-			haocv->hbuf[i].v[j] = AKFS_FMAX;
-		}
+	/* clear hbuf, i.e. keep only the newer half */
+	if (haocv->hbuf.num > (AKFS_HBUF_SIZE>>1)) {
+		haocv->hbuf.num = (AKFS_HBUF_SIZE>>1);
 	}
 
 	/* Check Init */
-	if (CheckInitFvec(&haocv->hobuf[AKFS_HOBUF_SIZE-1]) == 1) {
+	if (haocv->hobuf.num < AKFS_HOBUF_SIZE) {
 		return AKFS_ERROR;
 	}
 
 	/* Check ovar */
 	tempf = haocv->hraoc * AKFS_HO_TH;
-	MeanVar(haocv->hobuf, AKFS_HOBUF_SIZE, &mean, &var);
+	MeanVar(&haocv->hobuf, AKFS_HOBUF_SIZE, &mean, &var);
 	if ((var.u.x >= tempf) || (var.u.y >= tempf) || (var.u.z >= tempf)) {
 		return AKFS_ERROR;
 	}
@@ -314,19 +283,9 @@ int16 AKFS_AOC(				/*!< (o) : calibration success(AKFS_SUCCESS), failure(AKFS_ER
 void AKFS_InitAOC(
 			AKFS_AOC_VAR	*haocv
 ){
-	int16 i, j;
-
 	/* Initialize buffer */
-	for (i = 0; i < AKFS_HBUF_SIZE; i++) {
-		for (j = 0; j < 3; j++) {
-			haocv->hbuf[i].v[j] = AKFS_FMAX;
-		}
-	}
-	for (i = 0; i < AKFS_HOBUF_SIZE; i++) {
-		for (j = 0; j < 3; j++) {
-			haocv->hobuf[i].v[j] = AKFS_FMAX;
-		}
-	}
+	AKFS_InitRBuf(AKFS_HBUF_SIZE, &haocv->hbuf);
+	AKFS_InitRBuf(AKFS_HOBUF_SIZE, &haocv->hobuf);
 
 	haocv->hraoc = 0.0;
 }
@@ -30,8 +30,8 @@
 
 /***** Type declaration *******************************************************/
 typedef struct _AKFS_AOC_VAR{
-	AKFVEC		hbuf[AKFS_HBUF_SIZE];
-	AKFVEC		hobuf[AKFS_HOBUF_SIZE];
+	AKFS_RBUF	hbuf;
+	AKFS_RBUF	hobuf;
 	AKFLOAT		hraoc;
 } AKFS_AOC_VAR;
 
@@ -0,0 +1,133 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include "AKFS_Device.h"
+#include "AKFS_Batch.h"
+
+/***** Vector abstraction *****************************************************/
+/* AKFS_VLANES samples are processed at once. When no vector unit is
+   available, or double precision is selected, only scalar code is used. */
+#if !defined(AKFS_PRECISION_DOUBLE) && (defined(__ARM_NEON__) || defined(__ARM_NEON))
+#include <arm_neon.h>
+#define AKFS_VLANES			4
+typedef float32x4_t			AKFS_VFLOAT;
+#define AKFS_VSET1(a)		vdupq_n_f32(a)
+#define AKFS_VMUL(a, b)		vmulq_f32((a), (b))
+#define AKFS_VADD(a, b)		vaddq_f32((a), (b))
+#define AKFS_VSTORE(p, a)	vst1q_f32((p), (a))
+/* De-interleave 4 samples of int16[3] and convert to float */
+#define AKFS_VLOAD3(raw, x, y, z) do {								\
+	int16x4x3_t r_ = vld3_s16(&(raw)[0][0]);						\
+	(x) = vcvtq_f32_s32(vmovl_s16(r_.val[0]));						\
+	(y) = vcvtq_f32_s32(vmovl_s16(r_.val[1]));						\
+	(z) = vcvtq_f32_s32(vmovl_s16(r_.val[2]));						\
+} while (0)
+
+#elif !defined(AKFS_PRECISION_DOUBLE) && (defined(__SSE__) || defined(_M_X64))
+#include <xmmintrin.h>
+#define AKFS_VLANES			4
+typedef __m128				AKFS_VFLOAT;
+#define AKFS_VSET1(a)		_mm_set1_ps(a)
+#define AKFS_VMUL(a, b)		_mm_mul_ps((a), (b))
+#define AKFS_VADD(a, b)		_mm_add_ps((a), (b))
+#define AKFS_VSTORE(p, a)	_mm_storeu_ps((p), (a))
+#define AKFS_VLOAD3(raw, x, y, z) do {								\
+	(x) = _mm_set_ps((raw)[3][0], (raw)[2][0], (raw)[1][0], (raw)[0][0]);	\
+	(y) = _mm_set_ps((raw)[3][1], (raw)[2][1], (raw)[1][1], (raw)[0][1]);	\
+	(z) = _mm_set_ps((raw)[3][2], (raw)[2][2], (raw)[1][2], (raw)[0][2]);	\
+} while (0)
+
+#else
+#define AKFS_VLANES			1
+#endif
+
+/******************************************************************************/
+/*! Convert a block of raw samples with an affine transform, and store the
+  result as structure-of-arrays. This is the batch version of
+  #AKFS_AffineApply, e.g. with the transform made by #AKFS_UpdateTransform it
+  does decomposition, rotation and normalization of magnetometer data at
+  once. Measurement status is not checked in this function, so the caller
+  discards samples with #AKM_ST_ERROR.
+  The result is the same as #AKFS_AffineApply except rounding, i.e. the
+  difference is a few ulp of the output value.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] raw Raw samples, sensor local unit.
+  @param[in] n Number of samples
+  @param[in] t Affine transform
+  @param[out] vx X axis of converted samples
+  @param[out] vy Y axis of converted samples
+  @param[out] vz Z axis of converted samples
+ */
+int16 AKFS_DecompNormBatch(
+	const	int16		raw[][3],
+	const	int16		n,
+	const	AKFS_AFFINE	*t,
+			AKFLOAT		vx[],
+			AKFLOAT		vy[],
+			AKFLOAT		vz[]
+)
+{
+	int i = 0;
+	AKFVEC in;
+	AKFVEC out;
+
+	if (n < 0) {
+		return AKFS_ERROR;
+	}
+
+#if AKFS_VLANES > 1
+	{
+		AKFS_VFLOAT m00 = AKFS_VSET1(t->m[0][0]);
+		AKFS_VFLOAT m01 = AKFS_VSET1(t->m[0][1]);
+		AKFS_VFLOAT m02 = AKFS_VSET1(t->m[0][2]);
+		AKFS_VFLOAT m10 = AKFS_VSET1(t->m[1][0]);
+		AKFS_VFLOAT m11 = AKFS_VSET1(t->m[1][1]);
+		AKFS_VFLOAT m12 = AKFS_VSET1(t->m[1][2]);
+		AKFS_VFLOAT m20 = AKFS_VSET1(t->m[2][0]);
+		AKFS_VFLOAT m21 = AKFS_VSET1(t->m[2][1]);
+		AKFS_VFLOAT m22 = AKFS_VSET1(t->m[2][2]);
+		AKFS_VFLOAT bx = AKFS_VSET1(t->b.u.x);
+		AKFS_VFLOAT by = AKFS_VSET1(t->b.u.y);
+		AKFS_VFLOAT bz = AKFS_VSET1(t->b.u.z);
+		AKFS_VFLOAT x, y, z;
+
+		for (; i + AKFS_VLANES <= n; i += AKFS_VLANES) {
+			AKFS_VLOAD3(&raw[i], x, y, z);
+			AKFS_VSTORE(&vx[i], AKFS_VADD(AKFS_VADD(AKFS_VADD(
+				AKFS_VMUL(m00, x), AKFS_VMUL(m01, y)), AKFS_VMUL(m02, z)), bx));
+			AKFS_VSTORE(&vy[i], AKFS_VADD(AKFS_VADD(AKFS_VADD(
+				AKFS_VMUL(m10, x), AKFS_VMUL(m11, y)), AKFS_VMUL(m12, z)), by));
+			AKFS_VSTORE(&vz[i], AKFS_VADD(AKFS_VADD(AKFS_VADD(
+				AKFS_VMUL(m20, x), AKFS_VMUL(m21, y)), AKFS_VMUL(m22, z)), bz));
+		}
+	}
+#endif
+
+	/* Scalar fallback and remainder */
+	for (; i < n; i++) {
+		in.u.x = (AKFLOAT)raw[i][0];
+		in.u.y = (AKFLOAT)raw[i][1];
+		in.u.z = (AKFLOAT)raw[i][2];
+		AKFS_AffineApply(t, &in, &out);
+		vx[i] = out.u.x;
+		vy[i] = out.u.y;
+		vz[i] = out.u.z;
+	}
+
+	return AKFS_SUCCESS;
+}
+
@@ -33,5 +33,12 @@
 #define AKFS_PRECISION_DOUBLE
 */
 
+/*! If following line is commented in, a polynomial approximation of atan2
+   whose maximum error is less than 0.05 degree is used to calculate
+   azimuth, pitch and roll */
+/*
+#define AKFS_FAST_ATAN
+*/
+
 #endif
 
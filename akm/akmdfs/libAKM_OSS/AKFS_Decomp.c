@@ -18,34 +18,207 @@
 #include "AKFS_Decomp.h"
 #include "AKFS_Device.h"
 
+/***** Decomposition kernels **************************************************/
+/* With a layout pattern, each axis of output comes from only one axis of
+   input, i.e. out.x = m[0][ix] * mag[ix] etc. Signs are already included in
+   the matrix, so a kernel only depends on which axes are swapped. */
+#define AKFS_DECOMP_KERNEL(name, ix, iy, iz)							\
+static void name(														\
+	const	AKFS_AFFINE	*dec,											\
+	const	int16		mag[3],											\
+			AKFVEC		*out											\
+)																		\
+{																		\
+	out->u.x = dec->m[0][ix] * (AKFLOAT)mag[ix] + dec->b.u.x;			\
+	out->u.y = dec->m[1][iy] * (AKFLOAT)mag[iy] + dec->b.u.y;			\
+	out->u.z = dec->m[2][iz] * (AKFLOAT)mag[iz] + dec->b.u.z;			\
+}
+
+/* PAT1, PAT3, PAT5, PAT7 */
+AKFS_DECOMP_KERNEL(AKFS_DecompXYZ, 0, 1, 2)
+/* PAT2, PAT4, PAT6, PAT8 */
+AKFS_DECOMP_KERNEL(AKFS_DecompYXZ, 1, 0, 2)
+
+/* Any matrix, e.g. with a soft iron matrix. The product is written out
+   here, so that no further call is made for each sample. */
+static void AKFS_DecompMat(
+	const	AKFS_AFFINE	*dec,
+	const	int16		mag[3],
+			AKFVEC		*out
+)
+{
+	AKFLOAT x = (AKFLOAT)mag[0];
+	AKFLOAT y = (AKFLOAT)mag[1];
+	AKFLOAT z = (AKFLOAT)mag[2];
+
+	out->u.x = dec->m[0][0]*x + dec->m[0][1]*y + dec->m[0][2]*z + dec->b.u.x;
+	out->u.y = dec->m[1][0]*x + dec->m[1][1]*y + dec->m[1][2]*z + dec->b.u.y;
+	out->u.z = dec->m[2][0]*x + dec->m[2][1]*y + dec->m[2][2]*z + dec->b.u.z;
+}
+
+/* Indexed by #AKFS_PATNO */
+static const AKFS_DECOMP_FUNC s_decompFunc[] = {
+	AKFS_DecompMat,		/* PAT_INVALID */
+	AKFS_DecompXYZ,		/* PAT1 */
+	AKFS_DecompYXZ,		/* PAT2 */
+	AKFS_DecompXYZ,		/* PAT3 */
+	AKFS_DecompYXZ,		/* PAT4 */
+	AKFS_DecompXYZ,		/* PAT5 */
+	AKFS_DecompYXZ,		/* PAT6 */
+	AKFS_DecompXYZ,		/* PAT7 */
+	AKFS_DecompYXZ		/* PAT8 */
+};
+
+/* Input axis of each output axis, i.e. ix, iy and iz of the kernel above */
+static const int16 s_decompAxis[][3] = {
+	{0, 1, 2},	/* PAT_INVALID, not used */
+	{0, 1, 2},	/* PAT1 */
+	{1, 0, 2},	/* PAT2 */
+	{0, 1, 2},	/* PAT3 */
+	{1, 0, 2},	/* PAT4 */
+	{0, 1, 2},	/* PAT5 */
+	{1, 0, 2},	/* PAT6 */
+	{0, 1, 2},	/* PAT7 */
+	{1, 0, 2}	/* PAT8 */
+};
+
 /******************************************************************************/
-/*! Convert from sensor local data unit to micro tesla, then buffer the data.
+/*! Make an affine transform which converts from sensor local data unit to
+  micro tesla in Android coordinate, i.e. sensitivity adjustment and
+  rotation with layout pattern are combined into one matrix.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] asa
+  @param[in] pat
+  @param[out] dec
+ */
+int16 AKFS_InitDecompAffine(
+	const	uint8vec	*asa,
+	const	AKFS_PATNO	pat,
+			AKFS_AFFINE	*dec
+)
+{
+	int16 layout[3][3];
+	int16 i, j;
+	AKFVEC col;
+
+	for (j = 0; j < 3; j++) {
+		/* Rotate unit vector to get j-th column of layout matrix */
+		col.u.x = 0;
+		col.u.y = 0;
+		col.u.z = 0;
+		col.v[j] = 1;
+		if (AKFS_Rotate(pat, &col) != AKFS_SUCCESS) {
+			return AKFS_ERROR;
+		}
+		for (i = 0; i < 3; i++) {
+			layout[i][j] = (int16)col.v[i];
+		}
+	}
+
+	return AKFS_InitDecompAffineMat(asa, layout, dec);
+}
+
+/******************************************************************************/
+/*! Same as #AKFS_InitDecompAffine, but layout is specified with a matrix.
+  With a matrix which is not one of the layout patterns, the transform must
+  be used with the generic matrix kernel, see #AKFS_GetDecompFunc.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] asa
+  @param[in] layout
+  @param[out] dec
+ */
+int16 AKFS_InitDecompAffineMat(
+	const	uint8vec	*asa,
+	const	int16		layout[3][3],
+			AKFS_AFFINE	*dec
+)
+{
+	int16 i, j;
+	AKFVEC col;
+
+	for (j = 0; j < 3; j++) {
+		/* Rotate unit vector to get j-th column of layout matrix */
+		col.u.x = 0;
+		col.u.y = 0;
+		col.u.z = 0;
+		col.v[j] = 1;
+		if (AKFS_RotateMat(layout, &col) != AKFS_SUCCESS) {
+			return AKFS_ERROR;
+		}
+		for (i = 0; i < 3; i++) {
+			dec->m[i][j] = col.v[i] *
+				AKM_HDATA_CONVERTER(1, asa->v[j]) * AKM_SENSITIVITY;
+		}
+	}
+	dec->b.u.x = 0;
+	dec->b.u.y = 0;
+	dec->b.u.z = 0;
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Select a kernel for a transform made from the layout pattern, e.g. the
+  transform made by #AKFS_InitDecompAffine, or that combined with offset,
+  sensitivity and a diagonal soft iron matrix. This function should be
+  called once when the transform is changed, so that no branch on the
+  pattern is needed for each sample. The kernel of the pattern is returned
+  only if the matrix has no entry out of the pattern. Otherwise, or for
+  #PAT_INVALID and unknown value, the generic matrix kernel is returned.
+  @return A kernel function.
+  @param[in] pat
+  @param[in] dec
+ */
+AKFS_DECOMP_FUNC AKFS_GetDecompFunc(
+	const	AKFS_PATNO	pat,
+	const	AKFS_AFFINE	*dec
+)
+{
+	int16 i, j;
+
+	if ((pat < PAT1) || (PAT8 < pat)) {
+		return s_decompFunc[PAT_INVALID];
+	}
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			if ((j != s_decompAxis[pat][i]) && (dec->m[i][j] != 0.0f)) {
+				return s_decompFunc[PAT_INVALID];
+			}
+		}
+	}
+	return s_decompFunc[pat];
+}
+
+/******************************************************************************/
+/*! Convert from sensor local data unit to micro tesla in Android
+  coordinate, then buffer the data. Conversion is done with an affine
+  transform made by #AKFS_InitDecompAffine and a kernel selected by
+  #AKFS_GetDecompFunc.
   @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
   @param[in] mag
   @param[in] status
-  @param[in] asa
-  @param[in] nhdata
-  @param[out] hdata
+  @param[in] dec
+  @param[in] func
+  @param[in/out] hdata
  */
-int16 AKFS_Decomp(
+int16 AKFS_DecompAffine(
 	const	int16		mag[3],
 	const	int16		status,
-	const	uint8vec	*asa,
-	const	int16		nhdata,
-			AKFVEC		hdata[]
+	const	AKFS_AFFINE	*dec,
+	const	AKFS_DECOMP_FUNC	func,
+			AKFS_RBUF	*hdata
 )
 {
+	AKFVEC tmp;
+
 	/* put st1 and st2 value */
 	if (AKM_ST_ERROR(status)) {
 		return AKFS_ERROR;
 	}
 
 	/* magnetic */
-	AKFS_BufShift(nhdata, 1, hdata);
-	hdata[0].u.x = AKM_HDATA_CONVERTER(mag[0], asa->u.x) * AKM_SENSITIVITY;
-	hdata[0].u.y = AKM_HDATA_CONVERTER(mag[1], asa->u.y) * AKM_SENSITIVITY;
-	hdata[0].u.z = AKM_HDATA_CONVERTER(mag[2], asa->u.z) * AKM_SENSITIVITY;
+	func(dec, mag, &tmp);
+	AKFS_RBufPush(hdata, &tmp);
 
 	return AKFS_SUCCESS;
 }
-
@@ -43,15 +43,39 @@
 
 
 /***** Type declaration *******************************************************/
+/* A kernel which applies a transform to measurement data, e.g. the one made
+   by #AKFS_InitDecompAffine. */
+typedef void (*AKFS_DECOMP_FUNC)(
+	const	AKFS_AFFINE	*dec,
+	const	int16		mag[3],
+			AKFVEC		*out
+);
 
 /***** Prototype of function **************************************************/
 AKLIB_C_API_START
-int16 AKFS_Decomp(
+int16 AKFS_InitDecompAffine(
+	const	uint8vec	*asa,
+	const	AKFS_PATNO	pat,
+			AKFS_AFFINE	*dec
+);
+
+int16 AKFS_InitDecompAffineMat(
+	const	uint8vec	*asa,
+	const	int16		layout[3][3],
+			AKFS_AFFINE	*dec
+);
+
+AKFS_DECOMP_FUNC AKFS_GetDecompFunc(
+	const	AKFS_PATNO	pat,
+	const	AKFS_AFFINE	*dec
+);
+
+int16 AKFS_DecompAffine(
 	const	int16		mag[3],
 	const	int16		status,
-	const	uint8vec	*asa,
-	const	int16		nhdata,
-			AKFVEC		hdata[]
+	const	AKFS_AFFINE	*dec,
+	const	AKFS_DECOMP_FUNC	func,
+			AKFS_RBUF	*hdata
 );
 AKLIB_C_API_END
 
@@ -16,6 +16,7 @@
  *
  ******************************************************************************/
 #include "AKFS_Device.h"
+#include "AKFS_Math.h"
 
 /******************************************************************************/
 /*! Initialize #AKFVEC array.
@@ -45,27 +46,47 @@ int16 AKFS_InitBuffer(
 }
 
 /******************************************************************************/
-/*! Shift #AKFVEC array.
+/*! Initialize #AKFS_RBUF structure. All entries are marked as invalid.
   @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
-  @param[in] len
-  @param[in] shift
-  @param[in/out] v
+  @param[in] len Length of buffer
+  @param[out] rb Ring buffer
  */
-int16 AKFS_BufShift(
-	const	int16	len,	/*!< size of buffer */
-	const	int16	shift,	/*!< shift size */
-			AKFVEC	v[] /*!< buffer */
+int16 AKFS_InitRBuf(
+	const	int16		len,	/*!< Length of buffer */
+			AKFS_RBUF	*rb		/*!< Ring buffer */
 )
 {
-	int16 i;
-
-	if ((shift < 1) || (len < shift)) {
+	/* size check */
+	if ((len <= 0) || (AKFS_RBUF_SIZE < len)) {
 		return AKFS_ERROR;
 	}
-	for (i = len-1; i >= shift; i--) {
-		v[i] = v[i-shift];
+
+	rb->len = len;
+	rb->head = len - 1;
+	rb->num = 0;
+
+	return AKFS_InitBuffer(len, rb->v);
+}
+
+/******************************************************************************/
+/*! Add a vector to #AKFS_RBUF as the most recent entry. When the buffer is
+  full, the oldest entry is discarded.
+  @return None
+  @param[in/out] rb Ring buffer
+  @param[in] v A vector to be added
+ */
+void AKFS_RBufPush(
+			AKFS_RBUF	*rb,	/*!< Ring buffer */
+	const	AKFVEC		*v		/*!< New entry */
+)
+{
+	if (++rb->head >= rb->len) {
+		rb->head = 0;
+	}
+	rb->v[rb->head] = *v;
+	if (rb->num < rb->len) {
+		rb->num++;
 	}
-	return AKFS_SUCCESS;
 }
 
 /******************************************************************************/
@@ -148,3 +169,110 @@ int16 AKFS_RotateMat(
 
 	return AKFS_SUCCESS;
 }
+
+/******************************************************************************/
+/*! Apply affine transform to a vector, i.e. out = m * in + b.
+  in and out may point to the same vector.
+  @return None
+  @param[in] t
+  @param[in] in
+  @param[out] out
+ */
+void AKFS_AffineApply(
+	const	AKFS_AFFINE	*t,
+	const	AKFVEC		*in,
+			AKFVEC		*out
+)
+{
+	AKFVEC tmp;
+
+	tmp.u.x = t->m[0][0]*in->u.x + t->m[0][1]*in->u.y + t->m[0][2]*in->u.z + t->b.u.x;
+	tmp.u.y = t->m[1][0]*in->u.x + t->m[1][1]*in->u.y + t->m[1][2]*in->u.z + t->b.u.y;
+	tmp.u.z = t->m[2][0]*in->u.x + t->m[2][1]*in->u.y + t->m[2][2]*in->u.z + t->b.u.z;
+
+	*out = tmp;
+}
+
+/******************************************************************************/
+/*! Compose two affine transforms. The result is equivalent to applying b
+  first, then a. out must not point to a or b.
+  @return None
+  @param[in] a
+  @param[in] b
+  @param[out] out
+ */
+void AKFS_AffineMul(
+	const	AKFS_AFFINE	*a,
+	const	AKFS_AFFINE	*b,
+			AKFS_AFFINE	*out
+)
+{
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			out->m[i][j] = a->m[i][0]*b->m[0][j]
+						 + a->m[i][1]*b->m[1][j]
+						 + a->m[i][2]*b->m[2][j];
+		}
+	}
+	AKFS_AffineApply(a, &b->b, &out->b);
+}
+
+/******************************************************************************/
+/*! Solve a system of linear equations by Gaussian elimination with partial
+  pivoting.
+  @return #AKFS_SUCCESS on success. #AKFS_ERROR if the matrix is singular.
+  @param[in] n Number of unknowns.
+  @param[in,out] a Augmented matrix of n rows and (n + 1) columns, stored in
+  row-major order. The content is destroyed.
+  @param[out] p Solution of n elements.
+ */
+int16 AKFS_SolveLinear(
+	const	int16	n,
+			AKFLOAT	*a,
+			AKFLOAT	*p
+)
+{
+	int16	i, j, k;
+	int16	piv;
+	int16	w;
+	AKFLOAT	tmp;
+
+	w = n + 1;
+	for (k = 0; k < n; k++) {
+		piv = k;
+		for (i = k + 1; i < n; i++) {
+			if (fabs(a[i*w + k]) > fabs(a[piv*w + k])) {
+				piv = i;
+			}
+		}
+		if (fabs(a[piv*w + k]) < AKFS_EPSILON) {
+			return AKFS_ERROR;
+		}
+		if (piv != k) {
+			for (j = k; j < w; j++) {
+				tmp = a[k*w + j];
+				a[k*w + j] = a[piv*w + j];
+				a[piv*w + j] = tmp;
+			}
+		}
+		for (i = k + 1; i < n; i++) {
+			tmp = a[i*w + k] / a[k*w + k];
+			for (j = k; j < w; j++) {
+				a[i*w + j] -= tmp * a[k*w + j];
+			}
+		}
+	}
+
+	/* Back substitution */
+	for (i = n - 1; i >= 0; i--) {
+		tmp = a[i*w + n];
+		for (j = i + 1; j < n; j++) {
+			tmp -= a[i*w + j] * p[j];
+		}
+		p[i] = tmp / a[i*w + i];
+	}
+
+	return AKFS_SUCCESS;
+}
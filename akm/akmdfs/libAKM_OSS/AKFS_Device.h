@@ -28,6 +28,10 @@
 #define AKFS_HDATA_SIZE		32
 #define AKFS_ADATA_SIZE		32
 
+/* Capacity of #AKFS_RBUF storage. This must not be less than any buffer
+   length which is passed to #AKFS_InitRBuf. */
+#define AKFS_RBUF_SIZE		32
+
 /***** Type declaration *******************************************************/
 typedef signed char     int8;
 typedef signed short    int16;
@@ -71,6 +75,31 @@ typedef union _AKFVEC {
 	AKFLOAT	v[3];
 } AKFVEC;
 
+/***** Affine transform ****************************************************/
+/* out = m * in + b */
+typedef struct _AKFS_AFFINE {
+	AKFLOAT	m[3][3];
+	AKFVEC	b;
+} AKFS_AFFINE;
+
+/***** Ring buffer *********************************************************/
+/* A history of vectors. Entry 0 is the most recent one, entry 1 is the one
+   before it, and so on. Adding a new entry only moves the head index, so the
+   cost does not depend on the length of the buffer. */
+typedef struct _AKFS_RBUF {
+	AKFVEC	v[AKFS_RBUF_SIZE];
+	int16	len;	/* Length of buffer, i.e. number of slots in use */
+	int16	head;	/* Index of the most recent entry in v[] */
+	int16	num;	/* Number of valid entries */
+} AKFS_RBUF;
+
+/* Index of the i-th recent entry in v[]. i should be 0 <= i < len. */
+#define AKFS_RBUF_IDX(rb, i) \
+	(((rb)->head >= (i)) ? ((rb)->head - (i)) : ((rb)->head - (i) + (rb)->len))
+
+/* The i-th recent entry. */
+#define AKFS_RBUF_AT(rb, i)		((rb)->v[AKFS_RBUF_IDX((rb), (i))])
+
 /***** Layout pattern ********************************************************/
 typedef enum _AKFS_PATNO {
 	PAT_INVALID = 0,
@@ -91,10 +120,14 @@ int16 AKFS_InitBuffer(
 			AKFVEC	vdata[]		/*!< Raw vector buffer */
 );
 
-int16 AKFS_BufShift(
-	const	int16	len,
-	const	int16	shift,
-			AKFVEC	v[]
+int16 AKFS_InitRBuf(
+	const	int16		len,
+			AKFS_RBUF	*rb
+);
+
+void AKFS_RBufPush(
+			AKFS_RBUF	*rb,
+	const	AKFVEC		*v
 );
 
 int16 AKFS_Rotate(
@@ -106,6 +139,24 @@ int16 AKFS_RotateMat(
 	const   int16		layout[3][3],
 			AKFVEC		*vec
 );
+
+void AKFS_AffineApply(
+	const	AKFS_AFFINE	*t,
+	const	AKFVEC		*in,
+			AKFVEC		*out
+);
+
+void AKFS_AffineMul(
+	const	AKFS_AFFINE	*a,
+	const	AKFS_AFFINE	*b,
+			AKFS_AFFINE	*out
+);
+
+int16 AKFS_SolveLinear(
+	const	int16	n,
+			AKFLOAT	*a,
+			AKFLOAT	*p
+);
 AKLIB_C_API_END
 
 #endif
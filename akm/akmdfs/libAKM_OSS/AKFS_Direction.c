@@ -36,131 +36,249 @@
 */
 
 
+#ifdef AKFS_FAST_ATAN
+/* Coefficients of atan(z) = z * (C1 + C3 z^2 + C5 z^4 + C7 z^6), 0 <= z <= 1.
+   Maximum error is 0.0047 degree. */
+#define AKFS_ATAN_C1	( 0.99921399f)
+#define AKFS_ATAN_C3	(-0.32117677f)
+#define AKFS_ATAN_C5	( 0.14626869f)
+#define AKFS_ATAN_C7	(-0.03898924f)
+
 /******************************************************************************/
-/*! This function is used internally, so output is RADIAN!
-  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
-  @param[in] avec
-  @param[out] pitch
-  @param[out] roll
+/*! Polynomial approximation of atan2. The result is in [-PI, PI] and its
+  maximum error is 0.0047 degree (0.05 degree is guaranteed).
+  @return atan2(y, x) in radian.
+  @param[in] y
+  @param[in] x
  */
-static int16 AKFS_Angle(
-	const	AKFVEC		*avec,
-			AKFLOAT		*pitch,	/* radian */
-			AKFLOAT		*roll	/* radian */
+static AKFLOAT AKFS_FastAtan2(
+	const	AKFLOAT		y,
+	const	AKFLOAT		x
 )
 {
-	AKFLOAT	av;	/* Size of vector */
-
-	av = AKFS_SQRT((avec->u.x)*(avec->u.x) + (avec->u.y)*(avec->u.y) + (avec->u.z)*(avec->u.z));
+	AKFLOAT ax, ay;
+	AKFLOAT z, z2;
+	AKFLOAT r;
 
-	if (av < AKFS_EPSILON) {
-		return AKFS_ERROR;
+	ax = fabs(x);
+	ay = fabs(y);
+	if ((ax == 0.0f) && (ay == 0.0f)) {
+		return 0.0f;
 	}
 
-	*pitch = AKFS_ASIN(-(avec->u.y) / av);
-	*roll  = AKFS_ASIN((avec->u.x) / av);
+	/* Reduce the argument to [0, 1] */
+	if (ay <= ax) {
+		z = ay / ax;
+	} else {
+		z = ax / ay;
+	}
+	z2 = z * z;
+	r = z * (AKFS_ATAN_C1 + z2 * (AKFS_ATAN_C3 + z2 * (AKFS_ATAN_C5 + z2 * AKFS_ATAN_C7)));
 
-	return AKFS_SUCCESS;
+	/* Restore the octant and quadrant */
+	if (ay > ax) {
+		r = (AKFS_PI / 2.0f) - r;
+	}
+	if (x < 0.0f) {
+		r = AKFS_PI - r;
+	}
+	if (y < 0.0f) {
+		r = -r;
+	}
+	return r;
 }
+#define AKFS_DIR_ATAN2(y, x)	AKFS_FastAtan2((y), (x))
+#else
+#define AKFS_DIR_ATAN2(y, x)	AKFS_ATAN2((y), (x))
+#endif
 
 /******************************************************************************/
 /*! This function is used internally, so output is RADIAN!
-  @return None
+  Pitch and roll are asin(-ay/|a|) and asin(ax/|a|). Their sine and cosine
+  are simple ratios of the components of avec, so every angle is given by
+  atan2 of two quantities which have the same scale, and neither asin, sin,
+  cos nor division is needed.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
   @param[in] hvec
-  @param[in] pitch
-  @param[in] roll
+  @param[in] avec
   @param[out] azimuth
+  @param[out] pitch
+  @param[out] roll
  */
-static void AKFS_Azimuth(
+static int16 AKFS_Angle(
 	const	AKFVEC		*hvec,
-	const	AKFLOAT		pitch,	/* radian */
-	const	AKFLOAT		roll,	/* radian */
-			AKFLOAT		*azimuth	/* radian */
+	const	AKFVEC		*avec,
+			AKFLOAT		*azimuth,	/* radian */
+			AKFLOAT		*pitch,	/* radian */
+			AKFLOAT		*roll	/* radian */
 )
 {
-	AKFLOAT sinP; /* sin value of pitch angle */
-	AKFLOAT cosP; /* cos value of pitch angle */
-	AKFLOAT sinR; /* sin value of roll angle */
-	AKFLOAT cosR; /* cos value of roll angle */
+	AKFLOAT	av;	/* Size of vector */
+	AKFLOAT sinP; /* sin value of pitch angle, multiplied by av */
+	AKFLOAT cosP; /* cos value of pitch angle, multiplied by av */
+	AKFLOAT sinR; /* sin value of roll angle, multiplied by av */
+	AKFLOAT cosR; /* cos value of roll angle, multiplied by av */
 	AKFLOAT Xh;   /* X axis element of vector which is projected to horizontal plane */
 	AKFLOAT Yh;   /* Y axis element of vector which is projected to horizontal plane */
+	AKFLOAT xx, yy, zz;
+
+	xx = (avec->u.x)*(avec->u.x);
+	yy = (avec->u.y)*(avec->u.y);
+	zz = (avec->u.z)*(avec->u.z);
+	av = AKFS_SQRT(xx + yy + zz);
+
+	if (av < AKFS_EPSILON) {
+		return AKFS_ERROR;
+	}
 
-	sinP = AKFS_SIN(pitch);
-	cosP = AKFS_COS(pitch);
-	sinR = AKFS_SIN(roll);
-	cosR = AKFS_COS(roll);
+	sinP = -(avec->u.y);
+	cosP = AKFS_SQRT(xx + zz);
+	sinR = avec->u.x;
+	cosR = AKFS_SQRT(yy + zz);
 
-	Yh = -(hvec->u.x)*cosR + (hvec->u.z)*sinR;
-	Xh = (hvec->u.x)*sinP*sinR + (hvec->u.y)*cosP + (hvec->u.z)*sinP*cosR;
+	*pitch = AKFS_DIR_ATAN2(sinP, cosP);
+	*roll  = AKFS_DIR_ATAN2(sinR, cosR);
+
+	/* Both are multiplied by av^2 */
+	Yh = (-(hvec->u.x)*cosR + (hvec->u.z)*sinR) * av;
+	Xh = (hvec->u.x)*sinP*sinR + (hvec->u.y)*cosP*av + (hvec->u.z)*sinP*cosR;
 
 	/* atan2(y, x) -> divisor and dividend is opposite from mathematical equation. */
-	*azimuth = AKFS_ATAN2(Yh, Xh);
+	*azimuth = AKFS_DIR_ATAN2(Yh, Xh);
+
+	return AKFS_SUCCESS;
 }
 
 /******************************************************************************/
 /*! Output is DEGREE!
   @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
-  @param[in] nhvec
-  @param[in] hvec
-  @param[in] hnave
-  @param[in] navec
-  @param[in] avec
-  @param[in] anave
+  @param[in] hvec Averaged magnetic vector
+  @param[in] avec Averaged acceleration vector
   @param[out] azimuth
   @param[out] pitch
   @param[out] roll
  */
 int16 AKFS_Direction(
-	const	int16		nhvec,
-	const	AKFVEC		hvec[],
-	const	int16		hnave,
-	const	int16		navec,
-	const	AKFVEC		avec[],
-	const	int16		anave,
+	const	AKFVEC		*hvec,
+	const	AKFVEC		*avec,
 			AKFLOAT		*azimuth,
 			AKFLOAT		*pitch,
 			AKFLOAT		*roll
 )
 {
-	AKFVEC have, aave;
 	AKFLOAT azimuthRad;
 	AKFLOAT pitchRad;
 	AKFLOAT rollRad;
 
-	/* arguments check */
-	if ((nhvec <= 0) || (navec <= 0) || (hnave <= 0) || (anave <= 0)) {
-		return AKFS_ERROR;
-	}
-	if ((nhvec < hnave) || (navec < anave)) {
+	/* calculate azimuth, pitch and roll */
+	if (AKFS_Angle(hvec, avec, &azimuthRad, &pitchRad, &rollRad) != AKFS_SUCCESS) {
 		return AKFS_ERROR;
 	}
 
-	/* average */
-	if (AKFS_VbAve(nhvec, hvec, hnave, &have) != AKFS_SUCCESS) {
-		return AKFS_ERROR;
+	*azimuth = RAD2DEG(azimuthRad);
+	*pitch = RAD2DEG(pitchRad);
+	*roll = RAD2DEG(rollRad);
+
+	/* Adjust range of azimuth */
+	if (*azimuth < 0) {
+		*azimuth += 360.0f;
 	}
-	if (AKFS_VbAve(navec, avec, anave, &aave) != AKFS_SUCCESS) {
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Calculate rotation vector, i.e. a unit quaternion which rotates the
+  device coordinate to the world coordinate (X: east, Y: north, Z: up).
+  The rotation matrix is made from the averaged vectors directly, in the
+  same way as SensorManager.getRotationMatrix of Android, and converted to
+  a quaternion. No trigonometric function is used.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] hvec Averaged magnetic vector
+  @param[in] avec Averaged acceleration vector
+  @param[out] quat x, y, z and w of the quaternion. w is not negative.
+ */
+int16 AKFS_RotationVector(
+	const	AKFVEC		*hvec,
+	const	AKFVEC		*avec,
+			AKFLOAT		quat[4]
+)
+{
+	AKFVEC e, n, u;	/* Rows of rotation matrix: east, north and up */
+	AKFLOAT norm;
+	AKFLOAT s;
+	AKFLOAT tr;
+
+	/* east = h x a */
+	e.u.x = hvec->u.y * avec->u.z - hvec->u.z * avec->u.y;
+	e.u.y = hvec->u.z * avec->u.x - hvec->u.x * avec->u.z;
+	e.u.z = hvec->u.x * avec->u.y - hvec->u.y * avec->u.x;
+	norm = AKFS_SQRT(e.u.x * e.u.x + e.u.y * e.u.y + e.u.z * e.u.z);
+	/* Free fall, or magnetic vector is parallel to gravity */
+	if (norm < AKFS_EPSILON) {
 		return AKFS_ERROR;
 	}
+	s = 1.0f / norm;
+	e.u.x *= s;
+	e.u.y *= s;
+	e.u.z *= s;
 
-	/* calculate pitch and roll */
-	if (AKFS_Angle(&aave, &pitchRad, &rollRad) != AKFS_SUCCESS) {
+	/* up = a / |a| */
+	norm = AKFS_SQRT(avec->u.x * avec->u.x + avec->u.y * avec->u.y + avec->u.z * avec->u.z);
+	if (norm < AKFS_EPSILON) {
 		return AKFS_ERROR;
 	}
+	s = 1.0f / norm;
+	u.u.x = avec->u.x * s;
+	u.u.y = avec->u.y * s;
+	u.u.z = avec->u.z * s;
 
-	/* calculate azimuth */
-	AKFS_Azimuth(&have, pitchRad, rollRad, &azimuthRad);
+	/* north = up x east, which is a unit vector */
+	n.u.x = u.u.y * e.u.z - u.u.z * e.u.y;
+	n.u.y = u.u.z * e.u.x - u.u.x * e.u.z;
+	n.u.z = u.u.x * e.u.y - u.u.y * e.u.x;
 
-	*azimuth = RAD2DEG(azimuthRad);
-	*pitch = RAD2DEG(pitchRad);
-	*roll = RAD2DEG(rollRad);
+	/* Matrix to quaternion. The largest of w, x, y and z is calculated
+	   first to avoid cancellation. */
+	tr = e.u.x + n.u.y + u.u.z;
+	if (tr > 0.0f) {
+		s = 2.0f * AKFS_SQRT(tr + 1.0f);
+		quat[3] = 0.25f * s;
+		s = 1.0f / s;
+		quat[0] = (u.u.y - n.u.z) * s;
+		quat[1] = (e.u.z - u.u.x) * s;
+		quat[2] = (n.u.x - e.u.y) * s;
+	} else if ((e.u.x > n.u.y) && (e.u.x > u.u.z)) {
+		s = 2.0f * AKFS_SQRT(1.0f + e.u.x - n.u.y - u.u.z);
+		quat[0] = 0.25f * s;
+		s = 1.0f / s;
+		quat[3] = (u.u.y - n.u.z) * s;
+		quat[1] = (e.u.y + n.u.x) * s;
+		quat[2] = (e.u.z + u.u.x) * s;
+	} else if (n.u.y > u.u.z) {
+		s = 2.0f * AKFS_SQRT(1.0f + n.u.y - e.u.x - u.u.z);
+		quat[1] = 0.25f * s;
+		s = 1.0f / s;
+		quat[3] = (e.u.z - u.u.x) * s;
+		quat[0] = (e.u.y + n.u.x) * s;
+		quat[2] = (n.u.z + u.u.y) * s;
+	} else {
+		s = 2.0f * AKFS_SQRT(1.0f + u.u.z - e.u.x - n.u.y);
+		quat[2] = 0.25f * s;
+		s = 1.0f / s;
+		quat[3] = (n.u.x - e.u.y) * s;
+		quat[0] = (e.u.z + u.u.x) * s;
+		quat[1] = (n.u.z + u.u.y) * s;
+	}
 
-	/* Adjust range of azimuth */
-	if (*azimuth < 0) {
-		*azimuth += 360.0f;
+	/* q and -q are the same rotation */
+	if (quat[3] < 0.0f) {
+		quat[0] = -quat[0];
+		quat[1] = -quat[1];
+		quat[2] = -quat[2];
+		quat[3] = -quat[3];
 	}
 
 	return AKFS_SUCCESS;
 }
 
-
@@ -19,20 +19,23 @@
 #define AKFS_INC_DIRECTION_H
 
 #include "AKFS_Device.h"
+#include "AKFS_VNorm.h"
 
 /***** Prototype of function **************************************************/
 AKLIB_C_API_START
 int16 AKFS_Direction(
-	const	int16		nhvec,
-	const	AKFVEC		hvec[],
-	const	int16		hnave,
-	const	int16		navec,
-	const	AKFVEC		avec[],
-	const	int16		anave,
+	const	AKFVEC		*hvec,
+	const	AKFVEC		*avec,
 			AKFLOAT		*azimuth,
 			AKFLOAT		*pitch,
 			AKFLOAT		*roll
 );
+
+int16 AKFS_RotationVector(
+	const	AKFVEC		*hvec,
+	const	AKFVEC		*avec,
+			AKFLOAT		quat[4]
+);
 AKLIB_C_API_END
 
 #endif
@@ -0,0 +1,322 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include "AKFS_Ellipsoid.h"
+#include "AKFS_Math.h"
+
+/*
+ * Jacobi3
+ */
+static void Jacobi3(
+			AKFLOAT	a[3][3],	/*!< (i/o)	: symmetric matrix, diagonalized */
+			AKFLOAT	v[3][3]		/*!< (o)	: eigen vectors in columns */
+){
+	int16	i, k, p, q;
+	AKFLOAT	theta, t, c, s;
+	AKFLOAT	xp, xq;
+
+	for (i = 0; i < 3; i++) {
+		for (k = 0; k < 3; k++) {
+			v[i][k] = (i == k) ? 1.0f : 0.0f;
+		}
+	}
+
+	for (i = 0; i < AKFS_ELL_NJACOBI; i++) {
+		if ((fabs(a[0][1]) + fabs(a[0][2]) + fabs(a[1][2])) < AKFS_EPSILON) {
+			break;
+		}
+		for (p = 0; p < 2; p++) {
+			for (q = p + 1; q < 3; q++) {
+				if (fabs(a[p][q]) < AKFS_FMIN) {
+					continue;
+				}
+				/* Rotation which makes a[p][q] zero */
+				theta = (a[q][q] - a[p][p]) / (2.0f * a[p][q]);
+				t = 1.0f / (fabs(theta) + AKFS_SQRT(theta * theta + 1.0f));
+				if (theta < 0.0f) {
+					t = -t;
+				}
+				c = 1.0f / AKFS_SQRT(t * t + 1.0f);
+				s = t * c;
+				for (k = 0; k < 3; k++) {
+					xp = a[k][p];
+					xq = a[k][q];
+					a[k][p] = c * xp - s * xq;
+					a[k][q] = s * xp + c * xq;
+				}
+				for (k = 0; k < 3; k++) {
+					xp = a[p][k];
+					xq = a[q][k];
+					a[p][k] = c * xp - s * xq;
+					a[q][k] = s * xp + c * xq;
+				}
+				for (k = 0; k < 3; k++) {
+					xp = v[k][p];
+					xq = v[k][q];
+					v[k][p] = c * xp - s * xq;
+					v[k][q] = s * xp + c * xq;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Spread
+ * Mean and variance of accumulated samples in each axis, relative to ref
+ * and in scaled unit. They are taken from the terms 2x, 2y, 2z and 1.
+ */
+static void Spread(
+	const	AKFS_ELL_VAR	*ellv,
+			AKFVEC			*mean,
+			AKFVEC			*var
+){
+	int16 i;
+
+	for (i = 0; i < 3; i++) {
+		mean->v[i] = 0.5f * ellv->dtd[5 + i][8] / ellv->n;
+		var->v[i] = 0.25f * ellv->dtd[5 + i][5 + i] / ellv->n
+			- mean->v[i] * mean->v[i];
+	}
+}
+
+/*
+ * AKFS_EllipsoidFit
+ */
+int16 AKFS_EllipsoidFit(	/*!< (o) : calibration success(AKFS_SUCCESS), failure(AKFS_ERROR) */
+			AKFS_ELL_VAR	*ellv,	/*!< (i/o)	: a set of variables */
+	const	AKFVEC			*hdata,	/*!< (i)	: a vector of data   */
+			AKFVEC			*ho,	/*!< (i/o)	: offset             */
+			AKFVEC			hsi[3]	/*!< (i/o)	: soft iron matrix   */
+){
+	int16	i, j, k;
+	AKFLOAT	x, y, z;
+	AKFLOAT	d[9];
+	AKFLOAT	w;
+	AKFLOAT	m[9][10];
+	AKFLOAT	u[9];
+	AKFLOAT	e[3][3];
+	AKFLOAT	ev[3][3];
+	AKFLOAT	c3[3][4];
+	AKFLOAT	ctr[3];
+	AKFLOAT	r44;
+	AKFLOAT	lmin, lmax;
+	AKFLOAT	rg;
+	AKFLOAT	sl[3];
+	AKFVEC	mean;
+	AKFVEC	var;
+
+	/* Accept only samples which are far enough from the last one */
+	if (ellv->nacc == 0) {
+		ellv->ref = *hdata;
+	} else {
+		w = 0.0f;
+		for (i = 0; i < 3; i++) {
+			w += (hdata->v[i] - ellv->last.v[i]) * (hdata->v[i] - ellv->last.v[i]);
+		}
+		if (w < (AKFS_ELL_STEP * AKFS_ELL_STEP)) {
+			return AKFS_ERROR;
+		}
+	}
+	ellv->last = *hdata;
+	if (ellv->nacc < AKFS_ELL_NMAX) {
+		ellv->nacc++;
+	}
+
+	/* Count samples out of the current spread */
+	if (ellv->n < 2.0f) {
+		ellv->nnew++;
+	} else {
+		Spread(ellv, &mean, &var);
+		for (i = 0; i < 3; i++) {
+			w = (hdata->v[i] - ellv->ref.v[i]) / AKFS_ELL_SCALE - mean.v[i];
+			if ((w * w) > var.v[i]) {
+				ellv->nnew++;
+				break;
+			}
+		}
+	}
+
+	/* Forget old samples gradually */
+	if (ellv->n >= AKFS_ELL_NMAX) {
+		for (i = 0; i < 9; i++) {
+			for (j = i; j < 9; j++) {
+				ellv->dtd[i][j] *= 0.5f;
+			}
+			ellv->dtw[i] *= 0.5f;
+		}
+		ellv->n *= 0.5f;
+	}
+
+	/* Accumulate */
+	x = (hdata->u.x - ellv->ref.u.x) / AKFS_ELL_SCALE;
+	y = (hdata->u.y - ellv->ref.u.y) / AKFS_ELL_SCALE;
+	z = (hdata->u.z - ellv->ref.u.z) / AKFS_ELL_SCALE;
+	d[0] = x*x + y*y - 2.0f*z*z;
+	d[1] = x*x + z*z - 2.0f*y*y;
+	d[2] = 2.0f*x*y;
+	d[3] = 2.0f*x*z;
+	d[4] = 2.0f*y*z;
+	d[5] = 2.0f*x;
+	d[6] = 2.0f*y;
+	d[7] = 2.0f*z;
+	d[8] = 1.0f;
+	w = x*x + y*y + z*z;
+	for (i = 0; i < 9; i++) {
+		for (j = i; j < 9; j++) {
+			ellv->dtd[i][j] += d[i] * d[j];
+		}
+		ellv->dtw[i] += d[i] * w;
+	}
+	ellv->n += 1.0f;
+
+	/* Solve only when coverage is extended */
+	if ((ellv->nacc < AKFS_ELL_NMIN) || (ellv->nnew < AKFS_ELL_NSOLVE)) {
+		return AKFS_ERROR;
+	}
+	ellv->nnew = 0;
+
+	/* Check coverage, in scaled unit */
+	Spread(ellv, &mean, &var);
+	rg = AKFS_ELL_SPREAD * AKFS_ELL_RMIN / AKFS_ELL_SCALE;
+	for (i = 0; i < 3; i++) {
+		if (var.v[i] < (rg * rg)) {
+			return AKFS_ERROR;
+		}
+	}
+
+	for (i = 0; i < 9; i++) {
+		for (j = 0; j < 9; j++) {
+			m[i][j] = (j >= i) ? ellv->dtd[i][j] : ellv->dtd[j][i];
+		}
+		m[i][9] = ellv->dtw[i];
+	}
+	if (AKFS_SolveLinear(9, &m[0][0], u) != AKFS_SUCCESS) {
+		return AKFS_ERROR;
+	}
+
+	/* Quadric: p^T A p + 2 g.p + u[8] = 0 */
+	e[0][0] = u[0] + u[1] - 1.0f;
+	e[1][1] = u[0] - 2.0f*u[1] - 1.0f;
+	e[2][2] = u[1] - 2.0f*u[0] - 1.0f;
+	e[0][1] = e[1][0] = u[2];
+	e[0][2] = e[2][0] = u[3];
+	e[1][2] = e[2][1] = u[4];
+
+	/* Center: A c = -g */
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			c3[i][j] = e[i][j];
+		}
+		c3[i][3] = -u[5 + i];
+	}
+	if (AKFS_SolveLinear(3, &c3[0][0], ctr) != AKFS_SUCCESS) {
+		return AKFS_ERROR;
+	}
+
+	/* (p - c)^T (A / -r44) (p - c) = 1 */
+	r44 = u[8] + u[5]*ctr[0] + u[6]*ctr[1] + u[7]*ctr[2];
+	if (fabs(r44) < AKFS_EPSILON) {
+		return AKFS_ERROR;
+	}
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			e[i][j] /= -r44;
+		}
+	}
+
+	/* Semi-axes are 1/sqrt(eigen value) */
+	Jacobi3(e, ev);
+	lmin = AKFS_FMAX;
+	lmax = 0.0f;
+	rg = 1.0f;
+	for (i = 0; i < 3; i++) {
+		if (e[i][i] <= 0.0f) {
+			return AKFS_ERROR;
+		}
+		if (e[i][i] < lmin) {
+			lmin = e[i][i];
+		}
+		if (e[i][i] > lmax) {
+			lmax = e[i][i];
+		}
+		sl[i] = AKFS_SQRT(e[i][i]);
+		rg *= sl[i];
+	}
+	if (lmax > (AKFS_ELL_RATIO * AKFS_ELL_RATIO * lmin)) {
+		return AKFS_ERROR;
+	}
+	/* Geometric mean radius, in scaled unit */
+	rg = 1.0f / AKFS_POW(rg, 1.0f / 3.0f);
+
+	/* Check radius and coverage relative to it */
+	if (((rg * AKFS_ELL_SCALE) < AKFS_ELL_RMIN) ||
+		(AKFS_ELL_RMAX < (rg * AKFS_ELL_SCALE))) {
+		return AKFS_ERROR;
+	}
+	for (i = 0; i < 3; i++) {
+		if (var.v[i] < ((AKFS_ELL_SPREAD * rg) * (AKFS_ELL_SPREAD * rg))) {
+			return AKFS_ERROR;
+		}
+	}
+
+	/* hsi = V diag(sqrt(l) * rg) V^T, whose determinant is 1 */
+	for (i = 0; i < 3; i++) {
+		sl[i] *= rg;
+	}
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			w = 0.0f;
+			for (k = 0; k < 3; k++) {
+				w += ev[i][k] * sl[k] * ev[j][k];
+			}
+			hsi[i].v[j] = w;
+		}
+	}
+
+	ellv->hrell = rg * AKFS_ELL_SCALE;
+	ho->u.x = ctr[0] * AKFS_ELL_SCALE + ellv->ref.u.x;
+	ho->u.y = ctr[1] * AKFS_ELL_SCALE + ellv->ref.u.y;
+	ho->u.z = ctr[2] * AKFS_ELL_SCALE + ellv->ref.u.z;
+
+	return AKFS_SUCCESS;
+}
+
+/*
+ * AKFS_InitEllipsoidFit
+ */
+void AKFS_InitEllipsoidFit(
+			AKFS_ELL_VAR	*ellv
+){
+	int16 i, j;
+
+	for (i = 0; i < 9; i++) {
+		for (j = 0; j < 9; j++) {
+			ellv->dtd[i][j] = 0.0f;
+		}
+		ellv->dtw[i] = 0.0f;
+	}
+	for (i = 0; i < 3; i++) {
+		ellv->ref.v[i] = 0.0f;
+		ellv->last.v[i] = 0.0f;
+	}
+	ellv->n = 0.0f;
+	ellv->nnew = 0;
+	ellv->nacc = 0;
+	ellv->hrell = 0.0f;
+}
+
@@ -0,0 +1,78 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_ELLIPSOID_H
+#define AKFS_INC_ELLIPSOID_H
+
+#include "AKFS_Device.h"
+
+/***** Constant definition ****************************************************/
+/* Minimum distance from the last accepted sample to accept a new one. */
+#define AKFS_ELL_STEP		2.0f
+/* Number of accepted samples which are needed to try the first solve. */
+#define AKFS_ELL_NMIN		32
+/* Number of samples which extend coverage to try solving again, see
+   AKFS_LSQ_NSOLVE. */
+#define AKFS_ELL_NSOLVE		16
+/* When this number of samples are accumulated, all sums are halved. */
+#define AKFS_ELL_NMAX		256
+/* Samples are divided by this value (uT) to keep the sums small. */
+#define AKFS_ELL_SCALE		50.0f
+/* Range of valid radius (geometric mean of the three semi-axes) */
+#define AKFS_ELL_RMIN		10.0f
+#define AKFS_ELL_RMAX		100.0f
+/* Minimum standard deviation of samples in each axis relative to radius,
+   see AKFS_LSQ_SPREAD. */
+#define AKFS_ELL_SPREAD		0.3f
+/* Maximum ratio between the longest and the shortest semi-axis */
+#define AKFS_ELL_RATIO		2.0f
+/* Maximum number of Jacobi sweeps for the eigen decomposition */
+#define AKFS_ELL_NJACOBI	16
+
+/***** Type declaration *******************************************************/
+/* Sums of normal equations of ellipsoid fitting. For each sample (x, y, z)
+   relative to ref and divided by AKFS_ELL_SCALE,
+   d = (x^2 + y^2 - 2z^2, x^2 + z^2 - 2y^2, 2xy, 2xz, 2yz, 2x, 2y, 2z, 1) and
+   w = x^2 + y^2 + z^2 are accumulated as sum(d * d^T) and sum(d * w).
+   Only the upper triangle of dtd is used. */
+typedef struct _AKFS_ELL_VAR {
+	AKFLOAT		dtd[9][9];
+	AKFLOAT		dtw[9];
+	AKFLOAT		n;			/* Weight of accumulated samples */
+	int16		nnew;		/* Samples which extend coverage since the last solve */
+	int16		nacc;		/* Accepted samples since initialization */
+	AKFVEC		ref;		/* The first accepted sample */
+	AKFVEC		last;		/* The last accepted sample */
+	AKFLOAT		hrell;		/* Radius of the last solution */
+} AKFS_ELL_VAR;
+
+/***** Prototype of function **************************************************/
+AKLIB_C_API_START
+int16 AKFS_EllipsoidFit(
+			AKFS_ELL_VAR	*ellv,
+	const	AKFVEC			*hdata,
+			AKFVEC			*ho,
+			AKFVEC			hsi[3]
+);
+
+void AKFS_InitEllipsoidFit(
+			AKFS_ELL_VAR	*ellv
+);
+AKLIB_C_API_END
+
+#endif
+
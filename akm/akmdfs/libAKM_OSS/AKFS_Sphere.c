@@ -0,0 +1,187 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#include "AKFS_Sphere.h"
+#include "AKFS_Math.h"
+
+/*
+ * Spread
+ * Mean and variance of accumulated samples in each axis, relative to ref.
+ * They are weighted in the same way as the sums.
+ */
+static void Spread(
+	const	AKFS_LSQ_VAR	*lsqv,
+			AKFVEC			*mean,
+			AKFVEC			*var
+){
+	int16 i;
+
+	for (i = 0; i < 3; i++) {
+		mean->v[i] = lsqv->ata[i][3] / lsqv->n;
+		var->v[i] = lsqv->ata[i][i] / lsqv->n - mean->v[i] * mean->v[i];
+	}
+}
+
+/*
+ * AKFS_SphereFit
+ */
+int16 AKFS_SphereFit(		/*!< (o) : calibration success(AKFS_SUCCESS), failure(AKFS_ERROR) */
+			AKFS_LSQ_VAR	*lsqv,	/*!< (i/o)	: a set of variables */
+	const	AKFVEC			*hdata,	/*!< (i)	: a vector of data   */
+			AKFVEC			*ho		/*!< (i/o)	: offset             */
+){
+	int16	i, j;
+	AKFLOAT	a[4];
+	AKFLOAT	w;
+	AKFLOAT	d;
+	AKFLOAT	m[4][5];
+	AKFLOAT	p[4];
+	AKFVEC	mean;
+	AKFVEC	var;
+
+	/* Accept only samples which are far enough from the last one */
+	if (lsqv->nacc == 0) {
+		lsqv->ref = *hdata;
+	} else {
+		d = 0.0f;
+		for (i = 0; i < 3; i++) {
+			d += (hdata->v[i] - lsqv->last.v[i]) * (hdata->v[i] - lsqv->last.v[i]);
+		}
+		if (d < (AKFS_LSQ_STEP * AKFS_LSQ_STEP)) {
+			return AKFS_ERROR;
+		}
+	}
+	lsqv->last = *hdata;
+	if (lsqv->nacc < AKFS_LSQ_NMAX) {
+		lsqv->nacc++;
+	}
+
+	/* Count samples out of the current spread */
+	if (lsqv->n < 2.0f) {
+		lsqv->nnew++;
+	} else {
+		Spread(lsqv, &mean, &var);
+		for (i = 0; i < 3; i++) {
+			d = hdata->v[i] - lsqv->ref.v[i] - mean.v[i];
+			if ((d * d) > var.v[i]) {
+				lsqv->nnew++;
+				break;
+			}
+		}
+	}
+
+	/* Forget old samples gradually */
+	if (lsqv->n >= AKFS_LSQ_NMAX) {
+		for (i = 0; i < 4; i++) {
+			for (j = 0; j < 4; j++) {
+				lsqv->ata[i][j] *= 0.5f;
+			}
+			lsqv->atw[i] *= 0.5f;
+		}
+		lsqv->n *= 0.5f;
+	}
+
+	/* Accumulate, relative to ref to keep the sums small */
+	a[0] = hdata->u.x - lsqv->ref.u.x;
+	a[1] = hdata->u.y - lsqv->ref.u.y;
+	a[2] = hdata->u.z - lsqv->ref.u.z;
+	a[3] = 1.0f;
+	w = a[0]*a[0] + a[1]*a[1] + a[2]*a[2];
+	for (i = 0; i < 4; i++) {
+		for (j = i; j < 4; j++) {
+			lsqv->ata[i][j] += a[i] * a[j];
+		}
+		lsqv->atw[i] += a[i] * w;
+	}
+	lsqv->n += 1.0f;
+
+	/* Solve only when coverage is extended */
+	if (lsqv->nnew < AKFS_LSQ_NSOLVE) {
+		return AKFS_ERROR;
+	}
+	lsqv->nnew = 0;
+
+	/* Check coverage */
+	Spread(lsqv, &mean, &var);
+	for (i = 0; i < 3; i++) {
+		if (var.v[i] < ((AKFS_LSQ_SPREAD * AKFS_LSQ_RMIN) *
+						(AKFS_LSQ_SPREAD * AKFS_LSQ_RMIN))) {
+			return AKFS_ERROR;
+		}
+	}
+
+	/* w = 2c.a + (r^2 - c.c), i.e. p = (2cx, 2cy, 2cz, r^2 - c.c) */
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			m[i][j] = (j >= i) ? lsqv->ata[i][j] : lsqv->ata[j][i];
+		}
+		m[i][4] = lsqv->atw[i];
+	}
+	if (AKFS_SolveLinear(4, &m[0][0], p) != AKFS_SUCCESS) {
+		return AKFS_ERROR;
+	}
+	for (i = 0; i < 3; i++) {
+		p[i] *= 0.5f;
+	}
+	d = p[3] + p[0]*p[0] + p[1]*p[1] + p[2]*p[2];
+	if (d <= 0.0f) {
+		return AKFS_ERROR;
+	}
+	d = AKFS_SQRT(d);
+
+	/* Check radius and coverage relative to it */
+	if ((d < AKFS_LSQ_RMIN) || (AKFS_LSQ_RMAX < d)) {
+		return AKFS_ERROR;
+	}
+	for (i = 0; i < 3; i++) {
+		if (var.v[i] < (AKFS_LSQ_SPREAD * AKFS_LSQ_SPREAD * d * d)) {
+			return AKFS_ERROR;
+		}
+	}
+
+	lsqv->hrlsq = d;
+	ho->u.x = p[0] + lsqv->ref.u.x;
+	ho->u.y = p[1] + lsqv->ref.u.y;
+	ho->u.z = p[2] + lsqv->ref.u.z;
+
+	return AKFS_SUCCESS;
+}
+
+/*
+ * AKFS_InitSphereFit
+ */
+void AKFS_InitSphereFit(
+			AKFS_LSQ_VAR	*lsqv
+){
+	int16 i, j;
+
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			lsqv->ata[i][j] = 0.0f;
+		}
+		lsqv->atw[i] = 0.0f;
+	}
+	for (i = 0; i < 3; i++) {
+		lsqv->ref.v[i] = 0.0f;
+		lsqv->last.v[i] = 0.0f;
+	}
+	lsqv->n = 0.0f;
+	lsqv->nnew = 0;
+	lsqv->nacc = 0;
+	lsqv->hrlsq = 0.0f;
+}
+
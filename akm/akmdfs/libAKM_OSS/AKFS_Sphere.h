@@ -0,0 +1,69 @@
+/******************************************************************************
+ *
+ * Copyright (C) 2012 Asahi Kasei Microdevices Corporation, Japan
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ******************************************************************************/
+#ifndef AKFS_INC_SPHERE_H
+#define AKFS_INC_SPHERE_H
+
+#include "AKFS_Device.h"
+
+/***** Constant definition ****************************************************/
+/* Minimum distance from the last accepted sample to accept a new one. */
+#define AKFS_LSQ_STEP		2.0f
+/* Number of samples which extend coverage to try solving again. A sample
+   extends coverage when it is more than the standard deviation away from
+   the mean in any axis. */
+#define AKFS_LSQ_NSOLVE		8
+/* When this number of samples are accumulated, all sums are halved. */
+#define AKFS_LSQ_NMAX		128
+/* Range of valid radius */
+#define AKFS_LSQ_RMIN		10.0f
+#define AKFS_LSQ_RMAX		100.0f
+/* Minimum standard deviation of samples in each axis relative to radius,
+   e.g. a half circle has about 0.3 in its short axis. It is taken from the
+   sums, so it covers the same samples as the solution. */
+#define AKFS_LSQ_SPREAD		0.3f
+
+/***** Type declaration *******************************************************/
+/* Sums of normal equations of sphere fitting, i.e. for each sample
+   (x, y, z) relative to ref, a = (x, y, z, 1) and w = x^2 + y^2 + z^2 are
+   accumulated as sum(a * a^T) and sum(a * w). */
+typedef struct _AKFS_LSQ_VAR {
+	AKFLOAT		ata[4][4];
+	AKFLOAT		atw[4];
+	AKFLOAT		n;			/* Weight of accumulated samples */
+	int16		nnew;		/* Samples which extend coverage since the last solve */
+	int16		nacc;		/* Accepted samples since initialization */
+	AKFVEC		ref;		/* The first accepted sample */
+	AKFVEC		last;		/* The last accepted sample */
+	AKFLOAT		hrlsq;		/* Radius of the last solution */
+} AKFS_LSQ_VAR;
+
+/***** Prototype of function **************************************************/
+AKLIB_C_API_START
+int16 AKFS_SphereFit(
+			AKFS_LSQ_VAR	*lsqv,
+	const	AKFVEC			*hdata,
+			AKFVEC			*ho
+);
+
+void AKFS_InitSphereFit(
+			AKFS_LSQ_VAR	*lsqv
+);
+AKLIB_C_API_END
+
+#endif
+
@@ -19,38 +19,23 @@
 #include "AKFS_VNorm.h"
 
 /******************************************************************************/
-/*! Normalize vector.
+/*! Make an affine transform which normalizes a vector, i.e.
+  (v - o) / s * tgt. Divisions are done only here.
   @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
-  @param[in] ndata Size of raw vector buffer
-  @param[in] vdata Raw vector buffer
-  @param[in] nbuf Size of data to be buffered
   @param[in] o Offset
   @param[in] s Sensitivity
   @param[in] tgt Target sensitivity
-  @param[in] nvec Size of normalized vector buffer
-  @param[out] vvec Normalized vector buffer
+  @param[out] norm Affine transform
  */
-int16 AKFS_VbNorm(
-	const	int16	ndata,
-	const	AKFVEC	vdata[],
-	const	int16	nbuf,
-	const	AKFVEC	*o,
-	const	AKFVEC	*s,
-	const	AKFLOAT	tgt,
-	const	int16	nvec,
-			AKFVEC	vvec[]
+int16 AKFS_InitNormAffine(
+	const	AKFVEC		*o,
+	const	AKFVEC		*s,
+	const	AKFLOAT		tgt,
+			AKFS_AFFINE	*norm
 )
 {
-	int i;
+	int i, j;
 
-	/* size check */
-	if ((ndata <= 0) || (nvec <= 0) || (nbuf <= 0)) {
-		return AKFS_ERROR;
-	}
-	/* dependency check */
-	if ((nbuf < 1) || (ndata < nbuf) || (nvec < nbuf)) {
-		return AKFS_ERROR;
-	}
 	/* sensitivity check */
 	if ((s->u.x <= AKFS_EPSILON) ||
 		(s->u.y <= AKFS_EPSILON) ||
@@ -59,65 +44,426 @@ int16 AKFS_VbNorm(
 		return AKFS_ERROR;
 	}
 
-	/* calculate and store data to buffer */
-	if (AKFS_BufShift(nvec, nbuf, vvec) != AKFS_SUCCESS) {
-		return AKFS_ERROR;
-	}
-	for (i = 0; i < nbuf; i++) {
-		vvec[i].u.x = ((vdata[i].u.x - o->u.x) / (s->u.x) * (AKFLOAT)tgt);
-		vvec[i].u.y = ((vdata[i].u.y - o->u.y) / (s->u.y) * (AKFLOAT)tgt);
-		vvec[i].u.z = ((vdata[i].u.z - o->u.z) / (s->u.z) * (AKFLOAT)tgt);
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			norm->m[i][j] = 0;
+		}
+		norm->m[i][i] = (AKFLOAT)tgt / s->v[i];
+		norm->b.v[i] = -(o->v[i]) * norm->m[i][i];
 	}
 
 	return AKFS_SUCCESS;
 }
 
 /******************************************************************************/
-/*! Calculate an averaged vector form a given buffer.
+/*! Calculate an averaged vector form a given buffer. When the buffer has
+  less valid entries than nave, only the valid entries are averaged.
   @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
-  @param[in] nvec Size of normalized vector buffer
   @param[in] vvec Normalized vector buffer
   @param[in] nave Number of average
   @param[out] vave Averaged vector
  */
 int16 AKFS_VbAve(
-	const	int16	nvec,
-	const	AKFVEC	vvec[],
-	const	int16	nave,
-			AKFVEC	*vave
+	const	AKFS_RBUF	*vvec,
+	const	int16		nave,
+			AKFVEC		*vave
 )
 {
 	int i;
+	int n;
 
 	/* arguments check */
-	if ((nave <= 0) || (nvec <= 0) || (nvec < nave)) {
+	if ((nave <= 0) || (vvec->len <= 0) || (vvec->len < nave)) {
 		return AKFS_ERROR;
 	}
 
 	/* calculate average */
+	n = (vvec->num < nave) ? vvec->num : nave;
 	vave->u.x = 0;
 	vave->u.y = 0;
 	vave->u.z = 0;
-	for (i = 0; i < nave; i++) {
-		if ((vvec[i].u.x == AKFS_INIT_VALUE_F) ||
-			(vvec[i].u.y == AKFS_INIT_VALUE_F) ||
-			(vvec[i].u.z == AKFS_INIT_VALUE_F)) {
-				break;
+	for (i = 0; i < n; i++) {
+		vave->u.x += AKFS_RBUF_AT(vvec, i).u.x;
+		vave->u.y += AKFS_RBUF_AT(vvec, i).u.y;
+		vave->u.z += AKFS_RBUF_AT(vvec, i).u.z;
+	}
+	if (n > 0) {
+		vave->u.x /= n;
+		vave->u.y /= n;
+		vave->u.z /= n;
+	}
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Recompute all sums from the buffer, i.e. running sums of the window
+  lengths and prefix sums from the oldest valid entry.
+  @return None
+  @param[in] vvec Normalized vector buffer
+  @param[in/out] ave Running sums and prefix sums
+ */
+static void AKFS_VbAveRefresh(
+	const	AKFS_RBUF	*vvec,
+			AKFS_VAVE	*ave
+)
+{
+	AKFVEC acc;
+	int i, k, w;
+	int n;
+
+	for (w = 0; w < ave->nwin; w++) {
+		n = (vvec->num < ave->nave[w]) ? vvec->num : ave->nave[w];
+		ave->sum[w].u.x = 0;
+		ave->sum[w].u.y = 0;
+		ave->sum[w].u.z = 0;
+		for (i = 0; i < n; i++) {
+			ave->sum[w].u.x += AKFS_RBUF_AT(vvec, i).u.x;
+			ave->sum[w].u.y += AKFS_RBUF_AT(vvec, i).u.y;
+			ave->sum[w].u.z += AKFS_RBUF_AT(vvec, i).u.z;
+		}
+	}
+
+	acc.u.x = 0;
+	acc.u.y = 0;
+	acc.u.z = 0;
+	for (i = vvec->num - 1; i >= 0; i--) {
+		k = AKFS_RBUF_IDX(vvec, i);
+		acc.u.x += vvec->v[k].u.x;
+		acc.u.y += vvec->v[k].u.y;
+		acc.u.z += vvec->v[k].u.z;
+		ave->psum[k] = acc;
+	}
+	ave->nupdate = 0;
+}
+
+/******************************************************************************/
+/*! Initialize #AKFS_VAVE structure for the given buffer. Each window length
+  must be shorter than the length of the buffer, because the entry which
+  leaves the window is read from the buffer.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] vvec Normalized vector buffer
+  @param[in] nwin Number of window lengths
+  @param[in] nave Window lengths
+  @param[out] ave Running sums and prefix sums
+ */
+int16 AKFS_InitVbAve(
+	const	AKFS_RBUF	*vvec,
+	const	int16		nwin,
+	const	int16		nave[],
+			AKFS_VAVE	*ave
+)
+{
+	int w;
+
+	/* arguments check */
+	if ((vvec->len <= 0) || (AKFS_RBUF_SIZE < vvec->len)) {
+		return AKFS_ERROR;
+	}
+	if ((nwin < 0) || (AKFS_VAVE_NWIN < nwin)) {
+		return AKFS_ERROR;
+	}
+	for (w = 0; w < nwin; w++) {
+		if ((nave[w] <= 0) || (vvec->len <= nave[w])) {
+			return AKFS_ERROR;
+		}
+		ave->nave[w] = nave[w];
+	}
+	ave->nwin = nwin;
+
+	AKFS_VbAveRefresh(vvec, ave);
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Update running sums and prefix sums. This function must be called every
+  time one entry is added to the buffer.
+  @return None
+  @param[in] vvec Normalized vector buffer, the latest entry is just added.
+  @param[in/out] ave Running sums and prefix sums
+ */
+void AKFS_VbAveUpdate(
+	const	AKFS_RBUF	*vvec,
+			AKFS_VAVE	*ave
+)
+{
+	const AKFVEC *v;
+	AKFVEC *p;
+	int w;
+
+	if (++ave->nupdate >= AKFS_VAVE_REFRESH) {
+		AKFS_VbAveRefresh(vvec, ave);
+		return;
+	}
+
+	v = &AKFS_RBUF_AT(vvec, 0);
+	for (w = 0; w < ave->nwin; w++) {
+		ave->sum[w].u.x += v->u.x;
+		ave->sum[w].u.y += v->u.y;
+		ave->sum[w].u.z += v->u.z;
+		/* Subtract the entry which goes out of the window */
+		if (vvec->num > ave->nave[w]) {
+			ave->sum[w].u.x -= AKFS_RBUF_AT(vvec, ave->nave[w]).u.x;
+			ave->sum[w].u.y -= AKFS_RBUF_AT(vvec, ave->nave[w]).u.y;
+			ave->sum[w].u.z -= AKFS_RBUF_AT(vvec, ave->nave[w]).u.z;
 		}
-		vave->u.x += vvec[i].u.x;
-		vave->u.y += vvec[i].u.y;
-		vave->u.z += vvec[i].u.z;
 	}
-	if (i == 0) {
+
+	p = &ave->psum[vvec->head];
+	if (vvec->num > 1) {
+		/* The previous entry is the one just before head */
+		*p = ave->psum[AKFS_RBUF_IDX(vvec, 1)];
+		p->u.x += v->u.x;
+		p->u.y += v->u.y;
+		p->u.z += v->u.z;
+	} else {
+		*p = *v;
+	}
+}
+
+/******************************************************************************/
+/*! Get an averaged vector in O(1). The result is the same as #AKFS_VbAve
+  except rounding, see #AKFS_VAVE for the bound of the difference. The
+  running sum is used when nave is one of the window lengths of ave,
+  otherwise prefix sums are used. When the buffer has less valid entries
+  than nave, only the valid entries are averaged.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] vvec Normalized vector buffer
+  @param[in] ave Running sums and prefix sums
+  @param[in] nave Number of average
+  @param[out] vave Averaged vector
+ */
+int16 AKFS_VbAveGet(
+	const	AKFS_RBUF	*vvec,
+	const	AKFS_VAVE	*ave,
+	const	int16		nave,
+			AKFVEC		*vave
+)
+{
+	const AKFVEC *last;
+	const AKFVEC *first;
+	const AKFVEC *v;
+	int n, w;
+
+	/* arguments check */
+	if ((nave <= 0) || (vvec->len <= 0) || (vvec->len < nave)) {
+		return AKFS_ERROR;
+	}
+
+	n = (vvec->num < nave) ? vvec->num : nave;
+	if (n <= 0) {
 		vave->u.x = 0;
 		vave->u.y = 0;
 		vave->u.z = 0;
+		return AKFS_SUCCESS;
+	}
+
+	for (w = 0; w < ave->nwin; w++) {
+		if (ave->nave[w] == nave) {
+			vave->u.x = ave->sum[w].u.x / n;
+			vave->u.y = ave->sum[w].u.y / n;
+			vave->u.z = ave->sum[w].u.z / n;
+			return AKFS_SUCCESS;
+		}
+	}
+
+	/* Sum of entries 0 to n-1 = psum(0) - psum(n-1) + v(n-1) */
+	last = &ave->psum[vvec->head];
+	first = &ave->psum[AKFS_RBUF_IDX(vvec, n - 1)];
+	v = &AKFS_RBUF_AT(vvec, n - 1);
+	vave->u.x = (last->u.x - first->u.x + v->u.x) / n;
+	vave->u.y = (last->u.y - first->u.y + v->u.y) / n;
+	vave->u.z = (last->u.z - first->u.z + v->u.z) / n;
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Initialize #AKFS_VFILT structure. The process noise is chosen so that the
+  steady state gain is 2 / (nave + 1), i.e. the noise of a still input is
+  reduced as much as by the box average of nave entries. The lag of the
+  filter to a ramp is (nave - 1) / 2 samples as well, but a step which is
+  larger than the noise passes the gate and settles in one or two samples.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] nave Number of average which gives the same noise level
+  @param[in] r Variance of the measurement noise of each axis
+  @param[out] filt Filter
+ */
+int16 AKFS_InitVFilt(
+	const	int16		nave,
+	const	AKFLOAT		r,
+			AKFS_VFILT	*filt
+)
+{
+	AKFLOAT k;
+
+	/* arguments check */
+	if ((nave < 2) || (r <= AKFS_EPSILON)) {
+		return AKFS_ERROR;
+	}
+
+	/* Steady state of p = (p + q) * (1 - k), k = (p + q) / (p + q + r) */
+	k = 2.0f / (AKFLOAT)(nave + 1);
+	filt->q = r * k * k / (1.0f - k);
+	filt->r = r;
+	filt->p = r;
+	filt->x.u.x = 0;
+	filt->x.u.y = 0;
+	filt->x.u.z = 0;
+	filt->init = 0;
+
+	return AKFS_SUCCESS;
+}
+
+/******************************************************************************/
+/*! Update #AKFS_VFILT with a new vector.
+  @return None
+  @param[in/out] filt Filter
+  @param[in] v New vector
+ */
+void AKFS_VFiltUpdate(
+			AKFS_VFILT	*filt,
+	const	AKFVEC		*v
+)
+{
+	AKFVEC d;
+	AKFLOAT e;
+	AKFLOAT k;
+
+	if (!filt->init) {
+		filt->x = *v;
+		filt->p = filt->r;
+		filt->init = 1;
+		return;
+	}
+
+	/* Innovation */
+	d.u.x = v->u.x - filt->x.u.x;
+	d.u.y = v->u.y - filt->x.u.y;
+	d.u.z = v->u.z - filt->x.u.z;
+	e = (d.u.x * d.u.x + d.u.y * d.u.y + d.u.z * d.u.z) / 3.0f;
+
+	/* Predict. A large innovation means the vector has moved, so the
+	   uncertainty is raised to the size of the change. */
+	if (e > AKFS_VFILT_GATE * (filt->p + filt->q + filt->r)) {
+		filt->p += e;
 	} else {
-		vave->u.x /= i;
-		vave->u.y /= i;
-		vave->u.z /= i;
+		filt->p += filt->q;
 	}
+
+	/* Correct */
+	k = filt->p / (filt->p + filt->r);
+	filt->x.u.x += k * d.u.x;
+	filt->x.u.y += k * d.u.y;
+	filt->x.u.z += k * d.u.z;
+	filt->p *= (1.0f - k);
+}
+
+/******************************************************************************/
+/*! Initialize #AKFS_VVAR structure. The weight of the new entry is
+  2 / (nave + 1), i.e. the estimation follows the latest nave entries.
+  @return #AKFS_SUCCESS on success. Otherwise the return value is #AKFS_ERROR.
+  @param[in] nave Number of entries to follow
+  @param[out] vv Mean and variance
+ */
+int16 AKFS_InitVVar(
+	const	int16		nave,
+			AKFS_VVAR	*vv
+)
+{
+	/* arguments check */
+	if (nave < 1) {
+		return AKFS_ERROR;
+	}
+
+	vv->a = 2.0f / (AKFLOAT)(nave + 1);
+	vv->mean.u.x = 0;
+	vv->mean.u.y = 0;
+	vv->mean.u.z = 0;
+	vv->var.u.x = 0;
+	vv->var.u.y = 0;
+	vv->var.u.z = 0;
+	vv->init = 0;
+
 	return AKFS_SUCCESS;
 }
 
+/******************************************************************************/
+/*! Update #AKFS_VVAR with a new vector.
+  @return None
+  @param[in/out] vv Mean and variance
+  @param[in] v New vector
+ */
+void AKFS_VVarUpdate(
+			AKFS_VVAR	*vv,
+	const	AKFVEC		*v
+)
+{
+	int i;
+	AKFLOAT d;
+
+	if (!vv->init) {
+		vv->mean = *v;
+		vv->init = 1;
+		return;
+	}
+
+	for (i = 0; i < 3; i++) {
+		d = v->v[i] - vv->mean.v[i];
+		vv->mean.v[i] += vv->a * d;
+		vv->var.v[i] = (1.0f - vv->a) * (vv->var.v[i] + vv->a * d * d);
+	}
+}
+
+/******************************************************************************/
+/*! Choose an averaging length from the variance. When the variance is close
+  to the noise level, the input is still and nmax is chosen. Otherwise the
+  length is shortened in inverse proportion to the variance, so that the lag
+  is small while the device moves. The length grows by at most one per call,
+  so that the window does not jump back over entries taken during motion.
+  @return Number of average, between nmin and nmax.
+  @param[in] vv Mean and variance
+  @param[in] r Variance of the measurement noise of each axis
+  @param[in] nmin Shortest length
+  @param[in] nmax Longest length
+  @param[in] ncur Current length
+ */
+int16 AKFS_VVarWindow(
+	const	AKFS_VVAR	*vv,
+	const	AKFLOAT		r,
+	const	int16		nmin,
+	const	int16		nmax,
+	const	int16		ncur
+)
+{
+	AKFLOAT vmax;
+	AKFLOAT still;
+	int16 n;
+
+	vmax = vv->var.u.x;
+	if (vmax < vv->var.u.y) {
+		vmax = vv->var.u.y;
+	}
+	if (vmax < vv->var.u.z) {
+		vmax = vv->var.u.z;
+	}
+
+	still = AKFS_VVAR_STILL * r;
+	if (vmax <= still) {
+		n = nmax;
+	} else {
+		n = (int16)((AKFLOAT)nmax * still / vmax);
+	}
+
+	if (n > ncur + 1) {
+		n = ncur + 1;
+	}
+	if (n < nmin) {
+		n = nmin;
+	}
+	if (n > nmax) {
+		n = nmax;
+	}
+	return n;
+}
 
@@ -20,24 +20,121 @@
 
 #include "AKFS_Device.h"
 
+/***** Constant definition ****************************************************/
+/* Maximum number of window lengths which #AKFS_VAVE holds running sums of. */
+#define AKFS_VAVE_NWIN		2
+/* Sums are recomputed from the buffer after this number of updates, so that
+   prefix sums do not grow and rounding errors do not accumulate. */
+#define AKFS_VAVE_REFRESH	64
+/* When the squared innovation of #AKFS_VFILT exceeds this multiple of its
+   expected variance, the input is regarded as a real change and the filter
+   jumps toward it instead of smoothing it. */
+#define AKFS_VFILT_GATE		9.0f
+/* While the variance of every axis is below this multiple of the noise
+   level, the device is regarded as still and the longest window is used. */
+#define AKFS_VVAR_STILL		2.0f
+
+/***** Type declaration *******************************************************/
+/* Sums of the entries of #AKFS_RBUF, so that an average of any length is
+   obtained in O(1) with #AKFS_VbAveGet.
+   - sum[w] is the running sum of the latest nave[w] entries, i.e. of the
+     fixed window lengths. The difference of the average from #AKFS_VbAve is
+     bounded by at most #AKFS_VAVE_REFRESH float additions and subtractions,
+     i.e. less than 1e-4 in the unit of the buffer for values below 100.
+   - psum[k] is the sum of the entry in v[k] and all older valid entries.
+     The sum of the latest n entries is the difference of two of them, which
+     serves the lengths chosen at run time by #AKFS_VVarWindow. A prefix sum
+     holds up to #AKFS_VAVE_REFRESH plus the buffer length entries, and the
+     rounding of such a large sum remains in the difference. So the bound is
+     looser, less than 1e-3 for values below 100. */
+typedef struct _AKFS_VAVE {
+	AKFVEC	sum[AKFS_VAVE_NWIN];	/* Running sum of each window length */
+	int16	nave[AKFS_VAVE_NWIN];	/* Window lengths */
+	int16	nwin;					/* Number of window lengths */
+	AKFVEC	psum[AKFS_RBUF_SIZE];	/* Prefix sum at each slot of v[] */
+	int16	nupdate;				/* Updates since the last refresh */
+} AKFS_VAVE;
+
+/* Recursive vector filter. Each axis is a scalar Kalman filter of a random
+   walk, which runs in constant time and holds no history. */
+typedef struct _AKFS_VFILT {
+	AKFVEC	x;		/* Estimated vector */
+	AKFLOAT	p;		/* Variance of the estimation, per axis */
+	AKFLOAT	q;		/* Process noise, per axis */
+	AKFLOAT	r;		/* Measurement noise, per axis */
+	int16	init;	/* Non-zero after the first update */
+} AKFS_VFILT;
+
+/* Exponentially weighted mean and variance of each axis. They are updated
+   in the same way as Welford's algorithm, so no large sum is accumulated. */
+typedef struct _AKFS_VVAR {
+	AKFVEC	mean;	/* Mean of each axis */
+	AKFVEC	var;	/* Variance of each axis */
+	AKFLOAT	a;		/* Weight of the new entry */
+	int16	init;	/* Non-zero after the first update */
+} AKFS_VVAR;
+
 /***** Prototype of function **************************************************/
 AKLIB_C_API_START
-int16 AKFS_VbNorm(
-	const	int16	ndata,
-	const	AKFVEC	vdata[],
-	const	int16	nbuf,
-	const	AKFVEC	*o,
-	const	AKFVEC	*s,
-	const	AKFLOAT	tgt,
-	const	int16	nvec,
-			AKFVEC	vvec[]
+int16 AKFS_InitNormAffine(
+	const	AKFVEC		*o,
+	const	AKFVEC		*s,
+	const	AKFLOAT		tgt,
+			AKFS_AFFINE	*norm
 );
 
 int16 AKFS_VbAve(
-	const	int16	nvec,
-	const	AKFVEC	vvec[],
-	const	int16	nave,
-			AKFVEC	*vave
+	const	AKFS_RBUF	*vvec,
+	const	int16		nave,
+			AKFVEC		*vave
+);
+
+int16 AKFS_InitVbAve(
+	const	AKFS_RBUF	*vvec,
+	const	int16		nwin,
+	const	int16		nave[],
+			AKFS_VAVE	*ave
+);
+
+void AKFS_VbAveUpdate(
+	const	AKFS_RBUF	*vvec,
+			AKFS_VAVE	*ave
+);
+
+int16 AKFS_VbAveGet(
+	const	AKFS_RBUF	*vvec,
+	const	AKFS_VAVE	*ave,
+	const	int16		nave,
+			AKFVEC		*vave
+);
+
+int16 AKFS_InitVFilt(
+	const	int16		nave,
+	const	AKFLOAT		r,
+			AKFS_VFILT	*filt
+);
+
+void AKFS_VFiltUpdate(
+			AKFS_VFILT	*filt,
+	const	AKFVEC		*v
+);
+
+int16 AKFS_InitVVar(
+	const	int16		nave,
+			AKFS_VVAR	*vv
+);
+
+void AKFS_VVarUpdate(
+			AKFS_VVAR	*vv,
+	const	AKFVEC		*v
+);
+
+int16 AKFS_VVarWindow(
+	const	AKFS_VVAR	*vv,
+	const	AKFLOAT		r,
+	const	int16		nmin,
+	const	int16		nmax,
+	const	int16		ncur
 );
 
 AKLIB_C_API_END
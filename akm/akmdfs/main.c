@@ -20,12 +20,18 @@
 #include "AKFS_Disp.h"
 #include "AKFS_FileIO.h"
 #include "AKFS_Measure.h"
+#include "AKFS_Pipe.h"
 #include "AKFS_APIs.h"
 
 #ifndef WIN32
 #include <sched.h>
 #include <pthread.h>
 #include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
 #endif
 
 /*** Constant definition ******************************************************/
@@ -48,6 +54,73 @@
 #define CONVERT_ACC(a)	((int)((a) * 720 / 9.8f))
 #define CONVERT_MAG(m)	((int)((m) / 0.06f))
 #define CONVERT_ORI(o)	((int)((o) * 64))
+#define CONVERT_RV(r)	((int)((r) * 16384))	/* Q14 */
+
+/* I2C transactions of one magnetometer measurement: set mode, read data */
+#define AKM_MAG_I2C_PER_MEASURE	2
+
+/* Event sources of reactor loop, stored in epoll_event.data.u32.
+   Timers are indexed by the same number. */
+#define AKM_EV_ACC				ACC_DATA_FLAG
+#define AKM_EV_MAG				MAG_DATA_FLAG
+#define AKM_EV_FUSION			FUSION_DATA_FLAG
+#define AKM_EV_CONV				AKM_NUM_SENSORS	/* Measurement time is over */
+#define AKM_EV_NTIMER			(AKM_NUM_SENSORS + 1)
+#define AKM_EV_DRIVER			(AKM_EV_NTIMER)
+#define AKM_EV_CONTROL			(AKM_EV_NTIMER + 1)
+#define AKM_EV_MAX				(AKM_EV_NTIMER + 2)
+
+/* Shortest period of accelerometer and fusion sensor in nanosecond */
+#define AKM_MIN_PERIOD_NS		1000000
+/* Deadlines within this are processed together, in nanosecond */
+#define AKM_SCHED_SLACK_NS		500000
+
+/* Number of bins of jitter histogram, see #LoopStatSample */
+#define AKM_LOOPSTAT_NBIN		11
+
+/* State of measurement worker, see thread_worker */
+#define AKM_WORK_PARKED			0
+#define AKM_WORK_RUN			1
+#define AKM_WORK_QUIT			2
+
+/* Size of stack which is touched before measurement, in byte */
+#define AKM_STACK_PREFAULT		(32 * 1024)
+
+#define AKM_TS2NS(ts)	((int64_t)(ts).tv_sec * 1000000000 + (ts).tv_nsec)
+
+/*** Type declaration *********************************************************/
+/*! Statistics of measurement loop, taken at each magnetometer period. */
+typedef struct _AKM_LOOPSTAT {
+	const char*	name;
+	int64_t		begin;		/*!< Start time in nanosecond */
+	int64_t		end;		/*!< Stop time in nanosecond */
+	int64_t		first;		/*!< The first sample time in nanosecond */
+	int64_t		last;		/*!< The last sample time in nanosecond */
+	int64_t		psum;		/*!< Sum of requested intervals */
+	int64_t		jsum;		/*!< Sum of |interval - period| */
+	int64_t		jmax;		/*!< Maximum of |interval - period| */
+	uint32_t	nsample;	/*!< Number of samples */
+	uint32_t	noverrun;	/*!< Samples which missed a whole period */
+	uint32_t	nskip;		/*!< Periods skipped by overrun */
+	uint32_t	hist[AKM_LOOPSTAT_NBIN];	/*!< Histogram of jitter */
+	long		nvcsw;		/*!< Voluntary context switches */
+} AKM_LOOPSTAT;
+
+/*! Deadlines of sensors in #thread_main. */
+typedef struct _AKM_SCHED {
+	int64_t		base;						/*!< Origin of timeline */
+	int64_t		period[AKM_NUM_SENSORS];	/*!< Negative if disabled */
+	int64_t		next[AKM_NUM_SENSORS];		/*!< Next deadline */
+	uint32_t	skipped[AKM_NUM_SENSORS];	/*!< Missed by the last check */
+} AKM_SCHED;
+
+/*! State of magnetometer acquisition, see #MagAcquire. */
+typedef struct _AKM_MAGACQ {
+	int16		skip;		/*!< Measurements skipped while still */
+	int16		pending;	/*!< Non-zero if measurement is started */
+	BYTE		mode;		/*!< Current measurement mode */
+	int64_t		interval;	/*!< Interval of continuous mode */
+} AKM_MAGACQ;
 
 /*** Global variables *********************************************************/
 int g_stopRequest = 0;
@@ -57,6 +130,31 @@ int g_mainQuit = AKD_FALSE;
 
 /* Static variable. */
 static pthread_t s_thread;  /*!< Thread handle */
+static pthread_mutex_t s_workmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_workcond = PTHREAD_COND_INITIALIZER;
+static int s_workstate = AKM_WORK_PARKED; /*!< Guarded by s_workmutex */
+static int s_workstarted = 0; /*!< Non-zero if s_thread is created */
+static void* (*s_measure)(void*) = NULL; /*!< Run by thread_worker */
+static int s_warm = 0; /*!< Non-zero if library state is kept in memory */
+static AKFS_AOC_MODE s_aocmode = AKFS_AOC_4POINTS; /*!< Offset estimation */
+static AKFS_FILTER_MODE s_filter = AKFS_FILTER_BOX; /*!< Smoothing */
+static int s_lastypr[AKM_YPR_DATA_SIZE]; /*!< The last data set to driver */
+static int s_lastyprvalid = 0; /*!< Non-zero if s_lastypr is valid */
+static uint32_t s_magsaved = 0; /*!< I2C transactions saved while still */
+static int s_reactor = 0; /*!< Non-zero to use thread_reactor */
+static int s_pipeline = 0; /*!< Non-zero to start measurement in advance */
+static int s_contmode = 0; /*!< Non-zero to use continuous measurement */
+static int s_split = 0; /*!< Non-zero to use thread_acquire and thread_compute */
+static int s_rtprio = 0; /*!< SCHED_FIFO priority, 0 for normal policy */
+static unsigned long s_cpumask = 0; /*!< CPUs to run on, 0 for any CPU */
+static int s_memlock = 0; /*!< Non-zero to lock memory and prefault stack */
+static int s_ctlfd = -1; /*!< eventfd to wake thread_reactor up */
+static AKFS_PIPE s_pipe; /*!< Samples from thread_acquire to thread_compute */
+static AKM_LOOPSTAT s_loopstat; /*!< Statistics of the last measurement */
+/*! Upper bounds of bins of jitter histogram in microsecond */
+static const int64_t s_jitterbin[AKM_LOOPSTAT_NBIN - 1] = {
+	10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000
+};
 
 /*** Sub Function *************************************************************/
 /*!
@@ -125,27 +223,26 @@ struct timespec AKFS_CalcSleep(
 		diff = 0;
 	}
 
-	/* Convert to timespec */
-	if (diff > 1000000000) {
+	/* Convert to timespec, tv_nsec must be less than one second */
 	ret.tv_sec = diff / 1000000000;
-		ret.tv_nsec = diff % 1000000000;
-	} else {
-		ret.tv_sec = 0;
-		ret.tv_nsec = diff;
-	}
+	ret.tv_nsec = diff % 1000000000;
 	return ret;
 }
 
 /*!
-  Get interval of each sensors from device driver.
+  Get interval of each sensors from device driver. While fusion sensor is
+   enabled, accelerometer and magnetometer are measured at least as fast as
+   fusion sensor.
   @return If this function succeeds, the return value is #AKM_SUCCESS.
    Otherwise the return value is #AKM_ERROR.
-  @param flag This variable indicates what sensor frequency is updated.
-  @param minimum This value show the minimum loop period in all sensors.
+  @param flag This variable indicates what sensor is enabled.
+  @param period Period of each sensor in nanosecond, indexed by
+   ACC_DATA_FLAG, MAG_DATA_FLAG and FUSION_DATA_FLAG. Negative value means
+   the sensor is not measured.
  */
 int16 AKFS_GetInterval(
 		uint16*  flag,
-		int64_t* minimum
+		int64_t  period[AKM_NUM_SENSORS]
 )
 {
 	/* Accelerometer, Magnetometer, Fusion */
@@ -154,210 +251,1525 @@ int16 AKFS_GetInterval(
 	int64_t delay[AKM_NUM_SENSORS];
 	int i;
 
-#ifdef AKM_VALUE_CHECK
-	if (AKM_NUM_SENSORS != 3) {
-		AKMERROR_STR("You may refer invalid header file.");
-		return AKM_ERROR;
+#ifdef AKM_VALUE_CHECK
+	if (AKM_NUM_SENSORS != 3) {
+		AKMERROR_STR("You may refer invalid header file.");
+		return AKM_ERROR;
+	}
+#endif
+
+	if (AKD_GetDelay(delay) != AKD_SUCCESS) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+	AKMDEBUG(AKMDATA_LOOP, "delay[A,M,O]=%lld,%lld,%lld\n",
+		delay[0], delay[1], delay[2]);
+
+	/* update */
+	*flag = 0;
+	for (i=0; i<AKM_NUM_SENSORS; i++) {
+		/* Set flag */
+		if (delay[i] >= 0) {
+			*flag |= 1 << i;
+		}
+		period[i] = delay[i];
+	}
+	/* Fusion sensor uses the latest vectors */
+	if (period[FUSION_DATA_FLAG] >= 0) {
+		for (i = ACC_DATA_FLAG; i <= MAG_DATA_FLAG; i++) {
+			if ((period[i] < 0) || (period[i] > period[FUSION_DATA_FLAG])) {
+				period[i] = period[FUSION_DATA_FLAG];
+			}
+		}
+	}
+	for (i=0; i<AKM_NUM_SENSORS; i++) {
+		if ((period[i] >= 0) && (period[i] < AKM_MIN_PERIOD_NS)) {
+			period[i] = AKM_MIN_PERIOD_NS;
+		}
+	}
+	/* Measurement can not be started before the previous one finishes */
+	if ((period[MAG_DATA_FLAG] >= 0) &&
+		(period[MAG_DATA_FLAG] < AKM_MEASUREMENT_TIME_NS)) {
+		period[MAG_DATA_FLAG] = AKM_MEASUREMENT_TIME_NS;
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+  Align a deadline to the timeline of a period, i.e. base + n * period,
+   which is the first one after now. Sensors whose periods are multiples of
+   each other have the same deadline.
+  @return Deadline in nanosecond.
+  @param[in] base Origin of timeline in nanosecond.
+  @param[in] period Period in nanosecond.
+  @param[in] now Current time in nanosecond.
+ */
+static int64_t SchedAlign(
+	const	int64_t	base,
+	const	int64_t	period,
+	const	int64_t	now
+)
+{
+	int64_t n;
+
+	/* Round down, now is before base when a sensor is enabled at start */
+	n = (now - base) / period;
+	if ((now < base) && (((now - base) % period) != 0)) {
+		n--;
+	}
+	return base + (n + 1) * period;
+}
+
+/*!
+  Initialize deadlines of all sensors.
+  @param[out] sched Deadlines.
+  @param[in] now Current time in nanosecond, which is used as the origin.
+ */
+static void SchedInit(AKM_SCHED* sched, const int64_t now)
+{
+	int i;
+
+	sched->base = now;
+	for (i = 0; i < AKM_NUM_SENSORS; i++) {
+		sched->period[i] = -1;
+		sched->next[i] = now;
+		sched->skipped[i] = 0;
+	}
+}
+
+/*!
+  Set period of each sensor. A sensor whose period is changed follows the
+   timeline of the new period, from the deadline just before now.
+  @param[in,out] sched Deadlines.
+  @param[in] period Period of each sensor in nanosecond, negative if
+   disabled.
+  @param[in] now Current time in nanosecond.
+ */
+static void SchedSetPeriod(
+			AKM_SCHED*	sched,
+	const	int64_t		period[],
+	const	int64_t		now
+)
+{
+	int i;
+
+	for (i = 0; i < AKM_NUM_SENSORS; i++) {
+		if (sched->period[i] != period[i]) {
+			sched->period[i] = period[i];
+			if (period[i] >= 0) {
+				sched->next[i] = SchedAlign(sched->base, period[i],
+					now - period[i]);
+			}
+		}
+	}
+}
+
+/*!
+  Get sensors whose deadline comes within #AKM_SCHED_SLACK_NS, and advance
+   their deadlines. A late sensor is processed once, and then catches up
+   with the timeline if the next deadline is still ahead. If whole periods
+   have been missed, they are not processed in a burst but skipped, and the
+   number is set to skipped.
+  @return Flag of sensors to be processed now.
+  @param[in,out] sched Deadlines.
+  @param[in] now Current time in nanosecond.
+ */
+static uint16 SchedDue(AKM_SCHED* sched, const int64_t now)
+{
+	uint16 flag;
+	int64_t next;
+	int i;
+
+	flag = 0;
+	for (i = 0; i < AKM_NUM_SENSORS; i++) {
+		sched->skipped[i] = 0;
+		if ((sched->period[i] < 0) ||
+			(sched->next[i] > now + AKM_SCHED_SLACK_NS)) {
+			continue;
+		}
+		flag |= 1 << i;
+		sched->next[i] += sched->period[i];
+		if (sched->next[i] <= now) {
+			next = SchedAlign(sched->base, sched->period[i], now);
+			sched->skipped[i] =
+				(uint32_t)((next - sched->next[i]) / sched->period[i]);
+			sched->next[i] = next;
+		}
+	}
+	return flag;
+}
+
+/*!
+  Get the earliest deadline.
+  @return Deadline in nanosecond. If no sensor is enabled, one second later.
+  @param[in] sched Deadlines.
+  @param[in] now Current time in nanosecond.
+ */
+static int64_t SchedNext(const AKM_SCHED* sched, const int64_t now)
+{
+	int64_t next;
+	int i;
+
+	next = now + 1000000000;
+	for (i = 0; i < AKM_NUM_SENSORS; i++) {
+		if ((sched->period[i] >= 0) && (next > sched->next[i])) {
+			next = sched->next[i];
+		}
+	}
+	return next;
+}
+
+/*!
+  If this program run as console mode, measurement result will be displayed
+   on console terminal.
+  @return None.
+ */
+void AKFS_OutputResult(
+	const	uint16			flag,
+	const	AKSENSOR_DATA*	acc,
+	const	AKSENSOR_DATA*	mag,
+	const	AKSENSOR_DATA*	ori,
+	const	AKFLOAT			rv[4]
+)
+{
+	int buf[AKM_YPR_DATA_SIZE];
+
+#ifdef AKM_VALUE_CHECK
+	if (AKM_YPR_DATA_SIZE < 16) {
+		AKMERROR_STR("You may refer invalid header file.");
+		return;
+	}
+#endif
+	/* Store to buffer */
+	buf[0] = flag;					/* Data flag */
+	buf[1] = CONVERT_ACC(acc->x);	/* Ax */
+	buf[2] = CONVERT_ACC(acc->y);	/* Ay */
+	buf[3] = CONVERT_ACC(acc->z);	/* Az */
+	buf[4] = acc->status;			/* Acc status */
+	buf[5] = CONVERT_MAG(mag->x);	/* Mx */
+	buf[6] = CONVERT_MAG(mag->y);	/* My */
+	buf[7] = CONVERT_MAG(mag->z);	/* Mz */
+	buf[8] = mag->status;			/* Mag status */
+	buf[9] = CONVERT_ORI(ori->x);	/* yaw */
+	buf[10] = CONVERT_ORI(ori->y);	/* pitch */
+	buf[11] = CONVERT_ORI(ori->z);	/* roll */
+	buf[12] = CONVERT_RV(rv[0]);	/* Rotation vector x */
+	buf[13] = CONVERT_RV(rv[1]);	/* Rotation vector y */
+	buf[14] = CONVERT_RV(rv[2]);	/* Rotation vector z */
+	buf[15] = CONVERT_RV(rv[3]);	/* Rotation vector w */
+
+	if (g_opmode & OPMODE_CONSOLE) {
+		/* Console mode */
+		Disp_Result(buf);
+	}
+
+	/* Unchanged data is not reported by input subsystem, so it is not
+	   set to driver either. This happens while the device is still. */
+	if (s_lastyprvalid && (memcmp(buf, s_lastypr, sizeof(buf)) == 0)) {
+		return;
+	}
+	memcpy(s_lastypr, buf, sizeof(buf));
+	s_lastyprvalid = 1;
+
+	/* Set result to driver */
+	AKD_SetYPR(buf);
+}
+
+
+/*!
+  Get the number of voluntary context switches of the calling thread,
+   i.e. how many times the thread went to sleep.
+  @return The number of switches. Zero if it is not available.
+ */
+static long LoopStatSwitches(void)
+{
+#ifndef WIN32
+	struct rusage ru;
+#ifdef RUSAGE_THREAD
+	if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+		return ru.ru_nvcsw;
+	}
+#endif
+	if (getrusage(RUSAGE_SELF, &ru) == 0) {
+		return ru.ru_nvcsw;
+	}
+#endif
+	return 0;
+}
+
+/*!
+  Start to take statistics of measurement loop.
+  @param[out] stat Statistics.
+  @param[in] name Name of the loop, which is shown by #LoopStatPrint.
+ */
+static void LoopStatStart(AKM_LOOPSTAT* stat, const char* name)
+{
+	struct timespec ts;
+
+	memset(stat, 0, sizeof(AKM_LOOPSTAT));
+	stat->name = name;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	stat->begin = AKM_TS2NS(ts);
+	stat->nvcsw = LoopStatSwitches();
+}
+
+/*!
+  Stop to take statistics, so that #LoopStatPrint shows the same result
+   after the loop finishes.
+  @param[in,out] stat Statistics.
+ */
+static void LoopStatStop(AKM_LOOPSTAT* stat)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	stat->end = AKM_TS2NS(ts);
+	stat->nvcsw = LoopStatSwitches() - stat->nvcsw;
+}
+
+/*!
+  Add a wakeup for magnetometer to statistics. Jitter is the difference
+   between the interval of wakeups and the period which is requested. If
+   the loop overran and skipped periods, the interval is compared with
+   the whole duration of them. Jitter is counted in a histogram whose bins
+   are divided by #s_jitterbin.
+  @param[in,out] stat Statistics.
+  @param[in] period Current period in nanosecond.
+  @param[in] skipped Number of periods skipped before this wakeup.
+ */
+static void LoopStatSample(
+			AKM_LOOPSTAT*	stat,
+	const	int64_t			period,
+	const	uint32_t		skipped
+)
+{
+	struct timespec ts;
+	int64_t now;
+	int64_t jitter;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = AKM_TS2NS(ts);
+	if (stat->last != 0) {
+		jitter = (now - stat->last) - period * (skipped + 1);
+		if (jitter < 0) {
+			jitter = -jitter;
+		}
+		stat->jsum += jitter;
+		if (stat->jmax < jitter) {
+			stat->jmax = jitter;
+		}
+		for (i = 0; i < AKM_LOOPSTAT_NBIN - 1; i++) {
+			if (jitter < s_jitterbin[i] * 1000) {
+				break;
+			}
+		}
+		stat->hist[i]++;
+		stat->psum += period * (skipped + 1);
+		if (skipped > 0) {
+			stat->noverrun++;
+			stat->nskip += skipped;
+		}
+		stat->nsample++;
+	} else {
+		stat->first = now;
+	}
+	stat->last = now;
+}
+
+/*!
+  Show statistics of measurement loop. Rate error is the difference between
+   the total duration of samples and that of the requested periods, so it
+   shows the drift of the loop.
+  @param[in] stat Statistics, which is stopped by #LoopStatStop.
+  @param[in] zone Debug zone to output, e.g. #AKMDATA_DUMP.
+ */
+static void LoopStatPrint(const AKM_LOOPSTAT* stat, const int zone)
+{
+	int64_t elapsed;
+	int i;
+
+	elapsed = stat->end - stat->begin;
+	if ((stat->nsample == 0) || (elapsed <= 0) || (stat->psum <= 0)) {
+		return;
+	}
+	AKMDEBUG(zone,
+		"%s: %.2f Hz, jitter mean=%lld max=%lld usec, %.1f wakeups/sec\n",
+		stat->name, stat->nsample * 1.0e9 / elapsed,
+		(long long)(stat->jsum / stat->nsample / 1000),
+		(long long)(stat->jmax / 1000),
+		stat->nvcsw * 1.0e9 / elapsed);
+	AKMDEBUG(zone,
+		"%s: rate error %+.1f ppm, %u overruns, %u periods skipped\n",
+		stat->name,
+		(double)((stat->last - stat->first) - stat->psum) * 1.0e6 / stat->psum,
+		stat->noverrun, stat->nskip);
+	for (i = 0; i < AKM_LOOPSTAT_NBIN - 1; i++) {
+		AKMDEBUG(zone, "  jitter <  %5lld usec: %u\n",
+			(long long)s_jitterbin[i], stat->hist[i]);
+	}
+	AKMDEBUG(zone, "  jitter >= %5lld usec: %u\n",
+		(long long)s_jitterbin[i - 1], stat->hist[i]);
+}
+
+/*!
+  Choose continuous measurement mode for a period of magnetometer. The
+   slowest mode which is fast enough for the period is chosen. If no mode
+   is fast enough, the fastest one is chosen.
+  @return Measurement mode. #AKM_MODE_SNG_MEASURE if the device has no
+   continuous measurement mode.
+  @param[in] period Period in nanosecond.
+  @param[out] interval Interval of the mode in nanosecond.
+ */
+static BYTE ContMode(const int64_t period, int64_t* interval)
+{
+#ifdef AKM_MODE_CONT1_MEASURE
+	static const BYTE mode[] = {
+		AKM_MODE_CONT1_MEASURE,
+		AKM_MODE_CONT2_MEASURE,
+#ifdef AKM_MODE_CONT3_MEASURE
+		AKM_MODE_CONT3_MEASURE,
+		AKM_MODE_CONT4_MEASURE,
+#endif
+	};
+	static const int64_t interval_us[] = {
+		AKM_CONT1_INTERVAL_US,
+		AKM_CONT2_INTERVAL_US,
+#ifdef AKM_MODE_CONT3_MEASURE
+		AKM_CONT3_INTERVAL_US,
+		AKM_CONT4_INTERVAL_US,
+#endif
+	};
+	const int n = sizeof(mode) / sizeof(mode[0]);
+	int i;
+
+	for (i = 0; i < n - 1; i++) {
+		if (interval_us[i] * 1000 <= period) {
+			break;
+		}
+	}
+	*interval = interval_us[i] * 1000;
+	return mode[i];
+#else
+	(void)period;
+	*interval = AKM_MEASUREMENT_TIME_NS;
+	return AKM_MODE_SNG_MEASURE;
+#endif
+}
+
+/*!
+  Change measurement mode of magnetometer, only if it differs from the
+   current one. Device driver changes mode via powerdown mode.
+  @return If this function succeeds, the return value is #AKM_SUCCESS.
+   Otherwise the return value is #AKM_ERROR.
+  @param[in,out] cur Current mode.
+  @param[in] mode New mode.
+ */
+static int16 SetMagMode(BYTE* cur, const BYTE mode)
+{
+	if (*cur == mode) {
+		return AKM_SUCCESS;
+	}
+	if (AKD_SetMode(mode) != AKD_SUCCESS) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+	AKMDEBUG(AKMDATA_LOOP, "%s: mode=0x%02X\n", __FUNCTION__, mode);
+	*cur = mode;
+	return AKM_SUCCESS;
+}
+
+/*!
+  Touch the stack which measurement may use, so that page faults do not
+   occur in the loop. Pages are kept by mlockall(MCL_FUTURE).
+ */
+static void PrefaultStack(void)
+{
+	volatile BYTE buf[AKM_STACK_PREFAULT];
+	int i;
+
+	for (i = 0; i < AKM_STACK_PREFAULT; i += 1024) {
+		buf[i] = 0;
+	}
+	(void)buf[0];
+}
+
+/*!
+  Apply scheduling options to the calling thread, which measures. A failure
+   is reported, but the thread keeps measuring with the default settings,
+   e.g. when the daemon has no privilege.
+ */
+static void ThreadRealtime(void)
+{
+#ifndef WIN32
+	struct sched_param param;
+	cpu_set_t cpus;
+	int cpu;
+
+	if (s_cpumask != 0) {
+		CPU_ZERO(&cpus);
+		for (cpu = 0; cpu < (int)(sizeof(s_cpumask) * 8); cpu++) {
+			if (s_cpumask & (1UL << cpu)) {
+				CPU_SET(cpu, &cpus);
+			}
+		}
+		/* Zero means the calling thread, not the whole process */
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+			AKMERROR_STR("sched_setaffinity");
+		}
+	}
+	if (s_rtprio > 0) {
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = s_rtprio;
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+			AKMERROR_STR("sched_setscheduler");
+		}
+	}
+	if (s_memlock) {
+		PrefaultStack();
+	}
+	AKMDEBUG(AKMDATA_DEBUG, "%s: prio=%d cpu=0x%lx lock=%d\n",
+		__FUNCTION__, s_rtprio, s_cpumask, s_memlock);
+#endif
+}
+
+/*!
+  Initialize library for measurement. The setting file is read only at the
+   first time. After that, offset and its estimation are kept in memory and
+   continue from the last measurement.
+  @return If this function succeeds, the return value is #AKM_SUCCESS.
+   Otherwise the return value is #AKM_ERROR.
+  @param[in,out] prms Parameters.
+ */
+static int16 MeasureStart(AKMPRMS* prms)
+{
+	if (s_warm) {
+		return AKFS_Resume(prms);
+	}
+	if (AKFS_Start(prms, CSPEC_SETTING_FILE) != AKM_SUCCESS) {
+		return AKM_ERROR;
+	}
+	s_warm = 1;
+	return AKM_SUCCESS;
+}
+
+/*!
+  Initialize state of magnetometer acquisition.
+  @param[out] acq State.
+ */
+static void MagAcqInit(AKM_MAGACQ* acq)
+{
+	acq->skip = 0;
+	acq->pending = 0;
+	acq->mode = AKM_MODE_POWERDOWN;
+	acq->interval = 0;
+}
+
+/*!
+  Get data from magnetometer when it is due. While accelerometer shows that
+   the device is still, the last magnetic vector is held and the
+   measurement is skipped. Any motion clears the state, so the next call
+   measures again.
+  @return If this function succeeds, the return value is #AKM_SUCCESS.
+   Otherwise the return value is #AKM_ERROR.
+  @param[in,out] acq State.
+  @param[in] period Period of each sensor in nanosecond.
+  @param[in] still Non-zero if the device is still, see #AKFS_IsStill.
+  @param[out] i2cData Data read from device, ST1 ~ ST2.
+  @param[out] measured Non-zero if i2cData is read.
+ */
+static int16 MagAcquire(
+			AKM_MAGACQ*	acq,
+	const	int64_t		period[],
+	const	int			still,
+			BYTE		i2cData[],
+			int*		measured
+)
+{
+	*measured = 0;
+	if ((period[ACC_DATA_FLAG] >= 0) &&
+		!acq->pending && still &&
+		(++acq->skip < CSPEC_STILL_HINTERVAL)) {
+		s_magsaved += AKM_MAG_I2C_PER_MEASURE;
+		return AKM_SUCCESS;
+	}
+	acq->skip = 0;
+	if (s_contmode) {
+		/* Device measures by itself, at least as fast as the period.
+		   Only the mode change is written. */
+		if (SetMagMode(&acq->mode, ContMode(period[MAG_DATA_FLAG], &acq->interval)) != AKM_SUCCESS) {
+			return AKM_ERROR;
+		}
+	} else if (!acq->pending) {
+		/* Set to measurement mode, unless it was started by the
+		   previous call. */
+		if (AKD_SetMode(AKM_MODE_SNG_MEASURE) != AKD_SUCCESS) {
+			AKMERROR;
+			return AKM_ERROR;
+		}
+	}
+
+	/* Wait for DRDY and get data from device */
+	if (AKD_GetMagneticData(i2cData) != AKD_SUCCESS) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+	acq->pending = 0;
+	*measured = 1;
+
+	/* Start the next measurement, so that the device converts while this
+	   sample is processed and the loop sleeps. It is not started while
+	   still, since the next call may skip. */
+	if (s_pipeline && !s_contmode && !still) {
+		if (AKD_SetMode(AKM_MODE_SNG_MEASURE) != AKD_SUCCESS) {
+			AKMERROR;
+			return AKM_ERROR;
+		}
+		acq->pending = 1;
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+  Stop magnetometer when it is no longer measured.
+  @return If this function succeeds, the return value is #AKM_SUCCESS.
+   Otherwise the return value is #AKM_ERROR.
+  @param[in,out] acq State.
+ */
+static int16 MagStop(AKM_MAGACQ* acq)
+{
+	BYTE i2cData[AKM_SENSOR_DATA_SIZE];
+
+	/* Data of the pending measurement would be too old. It is read anyway,
+	   since driver rejects the next mode until then. */
+	if (acq->pending) {
+		if (AKD_GetMagneticData(i2cData) != AKD_SUCCESS) {
+			AKMERROR;
+			return AKM_ERROR;
+		}
+		acq->pending = 0;
+	}
+	/* Stop continuous measurement */
+	return SetMagMode(&acq->mode, AKM_MODE_POWERDOWN);
+}
+
+/*!
+  Convert data read from magnetometer.
+  @return Status of the data, i.e. ST1 | ST2.
+  @param[in] i2cData Data read from device, ST1 ~ ST2.
+  @param[out] mag Measurement data, x, y, z.
+ */
+static int16 MagConvert(const BYTE i2cData[], int16 mag[3])
+{
+	/* raw data to x,y,z value */
+	mag[0] = (int)((int16_t)(i2cData[2]<<8)+((int16_t)i2cData[1]));
+	mag[1] = (int)((int16_t)(i2cData[4]<<8)+((int16_t)i2cData[3]));
+	mag[2] = (int)((int16_t)(i2cData[6]<<8)+((int16_t)i2cData[5]));
+	return i2cData[0] | i2cData[7];
+}
+
+/*!
+ A thread function which is raised when measurement is started.
+ @param[in] args This parameter is not used currently.
+ */
+static void* thread_main(void* args)
+{
+	AKMPRMS	*prms;
+	BYTE    i2cData[AKM_SENSOR_DATA_SIZE]; /* ST1 ~ ST2 */
+	int16	mag[3];
+	int16	mstat;
+	int16	acc[3];
+	struct	timespec tsstart= {0, 0};
+	struct	timespec tsend = {0, 0};
+#ifdef WIN32
+	struct	timespec doze;
+#else
+	struct	timespec deadline;
+#endif
+	int64_t	now;
+	int64_t	next;
+	int64_t	period[AKM_NUM_SENSORS];
+	AKM_SCHED	sched;
+	uint16	enabled;
+	uint16	flag;
+	AKSENSOR_DATA sv_acc;
+	AKSENSOR_DATA sv_mag;
+	AKSENSOR_DATA sv_ori;
+	AKFLOAT sv_rv[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+	AKFLOAT tmpx, tmpy, tmpz, tmpw;
+	int16 tmp_accuracy;
+	AKM_MAGACQ magacq;
+	int measured;
+
+	prms = (AKMPRMS *)args;
+	s_lastyprvalid = 0;
+	MagAcqInit(&magacq);
+	ThreadRealtime();
+	LoopStatStart(&s_loopstat, "thread_main");
+
+	/* Initialize library functions and device */
+	if (MeasureStart(prms) != AKM_SUCCESS) {
+		AKMERROR;
+		goto MEASURE_END;
+	}
+	if (clock_gettime(CLOCK_MONOTONIC, &tsstart) < 0) {
+		AKMERROR;
+		goto MEASURE_END;
+	}
+	SchedInit(&sched, AKM_TS2NS(tsstart));
+
+	while (g_stopRequest != AKM_TRUE) {
+		/* Beginning time */
+		if (clock_gettime(CLOCK_MONOTONIC, &tsstart) < 0) {
+			AKMERROR;
+			goto MEASURE_END;
+		}
+		now = AKM_TS2NS(tsstart);
+
+		/* Get interval */
+		if (AKFS_GetInterval(&enabled, period) != AKM_SUCCESS) {
+			AKMERROR;
+			goto MEASURE_END;
+		}
+
+		/* Each sensor runs at its own period. Fusion sensor uses the
+		   latest vectors, which are measured at least as fast. */
+		SchedSetPeriod(&sched, period, now);
+		flag = SchedDue(&sched, now);
+		if (flag & MAG_DATA_READY) {
+			LoopStatSample(&s_loopstat, period[MAG_DATA_FLAG],
+				sched.skipped[MAG_DATA_FLAG]);
+		}
+
+		if (flag & ACC_DATA_READY) {
+			/* Get accelerometer */
+			if (AKD_GetAccelerationData(acc) != AKD_SUCCESS) {
+				AKMERROR;
+				goto MEASURE_END;
+			}
+
+			/* Calculate accelerometer vector */
+			if (AKFS_Get_ACCELEROMETER(prms, acc, 0, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
+				sv_acc.x = tmpx;
+				sv_acc.y = tmpy;
+				sv_acc.z = tmpz;
+				sv_acc.status = tmp_accuracy;
+			} else {
+				flag &= ~ACC_DATA_READY;
+				flag &= ~FUSION_DATA_READY;
+			}
+		}
+
+		if (flag & MAG_DATA_READY) {
+			if (MagAcquire(&magacq, period, AKFS_IsStill(prms), i2cData, &measured) != AKM_SUCCESS) {
+				goto MEASURE_END;
+			}
+			if (measured) {
+				mstat = MagConvert(i2cData, mag);
+
+				/* Calculate magnetic field vector */
+				if (AKFS_Get_MAGNETIC_FIELD(prms, mag, mstat, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
+					sv_mag.x = tmpx;
+					sv_mag.y = tmpy;
+					sv_mag.z = tmpz;
+					sv_mag.status = tmp_accuracy;
+				} else {
+					flag &= ~MAG_DATA_READY;
+					flag &= ~FUSION_DATA_READY;
+				}
+			}
+		} else if (period[MAG_DATA_FLAG] < 0) {
+			if (MagStop(&magacq) != AKM_SUCCESS) {
+				goto MEASURE_END;
+			}
+		}
+
+		if (flag & FUSION_DATA_READY) {
+			if (AKFS_Get_ORIENTATION(prms, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
+				sv_ori.x = tmpx;
+				sv_ori.y = tmpy;
+				sv_ori.z = tmpz;
+				sv_ori.status = tmp_accuracy;
+			} else {
+				flag &= ~FUSION_DATA_READY;
+			}
+		}
+
+		if (flag & FUSION_DATA_READY) {
+			/* The last one is kept if magnetic vector is parallel to gravity */
+			if (AKFS_Get_ROTATION_VECTOR(prms, &tmpx, &tmpy, &tmpz, &tmpw, &tmp_accuracy) == AKM_SUCCESS) {
+				sv_rv[0] = tmpx;
+				sv_rv[1] = tmpy;
+				sv_rv[2] = tmpz;
+				sv_rv[3] = tmpw;
+			}
+		}
+
+		/* Output result */
+		flag &= enabled;
+		if (flag) {
+			AKFS_OutputResult(flag, &sv_acc, &sv_mag, &sv_ori, sv_rv);
+		}
+
+		/* Ending time */
+		if (clock_gettime(CLOCK_MONOTONIC, &tsend) < 0) {
+			AKMERROR;
+			goto MEASURE_END;
+		}
+
+		/* Sleep until the next deadline. Since deadlines are on a fixed
+		   timeline, oversleep and processing time are not accumulated. */
+		next = SchedNext(&sched, now);
+		AKMDEBUG(AKMDATA_LOOP, "Sleep: %6.2f msec\n",
+			(next - AKM_TS2NS(tsend)) / 1000000.0f);
+#ifdef WIN32
+		doze = AKFS_CalcSleep(&tsend, &tsstart, next - now);
+		nanosleep(&doze, NULL);
+#else
+		deadline.tv_sec = next / 1000000000;
+		deadline.tv_nsec = next % 1000000000;
+		/* EINTR is not retried, so that g_stopRequest is checked. */
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+#endif
+
+#ifdef WIN32
+		if (_kbhit()) {
+			_getch();
+			break;
+		}
+#endif
+	}
+
+MEASURE_END:
+	AKMDEBUG(AKMDATA_DUMP, "%s: %u I2C transactions are saved so far.\n",
+		__FUNCTION__, s_magsaved);
+	LoopStatStop(&s_loopstat);
+	LoopStatPrint(&s_loopstat, AKMDATA_DUMP);
+
+	/* Set to PowerDown mode */
+	if (AKD_SetMode(AKM_MODE_POWERDOWN) != AKD_SUCCESS) {
+		AKMERROR;
+	}
+
+	/* Save parameters */
+	if (AKFS_Stop(prms, CSPEC_SETTING_FILE) != AKM_SUCCESS) {
+		AKMERROR;
+	}
+	return ((void*)0);
+}
+
+#ifndef WIN32
+/*!
+  Arm a timer of reactor loop. Periodic timers expire at base + n * period,
+   so that timers of the same period expire at once and wake the thread up
+   only once.
+  @return If this function succeeds, the return value is #AKM_SUCCESS.
+   Otherwise the return value is #AKM_ERROR.
+  @param[in] fd File descriptor of timerfd.
+  @param[in] base Common origin of periodic timers in nanosecond.
+  @param[in] period Period in nanosecond. Negative value disarms the timer.
+  @param[in] oneshot Non-zero if the timer expires only once after period.
+ */
+static int16 ReactorArm(
+	const	int		fd,
+	const	int64_t	base,
+	const	int64_t	period,
+	const	int		oneshot
+)
+{
+	struct itimerspec its;
+	struct timespec ts;
+	int64_t first;
+	int flags;
+
+	memset(&its, 0, sizeof(its));
+	flags = 0;
+	if (period > 0) {
+		if (oneshot) {
+			first = period;
+		} else {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			first = AKM_TS2NS(ts) - base;
+			first = base + (first / period + 1) * period;
+			its.it_interval.tv_sec = period / 1000000000;
+			its.it_interval.tv_nsec = period % 1000000000;
+			flags = TFD_TIMER_ABSTIME;
+		}
+		its.it_value.tv_sec = first / 1000000000;
+		its.it_value.tv_nsec = first % 1000000000;
+	}
+	if (timerfd_settime(fd, flags, &its, NULL) < 0) {
+		AKMERROR_STR("timerfd_settime");
+		return AKM_ERROR;
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+  Get interval of each sensors by #AKFS_GetInterval and arm timers.
+  @return If this function succeeds, the return value is #AKM_SUCCESS.
+   Otherwise the return value is #AKM_ERROR.
+  @param[in] tfd File descriptors of timers, indexed by AKM_EV_*.
+  @param[in] base Common origin of periodic timers in nanosecond.
+  @param[in,out] period Period of each timer in nanosecond, negative if
+   disabled. Initialize with negative value before the first call.
+  @param[out] flag This variable indicates what sensor is enabled.
+ */
+static int16 ReactorSetPeriod(
+	const	int		tfd[],
+	const	int64_t	base,
+			int64_t	period[],
+			uint16*	flag
+)
+{
+	int64_t newp[AKM_NUM_SENSORS];
+	int i;
+
+	if (AKFS_GetInterval(flag, newp) != AKM_SUCCESS) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+
+	/* Timer is re-armed only when its period is changed, to keep phase */
+	for (i = 0; i < AKM_NUM_SENSORS; i++) {
+		if (period[i] == newp[i]) {
+			continue;
+		}
+		period[i] = newp[i];
+		if (ReactorArm(tfd[i], base, period[i], 0) != AKM_SUCCESS) {
+			return AKM_ERROR;
+		}
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+  Set continuous measurement mode for the period of magnetometer timer.
+   The device measures by itself, then DRDY notified by device driver wakes
+   the thread up, so the timer is stopped. If the driver does not notify
+   DRDY, i.e. it has no poll support or no IRQ, the timer is kept and it
+   reads data.
+  @return If this function succeeds, the return value is #AKM_SUCCESS.
+   Otherwise the return value is #AKM_ERROR.
+  @param[in] tfd File descriptors of timers, indexed by AKM_EV_*.
+  @param[in] period Period of each timer in nanosecond.
+  @param[in] drvdrdy Non-zero if the driver notifies DRDY through poll.
+  @param[in,out] magmode Current measurement mode.
+  @param[out] interval Interval of the mode in nanosecond.
+ */
+static int16 ReactorMagMode(
+	const	int		tfd[],
+	const	int64_t	period[],
+	const	int		drvdrdy,
+			BYTE*	magmode,
+			int64_t*	interval
+)
+{
+	BYTE mode;
+
+	if (!s_contmode) {
+		return AKM_SUCCESS;
+	}
+	if (period[AKM_EV_MAG] < 0) {
+		mode = AKM_MODE_POWERDOWN;
+	} else {
+		mode = ContMode(period[AKM_EV_MAG], interval);
+	}
+	if (SetMagMode(magmode, mode) != AKM_SUCCESS) {
+		return AKM_ERROR;
+	}
+	if (drvdrdy && (mode != AKM_MODE_POWERDOWN)) {
+		return ReactorArm(tfd[AKM_EV_MAG], 0, -1, 0);
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+  Get data from magnetometer and calculate magnetic field vector.
+  @return If data is read from device, the return value is #AKM_SUCCESS.
+   Otherwise the return value is #AKM_ERROR.
+  @param[in,out] prms Parameters.
+  @param[out] sv_mag Magnetic field vector, updated only if it is valid.
+  @param[in,out] flag #MAG_DATA_READY is set if sv_mag is updated.
+ */
+static int16 ReactorMagnetic(
+	AKMPRMS*		prms,
+	AKSENSOR_DATA*	sv_mag,
+	uint16*			flag
+)
+{
+	BYTE	i2cData[AKM_SENSOR_DATA_SIZE]; /* ST1 ~ ST2 */
+	int16	mag[3];
+	int16	mstat;
+	AKFLOAT	tmpx, tmpy, tmpz;
+	int16	tmp_accuracy;
+
+	if (AKD_GetMagneticData(i2cData) != AKD_SUCCESS) {
+		AKMERROR;
+		return AKM_ERROR;
+	}
+	mstat = MagConvert(i2cData, mag);
+
+	/* Calculate magnetic field vector */
+	if (AKFS_Get_MAGNETIC_FIELD(prms, mag, mstat, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
+		sv_mag->x = tmpx;
+		sv_mag->y = tmpy;
+		sv_mag->z = tmpz;
+		sv_mag->status = tmp_accuracy;
+		*flag |= MAG_DATA_READY;
+	}
+	return AKM_SUCCESS;
+}
+
+/*!
+ A thread function which is raised when measurement is started, instead of
+ #thread_main. Each sensor has its own timer, and the thread sleeps in
+ epoll_wait until a timer expires, the device driver has data or settings
+ are changed, or stop is requested through #s_ctlfd. Timers keep a fixed
+ period, so the delay is not polled and the processing time does not shift
+ the next measurement. If the driver does not support poll, data is read
+ when measurement time is over, and delay is read at each measurement.
+ @param[in] args Pointer to #AKMPRMS.
+ */
+static void* thread_reactor(void* args)
+{
+	AKMPRMS	*prms;
+	int16	acc[3];
+	int		epfd;
+	int		drvfd;
+	int		drvpoll;
+	int		drvdrdy;
+	int		tfd[AKM_EV_NTIMER];
+	int64_t	period[AKM_EV_NTIMER];
+	int64_t	base;
+	struct	timespec ts;
+	struct	epoll_event ev;
+	struct	epoll_event events[AKM_EV_MAX];
+	uint64_t	val;
+	uint16	enabled;
+	uint16	flag;
+	int		measuring;
+	BYTE	magmode;
+	int64_t	interval;
+	int		nev;
+	int		i;
+	AKSENSOR_DATA sv_acc;
+	AKSENSOR_DATA sv_mag;
+	AKSENSOR_DATA sv_ori;
+	AKFLOAT sv_rv[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+	AKFLOAT tmpx, tmpy, tmpz, tmpw;
+	int16 tmp_accuracy;
+	int16 magskip;
+
+	prms = (AKMPRMS *)args;
+	epfd = -1;
+	for (i = 0; i < AKM_EV_NTIMER; i++) {
+		tfd[i] = -1;
+		period[i] = -1;
+	}
+	memset(&sv_acc, 0, sizeof(sv_acc));
+	memset(&sv_mag, 0, sizeof(sv_mag));
+	memset(&sv_ori, 0, sizeof(sv_ori));
+	s_lastyprvalid = 0;
+	magskip = 0;
+	measuring = 0;
+	magmode = AKM_MODE_POWERDOWN;
+	interval = 0;
+	ThreadRealtime();
+	LoopStatStart(&s_loopstat, "thread_reactor");
+
+	/* Initialize library functions and device */
+	if (MeasureStart(prms) != AKM_SUCCESS) {
+		AKMERROR;
+		goto REACTOR_END;
+	}
+
+	/* Register event sources */
+	if (AKD_GetDeviceFd(&drvfd) != AKD_SUCCESS) {
+		AKMERROR;
+		goto REACTOR_END;
+	}
+	epfd = epoll_create(AKM_EV_MAX);
+	if (epfd < 0) {
+		AKMERROR_STR("epoll_create");
+		goto REACTOR_END;
+	}
+	for (i = 0; i < AKM_EV_NTIMER; i++) {
+		tfd[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (tfd[i] < 0) {
+			AKMERROR_STR("timerfd_create");
+			goto REACTOR_END;
+		}
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd[i], &ev) < 0) {
+			AKMERROR_STR("epoll_ctl");
+			goto REACTOR_END;
+		}
+	}
+	ev.events = EPOLLIN;
+	ev.data.u32 = AKM_EV_CONTROL;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, s_ctlfd, &ev) < 0) {
+		AKMERROR_STR("epoll_ctl");
+		goto REACTOR_END;
+	}
+	/* Old driver does not support poll, then EPERM is returned. */
+	ev.events = EPOLLIN | EPOLLPRI;
+	ev.data.u32 = AKM_EV_DRIVER;
+	drvpoll = (epoll_ctl(epfd, EPOLL_CTL_ADD, drvfd, &ev) == 0);
+	/* DRDY is notified only if the driver has IRQ. */
+	drvdrdy = 0;
+	if (drvpoll && (AKD_GetDrdyIrq(&drvdrdy) != AKD_SUCCESS)) {
+		AKMERROR;
+		goto REACTOR_END;
+	}
+	AKMDEBUG(AKMDATA_LOOP, "%s: driver poll=%d drdy=%d\n",
+		__FUNCTION__, drvpoll, drvdrdy);
+
+	/* Origin of timers */
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		AKMERROR;
+		goto REACTOR_END;
+	}
+	base = AKM_TS2NS(ts);
+
+	if ((ReactorSetPeriod(tfd, base, period, &enabled) != AKM_SUCCESS) ||
+		(ReactorMagMode(tfd, period, drvdrdy, &magmode, &interval) != AKM_SUCCESS)) {
+		AKMERROR;
+		goto REACTOR_END;
+	}
+
+	while (g_stopRequest != AKM_TRUE) {
+		nev = epoll_wait(epfd, events, AKM_EV_MAX, -1);
+		if (nev < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			AKMERROR_STR("epoll_wait");
+			goto REACTOR_END;
+		}
+
+		flag = 0;
+		for (i = 0; i < nev; i++) {
+			if (events[i].data.u32 < AKM_EV_NTIMER) {
+				/* Expiration count, more than one if the loop overran */
+				val = 1;
+				read(tfd[events[i].data.u32], &val, sizeof(val));
+			}
+			switch (events[i].data.u32) {
+			case AKM_EV_CONTROL:
+				read(s_ctlfd, &val, sizeof(val));
+				break;
+
+			case AKM_EV_DRIVER:
+				if (events[i].events & EPOLLPRI) {
+					/* Enable flag or delay is changed */
+					if ((ReactorSetPeriod(tfd, base, period, &enabled) != AKM_SUCCESS) ||
+						(ReactorMagMode(tfd, period, drvdrdy, &magmode, &interval) != AKM_SUCCESS)) {
+						AKMERROR;
+						goto REACTOR_END;
+					}
+				}
+				if (!(events[i].events & EPOLLIN)) {
+					break;
+				}
+				if (!measuring && (magmode == AKM_MODE_POWERDOWN)) {
+					/* No sample is pending, i.e. it is already read by
+					   AKM_EV_CONV in this batch. Reading again blocks. */
+					break;
+				}
+				/* Data is ready before measurement time is over */
+				ReactorArm(tfd[AKM_EV_CONV], 0, -1, 1);
+				/* Fall through */
+			case AKM_EV_CONV:
+				if (!measuring && (events[i].data.u32 == AKM_EV_CONV)) {
+					/* Already read by AKM_EV_DRIVER */
+					break;
+				}
+				measuring = 0;
+				if (ReactorMagnetic(prms, &sv_mag, &flag) != AKM_SUCCESS) {
+					goto REACTOR_END;
+				}
+				if (magmode != AKM_MODE_POWERDOWN) {
+					/* DRDY of continuous measurement */
+					LoopStatSample(&s_loopstat, interval, 0);
+				}
+				break;
+
+			case AKM_EV_ACC:
+				if (AKD_GetAccelerationData(acc) != AKD_SUCCESS) {
+					AKMERROR;
+					goto REACTOR_END;
+				}
+				if (AKFS_Get_ACCELEROMETER(prms, acc, 0, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
+					sv_acc.x = tmpx;
+					sv_acc.y = tmpy;
+					sv_acc.z = tmpz;
+					sv_acc.status = tmp_accuracy;
+					flag |= ACC_DATA_READY;
+				}
+				break;
+
+			case AKM_EV_MAG:
+				LoopStatSample(&s_loopstat, period[AKM_EV_MAG],
+					(val > 1) ? (uint32_t)(val - 1) : 0);
+				if (!drvpoll) {
+					/* Settings are not notified */
+					if ((ReactorSetPeriod(tfd, base, period, &enabled) != AKM_SUCCESS) ||
+						(ReactorMagMode(tfd, period, drvdrdy, &magmode, &interval) != AKM_SUCCESS)) {
+						AKMERROR;
+						goto REACTOR_END;
+					}
+				}
+				if (magmode != AKM_MODE_POWERDOWN) {
+					/* Continuous measurement, DRDY is not notified */
+					if (ReactorMagnetic(prms, &sv_mag, &flag) != AKM_SUCCESS) {
+						goto REACTOR_END;
+					}
+					break;
+				}
+				if (measuring) {
+					/* The previous measurement is not finished */
+					break;
+				}
+				/* Hold the last magnetic vector while the device is still,
+				   same as thread_main. */
+				if ((period[AKM_EV_ACC] >= 0) &&
+					AKFS_IsStill(prms) && (++magskip < CSPEC_STILL_HINTERVAL)) {
+					s_magsaved += AKM_MAG_I2C_PER_MEASURE;
+					flag |= MAG_DATA_READY;
+					break;
+				}
+				magskip = 0;
+				if (AKD_SetMode(AKM_MODE_SNG_MEASURE) != AKD_SUCCESS) {
+					AKMERROR;
+					goto REACTOR_END;
+				}
+				measuring = 1;
+				if (ReactorArm(tfd[AKM_EV_CONV], 0, AKM_MEASUREMENT_TIME_NS, 1) != AKM_SUCCESS) {
+					goto REACTOR_END;
+				}
+				break;
+
+			case AKM_EV_FUSION:
+				if (AKFS_Get_ORIENTATION(prms, &tmpx, &tmpy, &tmpz, &tmp_accuracy) != AKM_SUCCESS) {
+					break;
+				}
+				sv_ori.x = tmpx;
+				sv_ori.y = tmpy;
+				sv_ori.z = tmpz;
+				sv_ori.status = tmp_accuracy;
+				/* The last one is kept if magnetic vector is parallel to gravity */
+				if (AKFS_Get_ROTATION_VECTOR(prms, &tmpx, &tmpy, &tmpz, &tmpw, &tmp_accuracy) == AKM_SUCCESS) {
+					sv_rv[0] = tmpx;
+					sv_rv[1] = tmpy;
+					sv_rv[2] = tmpz;
+					sv_rv[3] = tmpw;
+				}
+				flag |= FUSION_DATA_READY;
+				break;
+
+			default:
+				break;
+			}
+		}
+
+		/* Output result */
+		flag &= enabled;
+		if (flag) {
+			AKFS_OutputResult(flag, &sv_acc, &sv_mag, &sv_ori, sv_rv);
+		}
+	}
+
+REACTOR_END:
+	AKMDEBUG(AKMDATA_DUMP, "%s: %u I2C transactions are saved so far.\n",
+		__FUNCTION__, s_magsaved);
+	LoopStatStop(&s_loopstat);
+	LoopStatPrint(&s_loopstat, AKMDATA_DUMP);
+
+	for (i = 0; i < AKM_EV_NTIMER; i++) {
+		if (tfd[i] >= 0) {
+			close(tfd[i]);
+		}
+	}
+	if (epfd >= 0) {
+		close(epfd);
+	}
+
+	/* Set to PowerDown mode */
+	if (AKD_SetMode(AKM_MODE_POWERDOWN) != AKD_SUCCESS) {
+		AKMERROR;
+	}
+
+	/* Save parameters */
+	if (AKFS_Stop(prms, CSPEC_SETTING_FILE) != AKM_SUCCESS) {
+		AKMERROR;
 	}
+	return ((void*)0);
+}
 #endif
 
-	if (AKD_GetDelay(delay) != AKD_SUCCESS) {
+#ifndef WIN32
+/*!
+ A thread function which is raised by #thread_compute. It reads data from
+ device at the deadline of each sensor same as #thread_main, and queues raw
+ samples with wakeup time without any calculation, so that a slow
+ calculation does not delay measurement.
+ @param[in] args Pointer to #AKFS_PIPE.
+ */
+static void* thread_acquire(void* args)
+{
+	AKFS_PIPE	*pipe;
+	AKFS_SAMPLE	smp;
+	struct	timespec ts;
+	struct	timespec deadline;
+	int64_t	now;
+	int64_t	next;
+	int64_t	period[AKM_NUM_SENSORS];
+	AKM_SCHED	sched;
+	AKM_MAGACQ	magacq;
+	int		measured;
+
+	pipe = (AKFS_PIPE *)args;
+	MagAcqInit(&magacq);
+	ThreadRealtime();
+	LoopStatStart(&s_loopstat, "thread_acquire");
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
 		AKMERROR;
-		return AKM_ERROR;
+		goto ACQUIRE_END;
 	}
-	AKMDEBUG(AKMDATA_LOOP, "delay[A,M,O]=%lld,%lld,%lld\n",
-		delay[0], delay[1], delay[2]);
+	SchedInit(&sched, AKM_TS2NS(ts));
 
-	/* update */
-	*minimum = 1000000000;
-	*flag = 0;
-	for (i=0; i<AKM_NUM_SENSORS; i++) {
-		/* Set flag */
-		if (delay[i] >= 0) {
-			*flag |= 1 << i;
-			if (*minimum > delay[i]) {
-				*minimum = delay[i];
+	while ((g_stopRequest != AKM_TRUE) && !pipe->stop) {
+		/* Beginning time */
+		if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+			AKMERROR;
+			goto ACQUIRE_END;
+		}
+		now = AKM_TS2NS(ts);
+
+		/* Get interval */
+		if (AKFS_GetInterval(&smp.enabled, period) != AKM_SUCCESS) {
+			AKMERROR;
+			goto ACQUIRE_END;
+		}
+		SchedSetPeriod(&sched, period, now);
+		smp.flag = SchedDue(&sched, now);
+		smp.measured = 0;
+		smp.twake = now;
+		if (smp.flag & MAG_DATA_READY) {
+			LoopStatSample(&s_loopstat, period[MAG_DATA_FLAG],
+				sched.skipped[MAG_DATA_FLAG]);
+		}
+
+		if (smp.flag & ACC_DATA_READY) {
+			if (AKD_GetAccelerationData(smp.acc) != AKD_SUCCESS) {
+				AKMERROR;
+				goto ACQUIRE_END;
+			}
+			smp.measured |= ACC_DATA_READY;
+		}
+
+		if (smp.flag & MAG_DATA_READY) {
+			/* Stillness is told by thread_compute */
+			if (MagAcquire(&magacq, period, pipe->still, smp.mag, &measured) != AKM_SUCCESS) {
+				goto ACQUIRE_END;
+			}
+			if (measured) {
+				smp.measured |= MAG_DATA_READY;
 			}
+		} else if (period[MAG_DATA_FLAG] < 0) {
+			if (MagStop(&magacq) != AKM_SUCCESS) {
+				goto ACQUIRE_END;
+			}
+		}
+
+		/* A sample is dropped if the queue is full, which is counted */
+		if (smp.flag) {
+			AKFS_PushPipe(pipe, &smp);
 		}
+
+		/* Sleep until the next deadline, see thread_main */
+		next = SchedNext(&sched, now);
+		deadline.tv_sec = next / 1000000000;
+		deadline.tv_nsec = next % 1000000000;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
 	}
-	return AKM_SUCCESS;
+
+ACQUIRE_END:
+	AKMDEBUG(AKMDATA_DUMP, "%s: %u I2C transactions are saved so far.\n",
+		__FUNCTION__, s_magsaved);
+	LoopStatStop(&s_loopstat);
+	LoopStatPrint(&s_loopstat, AKMDATA_DUMP);
+
+	/* Set to PowerDown mode */
+	if (AKD_SetMode(AKM_MODE_POWERDOWN) != AKD_SUCCESS) {
+		AKMERROR;
+	}
+	AKFS_ClosePipe(pipe);
+	return ((void*)0);
 }
 
 /*!
-  If this program run as console mode, measurement result will be displayed
-   on console terminal.
-  @return None.
+  Copy the latest valid vector of a batch.
+  @return If a valid vector is found, the return value is #AKM_SUCCESS.
+   Otherwise the return value is #AKM_ERROR.
+  @param[in] n The number of vectors.
+  @param[in] vec Vectors.
+  @param[in] accuracy Accuracy of each vector, negative if invalid.
+  @param[out] sv The latest valid vector.
  */
-void AKFS_OutputResult(
-	const	uint16			flag,
-	const	AKSENSOR_DATA*	acc,
-	const	AKSENSOR_DATA*	mag,
-	const	AKSENSOR_DATA*	ori
+static int16 BatchLatest(
+	const	int16			n,
+	const	AKFVEC			vec[],
+	const	int16			accuracy[],
+			AKSENSOR_DATA*	sv
 )
 {
-	int buf[AKM_YPR_DATA_SIZE];
-
-#ifdef AKM_VALUE_CHECK
-	if (AKM_YPR_DATA_SIZE < 12) {
-		AKMERROR_STR("You may refer invalid header file.");
-		return;
-	}
-#endif
-	/* Store to buffer */
-	buf[0] = flag;					/* Data flag */
-	buf[1] = CONVERT_ACC(acc->x);	/* Ax */
-	buf[2] = CONVERT_ACC(acc->y);	/* Ay */
-	buf[3] = CONVERT_ACC(acc->z);	/* Az */
-	buf[4] = acc->status;			/* Acc status */
-	buf[5] = CONVERT_MAG(mag->x);	/* Mx */
-	buf[6] = CONVERT_MAG(mag->y);	/* My */
-	buf[7] = CONVERT_MAG(mag->z);	/* Mz */
-	buf[8] = mag->status;			/* Mag status */
-	buf[9] = CONVERT_ORI(ori->x);	/* yaw */
-	buf[10] = CONVERT_ORI(ori->y);	/* pitch */
-	buf[11] = CONVERT_ORI(ori->z);	/* roll */
-
-	if (g_opmode & OPMODE_CONSOLE) {
-		/* Console mode */
-		Disp_Result(buf);
+	int16 i;
+
+	for (i = n - 1; i >= 0; i--) {
+		if (accuracy[i] >= 0) {
+			sv->x = vec[i].u.x;
+			sv->y = vec[i].u.y;
+			sv->z = vec[i].u.z;
+			sv->status = accuracy[i];
+			return AKM_SUCCESS;
+		}
 	}
-
-	/* Set result to driver */
-	AKD_SetYPR(buf);
+	return AKM_ERROR;
 }
 
-
 /*!
- A thread function which is raised when measurement is started.
- @param[in] args This parameter is not used currently.
+ A thread function which is raised when measurement is started, instead of
+ #thread_main. It starts #thread_acquire, and calculates samples queued by
+ it. Queued samples are drained at once, vectors are calculated in a batch,
+ and only the result of the latest sample is output, since older ones would
+ be overwritten immediately.
+ @param[in] args Pointer to #AKMPRMS.
  */
-static void* thread_main(void* args)
+static void* thread_compute(void* args)
 {
 	AKMPRMS	*prms;
-	BYTE    i2cData[AKM_SENSOR_DATA_SIZE]; /* ST1 ~ ST2 */
-	int16	mag[3];
-	int16	mstat;
-	int16	acc[3];
-	struct	timespec tsstart= {0, 0};
-	struct	timespec tsend = {0, 0};
-	struct	timespec doze;
-	int64_t	minimum;
+	pthread_t	acqthread;
+	int		started;
+	AKFS_SAMPLE	smp[AKFS_PIPE_BATCH];
+	int16	acc[AKFS_PIPE_BATCH][3];
+	int16	astat[AKFS_PIPE_BATCH];
+	int16	mag[AKFS_PIPE_BATCH][3];
+	int16	mstat[AKFS_PIPE_BATCH];
+	AKFVEC	vec[AKFS_PIPE_BATCH];
+	int16	accuracy[AKFS_PIPE_BATCH];
+	int16	n;
+	int16	nacc;
+	int16	nmag;
+	int16	i;
 	uint16	flag;
 	AKSENSOR_DATA sv_acc;
 	AKSENSOR_DATA sv_mag;
 	AKSENSOR_DATA sv_ori;
-	AKFLOAT tmpx, tmpy, tmpz;
+	AKFLOAT sv_rv[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+	AKFLOAT tmpx, tmpy, tmpz, tmpw;
 	int16 tmp_accuracy;
 
 	prms = (AKMPRMS *)args;
-	minimum = -1;
+	started = 0;
+	memset(&sv_acc, 0, sizeof(sv_acc));
+	memset(&sv_mag, 0, sizeof(sv_mag));
+	memset(&sv_ori, 0, sizeof(sv_ori));
+	s_lastyprvalid = 0;
 
-	/* Initialize library functions and device */
-	if (AKFS_Start(prms, CSPEC_SETTING_FILE) != AKM_SUCCESS) {
+	if (AKFS_InitPipe(&s_pipe) != AKM_SUCCESS) {
 		AKMERROR;
-		goto MEASURE_END;
+		return ((void*)0);
 	}
 
-	while (g_stopRequest != AKM_TRUE) {
-		/* Beginning time */
-		if (clock_gettime(CLOCK_MONOTONIC, &tsstart) < 0) {
-			AKMERROR;
-			goto MEASURE_END;
-		}
+	/* Initialize library functions and device */
+	if (MeasureStart(prms) != AKM_SUCCESS) {
+		AKMERROR;
+		goto COMPUTE_END;
+	}
+	if (pthread_create(&acqthread, NULL, thread_acquire, &s_pipe) != 0) {
+		AKMERROR_STR("pthread_create");
+		goto COMPUTE_END;
+	}
+	started = 1;
 
-		/* Get interval */
-		if (AKFS_GetInterval(&flag, &minimum) != AKM_SUCCESS) {
-			AKMERROR;
-			goto MEASURE_END;
+	while (!s_pipe.done) {
+		if (AKFS_WaitPipe(&s_pipe) != AKM_SUCCESS) {
+			goto COMPUTE_END;
 		}
-
-		if ((flag & ACC_DATA_READY) || (flag & FUSION_DATA_READY)) {
-			/* Get accelerometer */
-			if (AKD_GetAccelerationData(acc) != AKD_SUCCESS) {
-				AKMERROR;
-				goto MEASURE_END;
+		while ((n = AKFS_PopPipe(&s_pipe, smp, AKFS_PIPE_BATCH)) > 0) {
+			flag = 0;
+			nacc = 0;
+			nmag = 0;
+			for (i = 0; i < n; i++) {
+				flag |= smp[i].flag;
+				if (smp[i].measured & ACC_DATA_READY) {
+					memcpy(acc[nacc], smp[i].acc, sizeof(acc[0]));
+					astat[nacc] = 0;
+					nacc++;
+				}
+				if (smp[i].measured & MAG_DATA_READY) {
+					mstat[nmag] = MagConvert(smp[i].mag, mag[nmag]);
+					nmag++;
+				}
 			}
 
-			/* Calculate accelerometer vector */
-			if (AKFS_Get_ACCELEROMETER(prms, acc, 0, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
-				sv_acc.x = tmpx;
-				sv_acc.y = tmpy;
-				sv_acc.z = tmpz;
-				sv_acc.status = tmp_accuracy;
-			} else {
+			/* Calculate vectors. Vector which is not measured, e.g.
+			   magnetic vector while still, is held. */
+			if ((nacc > 0) &&
+				((AKFS_Get_ACCELEROMETER_Batch(prms, nacc, acc, astat, vec, accuracy) <= 0) ||
+				 (BatchLatest(nacc, vec, accuracy, &sv_acc) != AKM_SUCCESS))) {
 				flag &= ~ACC_DATA_READY;
 				flag &= ~FUSION_DATA_READY;
 			}
-		}
-
-		if ((flag & MAG_DATA_READY) || (flag & FUSION_DATA_READY)) {
-			/* Set to measurement mode  */
-			if (AKD_SetMode(AKM_MODE_SNG_MEASURE) != AKD_SUCCESS) {
-				AKMERROR;
-				goto MEASURE_END;
-			}
-
-			/* Wait for DRDY and get data from device */
-			if (AKD_GetMagneticData(i2cData) != AKD_SUCCESS) {
-				AKMERROR;
-				goto MEASURE_END;
-			}
-			/* raw data to x,y,z value */
-			mag[0] = (int)((int16_t)(i2cData[2]<<8)+((int16_t)i2cData[1]));
-			mag[1] = (int)((int16_t)(i2cData[4]<<8)+((int16_t)i2cData[3]));
-			mag[2] = (int)((int16_t)(i2cData[6]<<8)+((int16_t)i2cData[5]));
-			mstat = i2cData[0] | i2cData[7];
-
-			/* Calculate magnetic field vector */
-			if (AKFS_Get_MAGNETIC_FIELD(prms, mag, mstat, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
-				sv_mag.x = tmpx;
-				sv_mag.y = tmpy;
-				sv_mag.z = tmpz;
-				sv_mag.status = tmp_accuracy;
-			} else {
+			if ((nmag > 0) &&
+				((AKFS_Get_MAGNETIC_FIELD_Batch(prms, nmag, mag, mstat, vec, accuracy) <= 0) ||
+				 (BatchLatest(nmag, vec, accuracy, &sv_mag) != AKM_SUCCESS))) {
 				flag &= ~MAG_DATA_READY;
 				flag &= ~FUSION_DATA_READY;
 			}
-		}
 
-		if (flag & FUSION_DATA_READY) {
-			if (AKFS_Get_ORIENTATION(prms, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
-				sv_ori.x = tmpx;
-				sv_ori.y = tmpy;
-				sv_ori.z = tmpz;
-				sv_ori.status = tmp_accuracy;
-			} else {
-				flag &= ~FUSION_DATA_READY;
+			if (flag & FUSION_DATA_READY) {
+				if (AKFS_Get_ORIENTATION(prms, &tmpx, &tmpy, &tmpz, &tmp_accuracy) == AKM_SUCCESS) {
+					sv_ori.x = tmpx;
+					sv_ori.y = tmpy;
+					sv_ori.z = tmpz;
+					sv_ori.status = tmp_accuracy;
+				} else {
+					flag &= ~FUSION_DATA_READY;
+				}
 			}
-		}
-
-		/* Output result */
-		AKFS_OutputResult(flag, &sv_acc, &sv_mag, &sv_ori);
-
-		/* Ending time */
-		if (clock_gettime(CLOCK_MONOTONIC, &tsend) < 0) {
-			AKMERROR;
-			goto MEASURE_END;
-		}
 
-		/* Calculate duration */
-		doze = AKFS_CalcSleep(&tsend, &tsstart, minimum);
-		AKMDEBUG(AKMDATA_LOOP, "Sleep: %6.2f msec\n", (doze.tv_nsec/1000000.0f));
-		nanosleep(&doze, NULL);
+			if (flag & FUSION_DATA_READY) {
+				/* The last one is kept if magnetic vector is parallel to gravity */
+				if (AKFS_Get_ROTATION_VECTOR(prms, &tmpx, &tmpy, &tmpz, &tmpw, &tmp_accuracy) == AKM_SUCCESS) {
+					sv_rv[0] = tmpx;
+					sv_rv[1] = tmpy;
+					sv_rv[2] = tmpz;
+					sv_rv[3] = tmpw;
+				}
+			}
 
-#ifdef WIN32
-		if (_kbhit()) {
-			_getch();
-			break;
+			/* Output result */
+			flag &= smp[n - 1].enabled;
+			if (flag) {
+				AKFS_OutputResult(flag, &sv_acc, &sv_mag, &sv_ori, sv_rv);
+			}
+			s_pipe.still = AKFS_IsStill(prms);
+			AKFS_DonePipe(&s_pipe, smp, n);
 		}
-#endif
 	}
 
-MEASURE_END:
-	/* Set to PowerDown mode */
-	if (AKD_SetMode(AKM_MODE_POWERDOWN) != AKD_SUCCESS) {
-		AKMERROR;
+COMPUTE_END:
+	if (started) {
+		s_pipe.stop = 1;
+		pthread_join(acqthread, NULL);
 	}
+	AKFS_PrintPipe(&s_pipe);
+	AKFS_ReleasePipe(&s_pipe);
 
 	/* Save parameters */
 	if (AKFS_Stop(prms, CSPEC_SETTING_FILE) != AKM_SUCCESS) {
@@ -365,6 +1777,24 @@ MEASURE_END:
 	}
 	return ((void*)0);
 }
+#endif
+
+/*!
+  Wake measurement thread up, so that it checks g_stopRequest. Only
+   #thread_reactor needs this, #thread_main wakes up periodically.
+ */
+static void WakeClone(void)
+{
+#ifndef WIN32
+	uint64_t val = 1;
+
+	if (s_ctlfd >= 0) {
+		if (write(s_ctlfd, &val, sizeof(val)) < 0) {
+			AKMERROR_STR("write");
+		}
+	}
+#endif
+}
 
 /*!
   Signal handler.  This should be used only in DEBUG mode.
@@ -376,11 +1806,48 @@ static void signal_handler(int sig)
 		AKMERROR;
 		g_stopRequest = 1;
 		g_mainQuit = AKD_TRUE;
+		WakeClone();
+	}
+}
+
+/*!
+ A thread function which is raised at the first open of device driver, and
+ kept until the daemon quits. While device driver is closed, it parks on
+ #s_workcond. When it is opened, #s_measure is run, so that no thread is
+ created at each open and the state of library is kept in memory.
+ @param[in] args Pointer to #AKMPRMS.
+ */
+static void* thread_worker(void* args)
+{
+	int state;
+
+	for (;;) {
+		pthread_mutex_lock(&s_workmutex);
+		while (s_workstate == AKM_WORK_PARKED) {
+			pthread_cond_wait(&s_workcond, &s_workmutex);
+		}
+		state = s_workstate;
+		pthread_mutex_unlock(&s_workmutex);
+		if (state == AKM_WORK_QUIT) {
+			break;
+		}
+
+		s_measure(args);
+
+		/* Measurement finishes by stop request or error */
+		pthread_mutex_lock(&s_workmutex);
+		if (s_workstate == AKM_WORK_RUN) {
+			s_workstate = AKM_WORK_PARKED;
+		}
+		pthread_cond_broadcast(&s_workcond);
+		pthread_mutex_unlock(&s_workmutex);
 	}
+	return ((void*)0);
 }
 
 /*!
- Starts new thread.
+ Starts measurement on the worker thread. The thread is created only at the
+ first time.
  @return If this function succeeds, the return value is 1. Otherwise,
  the return value is 0.
  */
@@ -388,13 +1855,76 @@ static int startClone(void *mem)
 {
 	pthread_attr_t attr;
 
-	pthread_attr_init(&attr);
 	g_stopRequest = 0;
-	if (pthread_create(&s_thread, &attr, thread_main, mem) == 0) {
-		return 1;
-	} else {
-		return 0;
+	s_measure = thread_main;
+#ifndef WIN32
+	if (s_reactor) {
+		s_ctlfd = eventfd(0, EFD_NONBLOCK);
+		if (s_ctlfd < 0) {
+			AKMERROR_STR("eventfd");
+			return 0;
+		}
+		s_measure = thread_reactor;
+	} else if (s_split) {
+		s_measure = thread_compute;
+	}
+#endif
+	if (!s_workstarted) {
+		pthread_attr_init(&attr);
+		if (pthread_create(&s_thread, &attr, thread_worker, mem) != 0) {
+#ifndef WIN32
+			if (s_ctlfd >= 0) {
+				close(s_ctlfd);
+				s_ctlfd = -1;
+			}
+#endif
+			return 0;
+		}
+		s_workstarted = 1;
+	}
+
+	pthread_mutex_lock(&s_workmutex);
+	s_workstate = AKM_WORK_RUN;
+	pthread_cond_broadcast(&s_workcond);
+	pthread_mutex_unlock(&s_workmutex);
+	return 1;
+}
+
+/*!
+ Stops measurement which is started by #startClone, and waits until the
+ worker thread parks.
+ */
+static void stopClone(void)
+{
+	g_stopRequest = 1;
+	WakeClone();
+	pthread_mutex_lock(&s_workmutex);
+	while (s_workstarted && (s_workstate != AKM_WORK_PARKED)) {
+		pthread_cond_wait(&s_workcond, &s_workmutex);
+	}
+	pthread_mutex_unlock(&s_workmutex);
+#ifndef WIN32
+	if (s_ctlfd >= 0) {
+		close(s_ctlfd);
+		s_ctlfd = -1;
+	}
+#endif
+}
+
+/*!
+ Terminates the worker thread, which must be parked by #stopClone.
+ */
+static void quitClone(void)
+{
+	if (!s_workstarted) {
+		return;
 	}
+	pthread_mutex_lock(&s_workmutex);
+	s_workstate = AKM_WORK_QUIT;
+	pthread_cond_broadcast(&s_workcond);
+	pthread_mutex_unlock(&s_workmutex);
+	pthread_join(s_thread, NULL);
+	s_workstarted = 0;
 }
 
 /*!
@@ -434,8 +1964,42 @@ int OptParse(
 
 	*layout_patno = PAT_INVALID;
 
-	while ((opt = getopt(argc, argv, "sm:z:")) != -1) {
+	while ((opt = getopt(argc, argv, "a:b:cef:lpr:sm:tz:")) != -1) {
 		switch(opt){
+			case 'a':
+				optVal = (char)(optarg[0] - '0');
+				if ((AKFS_AOC_4POINTS <= optVal) && (optVal <= AKFS_AOC_ELLIPSOID)) {
+					s_aocmode = (AKFS_AOC_MODE)optVal;
+					AKMDEBUG(AKMDATA_DEBUG, "%s: AOC=%d\n", __FUNCTION__, optVal);
+				}
+				break;
+			case 'b':
+				s_cpumask = strtoul(optarg, (char**)NULL, 0);
+				AKMDEBUG(AKMDATA_DEBUG, "%s: CPU mask=0x%lx\n", __FUNCTION__, s_cpumask);
+				break;
+			case 'c':
+#ifdef AKM_MODE_CONT1_MEASURE
+				s_contmode = 1;
+				AKMDEBUG(AKMDATA_DEBUG, "%s: Continuous mode\n", __FUNCTION__);
+#else
+				AKMERROR_STR("No continuous measurement mode");
+#endif
+				break;
+			case 'e':
+				s_reactor = 1;
+				AKMDEBUG(AKMDATA_DEBUG, "%s: Reactor loop\n", __FUNCTION__);
+				break;
+			case 'f':
+				optVal = (char)(optarg[0] - '0');
+				if ((AKFS_FILTER_BOX <= optVal) && (optVal <= AKFS_FILTER_ADAPTIVE)) {
+					s_filter = (AKFS_FILTER_MODE)optVal;
+					AKMDEBUG(AKMDATA_DEBUG, "%s: Filter=%d\n", __FUNCTION__, optVal);
+				}
+				break;
+			case 'l':
+				s_memlock = 1;
+				AKMDEBUG(AKMDATA_DEBUG, "%s: Lock memory\n", __FUNCTION__);
+				break;
 			case 'm':
 				optVal = (char)(optarg[0] - '0');
 				if ((PAT1 <= optVal) && (optVal <= PAT8)) {
@@ -443,9 +2007,26 @@ int OptParse(
 					AKMDEBUG(AKMDATA_DEBUG, "%s: Layout=%d\n", __FUNCTION__, optVal);
 				}
 				break;
+			case 'p':
+				s_pipeline = 1;
+				AKMDEBUG(AKMDATA_DEBUG, "%s: Pipeline\n", __FUNCTION__);
+				break;
+			case 'r':
+				s_rtprio = atoi(optarg);
+				if ((s_rtprio < sched_get_priority_min(SCHED_FIFO)) ||
+					(s_rtprio > sched_get_priority_max(SCHED_FIFO))) {
+					AKMERROR_STR("Invalid priority");
+					return 0;
+				}
+				AKMDEBUG(AKMDATA_DEBUG, "%s: SCHED_FIFO=%d\n", __FUNCTION__, s_rtprio);
+				break;
 			case 's':
 				g_opmode |= OPMODE_CONSOLE;
 				break;
+			case 't':
+				s_split = 1;
+				AKMDEBUG(AKMDATA_DEBUG, "%s: Acquisition thread\n", __FUNCTION__);
+				break;
             case 'z':
                 /* If error detected, hopefully 0 is returned. */
                 errno = 0;
@@ -491,6 +2072,11 @@ void ConsoleMode(void *mem)
 			thread_main(mem);
 			break;
 
+		case MODE_Stat:
+			/* Statistics of the last measurement */
+			LoopStatPrint(&s_loopstat, AKMDATA_CONSOLE);
+			break;
+
 		case MODE_Quit:
 			return;
 
@@ -529,6 +2115,13 @@ int main(int argc, char **argv)
 		goto MAIN_QUIT;
 	}
 
+#ifndef WIN32
+	/* Keep pages resident, so that measurement does not wait for them. */
+	if (s_memlock && (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)) {
+		AKMERROR_STR("mlockall");
+	}
+#endif
+
 	/* Self Test */
 	/*
 	if (g_opmode & OPMODE_FST){
@@ -549,6 +2142,24 @@ int main(int argc, char **argv)
 		retValue = ERROR_INIT;
 		goto MAIN_QUIT;
 	}
+	if (AKFS_SetAOCMode(&prms, s_aocmode) != AKM_SUCCESS) {
+		retValue = ERROR_INIT;
+		goto MAIN_QUIT;
+	}
+	if (AKFS_SetFilterMode(&prms, s_filter) != AKM_SUCCESS) {
+		retValue = ERROR_INIT;
+		goto MAIN_QUIT;
+	}
+	/* Keep offset estimation out of the measurement loop. */
+	if (AKFS_SetCalibAsync(&prms, 1) != AKM_SUCCESS) {
+		retValue = ERROR_INIT;
+		goto MAIN_QUIT;
+	}
+	/* Skip calculation while the device is still. */
+	if (AKFS_SetStillDetect(&prms, 1) != AKM_SUCCESS) {
+		retValue = ERROR_INIT;
+		goto MAIN_QUIT;
+	}
 
 	/* Start console mode */
 	if (g_opmode & OPMODE_CONSOLE) {
@@ -570,7 +2181,7 @@ int main(int argc, char **argv)
 			AKMDEBUG(AKMDATA_LOOP, "Compass Opened.");
 			/* Reset flag */
 			g_stopRequest = 0;
-			/* Start measurement thread. */
+			/* Start measurement, the thread is kept across cycles. */
 			if (startClone((void *)&prms) == 0) {
 				retValue = ERROR_STARTCLONE;
 				goto MAIN_QUIT;
@@ -581,14 +2192,15 @@ int main(int argc, char **argv)
 				retValue = ERROR_GETCLOSE_STAT;
 				g_mainQuit = AKD_TRUE;
 			}
-			/* Wait thread completion. */
-			g_stopRequest = 1;
-			pthread_join(s_thread, NULL);
+			/* Wait until measurement stops. */
+			stopClone();
 			AKMDEBUG(AKMDATA_LOOP, "Compass Closed.");
 		}
 	}
 
 MAIN_QUIT:
+	/* Terminate measurement thread */
+	quitClone();
 
 	/* Release library */
 	AKFS_Release(&prms);
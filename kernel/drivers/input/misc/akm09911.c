@@ -28,6 +28,7 @@
 #include <linux/irq.h>
 #include <linux/miscdevice.h>
 #include <linux/module.h>
+#include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <linux/workqueue.h>
@@ -68,6 +69,9 @@ struct akm_compass_data {
 
 	atomic_t	active;
 	atomic_t	drdy;
+	/* Non-zero when enable flag or delay is changed after the last
+	   ECS_IOCTL_GET_DELAY. Reported as POLLPRI. */
+	atomic_t	config;
 
 	char layout;
 	int	irq;
@@ -266,6 +270,21 @@ static int AKECS_Reset(
 	return err;
 }
 
+static int AKECS_Set_Continuous(
+	struct akm_compass_data *akm,
+	uint8_t mode)
+{
+	int err;
+
+	/* Mode has to be changed via powerdown mode */
+	err = AKECS_Set_PowerDown(akm);
+	if (err < 0)
+		return err;
+
+	/* Data is read on each DRDY, without setting mode again */
+	return AKECS_Set_CNTL(akm, mode);
+}
+
 static int AKECS_SetMode(
 	struct akm_compass_data *akm,
 	uint8_t mode)
@@ -278,6 +297,12 @@ static int AKECS_SetMode(
 	case AKM_MODE_FUSE_ACCESS:
 		err = AKECS_Set_CNTL(akm, mode);
 		break;
+	case AKM_MODE_CONT1_MEASURE:
+	case AKM_MODE_CONT2_MEASURE:
+	case AKM_MODE_CONT3_MEASURE:
+	case AKM_MODE_CONT4_MEASURE:
+		err = AKECS_Set_Continuous(akm, mode);
+		break;
 	case AKM_MODE_POWERDOWN:
 		err = AKECS_Set_PowerDown(akm);
 		break;
@@ -449,6 +474,26 @@ static int AKECS_Release(struct inode *inode, struct file *file)
 	return 0;
 }
 
+/* POLLIN is set when measurement data is ready, i.e. ECS_IOCTL_GET_DATA
+ * does not block. DRDY is known only by the interrupt, so POLLIN is never
+ * set without IRQ (see ECS_IOCTL_GET_DRDY_IRQ).
+ * POLLPRI is set when enable flag or delay is changed.
+ */
+static unsigned int AKECS_Poll(struct file *file, poll_table *wait)
+{
+	struct akm_compass_data *akm = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &akm->drdy_wq, wait);
+
+	if (akm->irq && atomic_read(&akm->drdy))
+		mask |= POLLIN | POLLRDNORM;
+	if (atomic_read(&akm->config))
+		mask |= POLLPRI;
+
+	return mask;
+}
+
 static long
 AKECS_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
@@ -462,7 +507,7 @@ AKECS_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	int64_t delay[AKM_NUM_SENSORS];	/* for GET_DELAY */
 	int16_t acc_buf[3];	/* for GET_ACCEL */
 	uint8_t mode;			/* for SET_MODE*/
-	int status;			/* for OPEN/CLOSE_STATUS */
+	int status;			/* for OPEN/CLOSE_STATUS, DRDY_IRQ */
 	int ret = 0;		/* Return value. */
 
 	switch (cmd) {
@@ -503,6 +548,7 @@ AKECS_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ECS_IOCTL_GET_CLOSE_STATUS:
 	case ECS_IOCTL_GET_DELAY:
 	case ECS_IOCTL_GET_LAYOUT:
+	case ECS_IOCTL_GET_DRDY_IRQ:
 	case ECS_IOCTL_GET_ACCEL:
 		/* Check buffer pointer for writing a data later. */
 		if (argp == NULL) {
@@ -583,6 +629,7 @@ AKECS_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ECS_IOCTL_GET_DELAY:
 		dev_vdbg(&akm->i2c->dev, "IOCTL_GET_DELAY called.");
 		mutex_lock(&akm->val_mutex);
+		atomic_set(&akm->config, 0);
 		delay[0] = ((akm->enable_flag & ACC_DATA_READY) ?
 				akm->delay[0] : -1);
 		delay[1] = ((akm->enable_flag & MAG_DATA_READY) ?
@@ -600,6 +647,10 @@ AKECS_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ECS_IOCTL_GET_LAYOUT:
 		dev_vdbg(&akm->i2c->dev, "IOCTL_GET_LAYOUT called.");
 		break;
+	case ECS_IOCTL_GET_DRDY_IRQ:
+		dev_vdbg(&akm->i2c->dev, "IOCTL_GET_DRDY_IRQ called.");
+		status = (akm->irq ? 1 : 0);
+		break;
 	case ECS_IOCTL_GET_ACCEL:
 		dev_vdbg(&akm->i2c->dev, "IOCTL_GET_ACCEL called.");
 		mutex_lock(&akm->accel_mutex);
@@ -660,6 +711,12 @@ AKECS_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			return -EFAULT;
 		}
 		break;
+	case ECS_IOCTL_GET_DRDY_IRQ:
+		if (copy_to_user(argp, &status, sizeof(status))) {
+			dev_err(&akm->i2c->dev, "copy_to_user failed.");
+			return -EFAULT;
+		}
+		break;
 	case ECS_IOCTL_GET_ACCEL:
 		if (copy_to_user(argp, &acc_buf, sizeof(acc_buf))) {
 			dev_err(&akm->i2c->dev, "copy_to_user failed.");
@@ -678,6 +735,7 @@ static const struct file_operations AKECS_fops = {
 	.open = AKECS_Open,
 	.release = AKECS_Release,
 	.unlocked_ioctl = AKECS_ioctl,
+	.poll = AKECS_Poll,
 };
 
 static struct miscdevice akm_compass_dev = {
@@ -775,6 +833,14 @@ static void remove_device_binary_attributes(
  */
 
 /***** sysfs enable *************************************************/
+/* Let the daemon know that it should read delay again. */
+static void akm_compass_sysfs_notify_config(
+	struct akm_compass_data *akm)
+{
+	atomic_set(&akm->config, 1);
+	wake_up(&akm->drdy_wq);
+}
+
 static void akm_compass_sysfs_update_status(
 	struct akm_compass_data *akm)
 {
@@ -833,6 +899,7 @@ static ssize_t akm_compass_sysfs_enable_store(
 	mutex_unlock(&akm->val_mutex);
 
 	akm_compass_sysfs_update_status(akm);
+	akm_compass_sysfs_notify_config(akm);
 
 	return count;
 }
@@ -913,6 +980,8 @@ static ssize_t akm_compass_sysfs_delay_store(
 	akm->delay[pos] = val;
 	mutex_unlock(&akm->val_mutex);
 
+	akm_compass_sysfs_notify_config(akm);
+
 	return count;
 }
 
@@ -1425,6 +1494,7 @@ int akm_compass_probe(struct i2c_client *client, const struct i2c_device_id *id)
 
 	atomic_set(&s_akm->active, 0);
 	atomic_set(&s_akm->drdy, 0);
+	atomic_set(&s_akm->config, 0);
 
 	s_akm->is_busy = 0;
 	s_akm->enable_flag = 0;
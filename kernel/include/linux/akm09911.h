@@ -29,6 +29,10 @@
 #define AK09911_FUSE_ASAZ			0x62
 
 #define AK09911_MODE_SNG_MEASURE	0x01
+#define AK09911_MODE_CONT1_MEASURE	0x02
+#define AK09911_MODE_CONT2_MEASURE	0x04
+#define AK09911_MODE_CONT3_MEASURE	0x06
+#define AK09911_MODE_CONT4_MEASURE	0x08
 #define AK09911_MODE_SELF_TEST		0x10
 #define AK09911_MODE_FUSE_ACCESS	0x1F
 #define AK09911_MODE_POWERDOWN		0x00
@@ -47,6 +51,11 @@
 #define AKM_REG_RESET			AK09911_REG_CNTL3
 #define AKM_REG_STATUS			AK09911_REG_ST1
 #define AKM_MEASURE_TIME_US		10000
+/* Interval of continuous measurement modes, from slow to fast */
+#define AKM_CONT1_INTERVAL_US	100000
+#define AKM_CONT2_INTERVAL_US	50000
+#define AKM_CONT3_INTERVAL_US	20000
+#define AKM_CONT4_INTERVAL_US	10000
 #define AKM_DRDY_IS_HIGH(x)		((x) & 0x01)
 #define AKM_SENSOR_INFO_SIZE	2
 #define AKM_SENSOR_CONF_SIZE	3
@@ -59,6 +68,10 @@
 #define AKM_FUSE_1ST_ADDR		AK09911_FUSE_ASAX
 
 #define AKM_MODE_SNG_MEASURE	AK09911_MODE_SNG_MEASURE
+#define AKM_MODE_CONT1_MEASURE	AK09911_MODE_CONT1_MEASURE
+#define AKM_MODE_CONT2_MEASURE	AK09911_MODE_CONT2_MEASURE
+#define AKM_MODE_CONT3_MEASURE	AK09911_MODE_CONT3_MEASURE
+#define AKM_MODE_CONT4_MEASURE	AK09911_MODE_CONT4_MEASURE
 #define AKM_MODE_SELF_TEST		AK09911_MODE_SELF_TEST
 #define AKM_MODE_FUSE_ACCESS	AK09911_MODE_FUSE_ACCESS
 #define AKM_MODE_POWERDOWN		AK09911_MODE_POWERDOWN
@@ -88,6 +101,7 @@
 #define ECS_IOCTL_GET_CLOSE_STATUS	_IOR(AKMIO, 0x24, int)
 #define ECS_IOCTL_GET_DELAY			_IOR(AKMIO, 0x25, long long int)
 #define ECS_IOCTL_GET_LAYOUT		_IOR(AKMIO, 0x26, char)
+#define ECS_IOCTL_GET_DRDY_IRQ		_IOR(AKMIO, 0x27, int)
 #define ECS_IOCTL_GET_ACCEL			_IOR(AKMIO, 0x30, short[3])
 
 struct akm09911_platform_data {
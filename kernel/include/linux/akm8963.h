@@ -29,6 +29,8 @@
 #define AK8963_FUSE_ASAZ	0x12
 
 #define AK8963_MODE_SNG_MEASURE		0x11
+#define AK8963_MODE_CONT1_MEASURE	0x12
+#define AK8963_MODE_CONT2_MEASURE	0x16
 #define AK8963_MODE_SELF_TEST		0x18
 #define AK8963_MODE_FUSE_ACCESS		0x0F
 #define AK8963_MODE_POWERDOWN		0x00
@@ -46,6 +48,9 @@
 #define AKM_REG_RESET			AK8963_REG_CNTL2
 #define AKM_REG_STATUS			AK8963_REG_ST1
 #define AKM_MEASURE_TIME_US		10000
+/* Interval of continuous measurement modes, from slow to fast */
+#define AKM_CONT1_INTERVAL_US	125000
+#define AKM_CONT2_INTERVAL_US	10000
 #define AKM_DRDY_IS_HIGH(x)		((x) & 0x01)
 #define AKM_SENSOR_INFO_SIZE	2
 #define AKM_SENSOR_CONF_SIZE	3
@@ -58,6 +63,8 @@
 #define AKM_FUSE_1ST_ADDR		AK8963_FUSE_ASAX
 
 #define AKM_MODE_SNG_MEASURE	AK8963_MODE_SNG_MEASURE
+#define AKM_MODE_CONT1_MEASURE	AK8963_MODE_CONT1_MEASURE
+#define AKM_MODE_CONT2_MEASURE	AK8963_MODE_CONT2_MEASURE
 #define AKM_MODE_SELF_TEST		AK8963_MODE_SELF_TEST
 #define AKM_MODE_FUSE_ACCESS	AK8963_MODE_FUSE_ACCESS
 #define AKM_MODE_POWERDOWN		AK8963_MODE_POWERDOWN
@@ -87,6 +94,7 @@
 #define ECS_IOCTL_GET_CLOSE_STATUS	_IOR(AKMIO, 0x24, int)
 #define ECS_IOCTL_GET_DELAY			_IOR(AKMIO, 0x25, long long int)
 #define ECS_IOCTL_GET_LAYOUT		_IOR(AKMIO, 0x26, char)
+#define ECS_IOCTL_GET_DRDY_IRQ		_IOR(AKMIO, 0x27, int)
 #define ECS_IOCTL_GET_ACCEL			_IOR(AKMIO, 0x30, short[3])
 
 struct akm8963_platform_data {
@@ -87,6 +87,7 @@
 #define ECS_IOCTL_GET_CLOSE_STATUS	_IOR(AKMIO, 0x24, int)
 #define ECS_IOCTL_GET_DELAY			_IOR(AKMIO, 0x25, long long int)
 #define ECS_IOCTL_GET_LAYOUT		_IOR(AKMIO, 0x26, char)
+#define ECS_IOCTL_GET_DRDY_IRQ		_IOR(AKMIO, 0x27, int)
 #define ECS_IOCTL_GET_ACCEL			_IOR(AKMIO, 0x30, short[3])
 
 struct akm8975_platform_data {